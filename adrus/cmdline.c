@@ -21,6 +21,7 @@
 #define _GNU_SOURCE
 
 #include <cmdline.h>
+#include <stdlib.h>
 
 typedef struct {
     char **args;
@@ -112,18 +113,60 @@ static bool take_tag(args_t *args, db_t *db, db_tag_t *f) {
     return true;
 }
 
+// consume next argument if it names a saved query (@foo)
+static bool take_query(args_t *args, const char **query) {
+    char *arg = peek(args);
+    if (!arg || *arg != '@') return false;
+
+    *query = arg + 1;
+    take(args);
+
+    return true;
+}
+
+// consume leading options (--limit N, --stats)
+static jb_res_t take_opts(args_t *args, cmdline_t *cmd) {
+    char *arg;
+    while ((arg = peek(args)) && strncmp(arg, "--", 2) == 0) {
+        take(args);
+
+        if (strcmp(arg, "--limit") == 0) {
+            char *val = take(args);
+            if (!val) return JB_ERR(JB_ERR_USER, "expected number after '--limit'");
+
+            char *endptr;
+            cmd->limit = strtoull(val, &endptr, 10);
+            if (!*val || *endptr) return JB_ERR(JB_ERR_USER, "invalid limit '%s'", val);
+        } else if (strcmp(arg, "--stats") == 0) {
+            cmd->stats = true;
+        } else {
+            return JB_ERR(JB_ERR_USER, "unknown option '%s'", arg);
+        }
+    }
+
+    return JB_OK_VAL;
+}
+
 jb_res_t cmdline_parse(cmdline_t *cmd, db_t *db, int argc, char *argv[]) {
     db_tag_t *buf = JB_BUF;
     args_t args = {argv, argc, 1};
 
     memset(cmd->path, 0, PATH_MAX + 1);
     cmd->len = 0;
+    cmd->query = NULL;
+    cmd->limit = 0;
+    cmd->stats = false;
+
+    JB_TRY(take_opts(&args, cmd));
+
     cmd->cmd = take_one_of(&args, (one_of_t){"rm", CMD_RM}, (one_of_t){"ls", CMD_LS});
 
     if (cmd->cmd != CMD_QUERY) {
         if (!take_path(&args, cmd->path) || argc < 3)
             return JB_ERR(JB_ERR_USER, "usage: %s [PATH] +/-[TAG]...", argv[1]);
 
+        if (cmd->cmd == CMD_LS) take_query(&args, &cmd->query);
+
         db_tag_t f;
         while (take_tag(&args, db, &f)) {
             if (cmd->cmd == CMD_OPEN) cmd->cmd = CMD_MODIFY;
@@ -143,7 +186,10 @@ jb_res_t cmdline_parse(cmdline_t *cmd, db_t *db, int argc, char *argv[]) {
         return JB_OK_VAL;
     }
 
-    if (take_path(&args, cmd->path)) cmd->cmd = CMD_OPEN;
+    if (take_path(&args, cmd->path))
+        cmd->cmd = CMD_OPEN;
+    else
+        take_query(&args, &cmd->query);
 
     db_tag_t f;
     while (take_tag(&args, db, &f)) {
@@ -36,6 +36,10 @@ typedef struct {
 
     db_tag_t *tags;
     size_t len;
+
+    const char *query; // saved query to filter by (`@NAME`), or NULL
+    size_t limit;  // maximum number of results (0 = unlimited)
+    bool stats;    // print performance counters on exit
 } cmdline_t;
 
 jb_res_t cmdline_parse(cmdline_t *cmd, db_t *db, int argc, char *argv[]);
@@ -19,12 +19,14 @@
 #define _XOPEN_SOURCE 500
 #define _GNU_SOURCE
 
-#include <ctype.h>
 #include <db.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <fnmatch.h>
 #include <jbase.h>
+#include <pthread.h>
+#include <stats.h>
 #include <stdio.h>
 #include <string.h>
 #include <util.h>
@@ -33,76 +35,209 @@
 #include "stdlib.h"
 #include "unistd.h"
 
-JB_TLOCAL static db_t temp;
+// state of a streaming query; see `db_stream`
+typedef struct {
+    const char *glob;
+    db_tag_t *filter;
+    size_t len;
+    const db_pred_t *pred;
+
+    size_t limit, count;
+
+    void *state;
+    db_cb_t cb;
+
+    tag_entry_t **tags;  // filtered tags present on the current note (reused across notes)
+} stream_t;
+
+// database being scanned by the current thread's nftw walk
+JB_TLOCAL static db_t *scan_db;
+// streaming query being evaluated during the walk (NULL when building the database)
+JB_TLOCAL static stream_t *scan_stream;
+
+// heads of the files found by the walk are read a batch at a time; one page covers almost any
+// header, and the rare longer one is re-read with `scan_reader`
+JB_TLOCAL static jb_batch_t scan_batch;
+JB_TLOCAL static jb_reader_t scan_reader;
+// stat results of the files in the current batch
+JB_TLOCAL static struct stat *scan_stats;
+// length of the directory part of each path in the current batch, for its span
+JB_TLOCAL static size_t *scan_dir_lens;
+
+#define HDR_BUF 4096
+#define BATCH_DEPTH 64
+
+// characters allowed in a header after the magic: whitespace, alphanumerics and '_'
+static jb_cclass_t hdr_class;
+static pthread_once_t hdr_class_once = PTHREAD_ONCE_INIT;
+
+static void hdr_class_init() {
+    jb_cc_init(&hdr_class);
+    jb_cc_add_range(&hdr_class, 'a', 'z');
+    jb_cc_add_range(&hdr_class, 'A', 'Z');
+    jb_cc_add_range(&hdr_class, '0', '9');
+    jb_cc_add_range(&hdr_class, '\t', '\r');
+    jb_cc_add_chars(&hdr_class, " _");
+}
 
-// read line into a jb_buf
-static jb_res_t read_line(FILE *f, char **out) {
-    char *buf = JB_BUF;
-    char c;
+// make sure header is valid
+static bool validate_hdr(jb_view_t hdr) {
+    if (hdr.len < 5 || memcmp(hdr.ptr, "adrus", 5) != 0) return false;
 
-    // read file until error or
-    int res;
-    while ((res = fread(&c, 1, 1, f)) == 1) {
-        if (c == '\n') break;
+    pthread_once(&hdr_class_once, hdr_class_init);
 
-        jb_buf_push(buf, c);
-    }
+    return jb_cc_span(&hdr_class, hdr.ptr + 5, hdr.len - 5) == hdr.len - 5;
+}
 
-    if (ferror(f)) return JB_ERR_LIBC(errno, "read_line failed");
+static bool note_has_tag(note_entry_t *note, tag_entry_t *tag) {
+    for (size_t i = 0; i < note->len; i++)
+        if (note->tags[i] == tag) return true;
 
-    jb_buf_push(buf, '\0');
-    // jb_trace("%s", buf);
+    return false;
+}
 
-    size_t len = jb_buf_len(buf);
-    *out = malloc(len + 1);
-    memcpy(*out, buf, len);
-    (*out)[len] = '\0';
+// tags already on a note, checked without a hash lookup (notes carry few tags)
+static bool note_has_tag_name(note_entry_t *note, const char *tag) {
+    for (size_t i = 0; i < note->len; i++)
+        if (strcmp(note->tags[i]->tag, tag) == 0) return true;
 
-    return JB_OK_VAL;
+    return false;
 }
 
-static bool valid_hdr_char(char c) {
-    return isspace(c) || isalnum(c) || c == '_';
+static bool note_matches(note_entry_t *note, db_tag_t *filter, size_t len,
+                         const db_pred_t *pred) {
+    for (size_t f = 0; f < len; f++) {
+        // fail matching if note has tag, and tag expected
+        if (note_has_tag(note, filter[f].tag) != filter[f].sign) return false;
+    }
+
+    return !pred || pred->fn(pred->state, note);
 }
 
-// make sure header is valid
-static bool validate_hdr(char *hdr) {
-    while (*hdr) {
-        if (!valid_hdr_char(*hdr)) return false;
-        hdr++;
+// evaluate the streaming query against a single note header; returns false once the limit is hit
+static bool stream_note(stream_t *st, const char *name, const char *hdr, const struct stat *sb) {
+    if (st->glob && fnmatch(st->glob, name, FNM_EXTMATCH) != 0) return true;
+
+    jb_buf_truncate(st->tags, 0);
+
+    // only tags named in the filter are defined in the database, so any other tag is skipped,
+    // unless a predicate needs to see them all
+    int n = 0;
+    for (;;) {
+        char tag_buf[TAG_MAX];
+        int res = sscanf(hdr, " %31[a-z]%n", tag_buf, &n);
+        if (res != 1) break;
+        hdr += n;
+
+        STAT_INC(STAT_TAGS_SEEN);
+
+        tag_entry_t *tag = st->pred ? db_def_tag(scan_db, tag_buf) : db_get_tag(scan_db, tag_buf);
+        if (tag) jb_buf_push(st->tags, tag);
     }
 
-    return true;
+    note_entry_t note;
+    strncpy(note.path, name, PATH_MAX - 1);
+    note.path[PATH_MAX - 1] = '\0';
+    note.ctime = sb->st_ctime;
+    note.mtime = sb->st_mtime;
+    note.tags = st->tags;
+    note.len = jb_buf_len(st->tags);
+    note.cap = jb_buf_cap(st->tags);
+    note.next = NULL;
+
+    STAT_INC(STAT_CANDIDATES);
+    if (!note_matches(&note, st->filter, st->len, st->pred)) return true;
+    STAT_INC(STAT_MATCHES);
+
+    st->cb(scan_db, st->state, &note);
+
+    return st->limit == 0 || ++st->count < st->limit;
+}
+
+// tags seen in the current batch, by hash, so each distinct tag costs one database lookup per
+// batch; at most half full, so probing always ends at an empty slot
+#define BATCH_TAGS 512
+
+JB_TLOCAL static tag_entry_t *batch_tags[BATCH_TAGS];
+JB_TLOCAL static size_t batch_tags_len;
+
+static tag_entry_t *batch_tag(const char *tag) {
+    jb_hash_t hash = jb_hash_str(tag);
+    size_t i = hash & (BATCH_TAGS - 1);
+
+    for (tag_entry_t *e; (e = batch_tags[i]); i = (i + 1) & (BATCH_TAGS - 1))
+        if (e->hash == hash && strcmp(e->tag, tag) == 0) return e;
+
+    tag_entry_t *e = db_def_tag_hashed(scan_db, tag, hash);
+    if (batch_tags_len < BATCH_TAGS / 2) {
+        batch_tags[i] = e;
+        batch_tags_len++;
+    }
+
+    return e;
+}
+
+// read a header that didn't fit in the batch's buffer
+static jb_res_t read_long_header(const char *path, jb_view_t *line, bool *got) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return JB_ERR_LIBC(errno, "failed to open file '%s'", path);
+
+    jb_reader_fd(&scan_reader, fd);
+    jb_errno_t err = jb_reader_line(&scan_reader, line, got);
+    close(fd);
+
+    JB_TRY_IO(err, "failed to read file '%s'", path);
+
+    return JB_OK_VAL;
 }
 
-// process file tree
-static jb_res_t process(const char *path, const struct stat *sb) {
-    // char *bname = basename(p);
-    char bname[NAME_MAX];
-    jb_errno_t err = jb_basename(path, bname, NAME_MAX);
-    JB_TRY_IO(err, "failed to get basename of path '%s'", path);
+// process a file read by the batch; sets `*more` to false if the walk should stop
+static jb_res_t process_item(jb_batch_item_t *item, bool *more) {
+    const char *path = item->path;
+    const struct stat *sb = item->user;
 
-    size_t db_path_len = strlen(temp.path);
-    char name[PATH_MAX];
-    strcpy(name, path + db_path_len);
+    if (item->err) return JB_ERR_LIBC(item->err, "failed to read file '%s'", path);
 
-    FILE *f = fopen(bname, "r");
+    STAT_INC(STAT_FILES_OPENED);
+    STAT_ADD(STAT_BYTES_READ, item->len);
 
-    if (!f) return JB_ERR_LIBC(errno, "failed to open file '%s'", path);
+    const char *name = path + strlen(scan_db->path);
 
-    char *line;
-    JB_TRY(read_line(f, &line));
+    // the line is NUL-terminated in the batch's buffer, so it can be parsed in place
+    jb_view_t line = {(const char *)item->data, item->len};
+    bool got = item->len > 0;
 
-    if (!validate_hdr(line) || strncmp(line, "adrus", 5) != 0) {
+    uint8_t *nl = memchr(item->data, '\n', item->len);
+    if (nl) {
+        *nl = '\0';
+        line.len = nl - item->data;
+    } else if (item->len == HDR_BUF) {
+        JB_TRY(read_long_header(path, &line, &got));
+    }
+
+    STAT_BEGIN(PHASE_PARSE);
+    bool valid = got && validate_hdr(line);
+    STAT_END(PHASE_PARSE);
+
+    if (!valid) {
         jb_debug("%s: not adrus file", path);
+        STAT_INC(STAT_REJECTS);
         return JB_OK_VAL;
     }
 
     jb_debug("%s: is adrus file", path);
 
-    db_add_note(&temp, name, sb->st_ctime, sb->st_mtime);
+    if (scan_stream) {
+        *more = stream_note(scan_stream, name, line.ptr + 5, sb);
+        return JB_OK_VAL;
+    }
+
+    STAT_BEGIN(PHASE_INDEX);
+    // one lookup for the note, and one per tag not yet seen in this batch; tags are then linked
+    // by handle
+    note_entry_t *note = db_add_note(scan_db, name, sb->st_ctime, sb->st_mtime);
 
-    char *hdr = line + 5;
+    const char *hdr = line.ptr + 5;
     int n = 0;
     for (;;) {
         char tag_buf[TAG_MAX];
@@ -111,28 +246,146 @@ static jb_res_t process(const char *path, const struct stat *sb) {
         hdr += n;
 
         jb_trace("  tag %s", tag_buf);
+        STAT_INC(STAT_TAGS_SEEN);
 
-        db_tag_note(&temp, name, tag_buf);
+        if (note_has_tag_name(note, tag_buf)) continue;
+
+        db_tag_entry(note, batch_tag(tag_buf));
     }
+    STAT_END(PHASE_INDEX);
 
     return JB_OK_VAL;
 }
 
-static int fs_cb(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
-    (void)ftwbuf;
-    if (typeflag == FTW_F) {
-        jb_res_t res = process(path, sb);
+static jb_res_t process(jb_batch_item_t *item, bool *more) {
+    jb_span_begin("process", item->path);
+    jb_res_t res = process_item(item, more);
+    jb_span_end();
+
+    return res;
+}
+
+// a span per run of files from the same directory, as they're processed rather than found
+static void dir_span(size_t i) {
+    const char *path = scan_batch.items[i].path;
+    size_t len = scan_dir_lens[i];
+
+    if (i > 0) {
+        const char *prev = scan_batch.items[i - 1].path;
+        if (scan_dir_lens[i - 1] == len && strncmp(prev, path, len) == 0) return;
+
+        jb_span_end();
+    }
+
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%.*s", (int)len, path);
+    jb_span_begin("dir", dir);
+}
+
+// read the queued files, and process them in the order they were found
+static void run_batch(bool *more) {
+    jb_span_begin("read batch", NULL);
+    STAT_BEGIN(PHASE_READ);
+    jb_errno_t err = jb_batch_run(&scan_batch);
+    STAT_END(PHASE_READ);
+    jb_span_end();
+
+    // items still carry their own results, so a batch-level error doesn't drop them
+    if (err) jb_error("failed to read notes: %s", strerror(err));
+
+    memset(batch_tags, 0, sizeof(batch_tags));
+    batch_tags_len = 0;
+
+    size_t i = 0;
+    for (; *more && i < scan_batch.len; i++) {
+        if (jb_span_enabled) dir_span(i);
+
+        jb_res_t res = process(&scan_batch.items[i], more);
 
         if (res JB_IS_ERR) {
-            jb_error("%s: %s", path, res.msg);
+            jb_error("%s: %s", scan_batch.items[i].path, res.msg);
             free(res.msg);
         }
     }
 
-    return 0;
+    if (i > 0) jb_span_end();
+
+    jb_batch_clear(&scan_batch);
 }
 
-jb_res_t db_init(db_t *db) {
+static int fs_cb(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
+    bool more = true;
+
+    // a note being rewritten when adrus was interrupted; the note itself is still there
+    if (strncmp(path + ftwbuf->base, JB_TMP_PREFIX, strlen(JB_TMP_PREFIX)) == 0)
+        return FTW_CONTINUE;
+
+    if (typeflag == FTW_F) {
+        STAT_INC(STAT_FILES_VISITED);
+
+        jb_batch_item_t *item = jb_batch_add(&scan_batch, path);
+        if (!item) {
+            run_batch(&more);
+            if (!more) return FTW_STOP;
+
+            item = jb_batch_add(&scan_batch, path);
+        }
+
+        size_t i = item - scan_batch.items;
+        scan_stats[i] = *sb;
+        item->user = &scan_stats[i];
+        scan_dir_lens[i] = ftwbuf->base ? ftwbuf->base - 1 : 0;
+    }
+
+    return FTW_CONTINUE;
+}
+
+// walk the notebook, building the database or evaluating `st` against each note
+static jb_res_t walk(db_t *db, stream_t *st) {
+    jb_errno_t err = jb_batch_init(&scan_batch, BATCH_DEPTH, HDR_BUF, 0);
+    JB_TRY_IO(err, "failed to allocate read batch");
+
+    err = jb_reader_init(&scan_reader, HDR_BUF);
+    scan_stats = malloc(BATCH_DEPTH * sizeof(struct stat));
+    scan_dir_lens = malloc(BATCH_DEPTH * sizeof(size_t));
+
+    if (err || !scan_stats || !scan_dir_lens) {
+        jb_batch_free(&scan_batch);
+        jb_reader_free(&scan_reader);
+        free(scan_stats);
+        free(scan_dir_lens);
+        return JB_ERR_LIBC(err ? err : ENOMEM, "failed to allocate header buffer");
+    }
+
+    scan_db = db;
+    scan_stream = st;
+
+    jb_span_begin(st ? "db_stream" : "db_scan", db->path);
+    STAT_BEGIN(PHASE_SCAN);
+    int res = nftw(db->path, fs_cb, 16, FTW_ACTIONRETVAL);
+    err = errno;
+
+    // the last, partial batch
+    bool more = true;
+    if (res != -1) run_batch(&more);
+
+    STAT_END(PHASE_SCAN);
+    jb_span_end();
+
+    scan_db = NULL;
+    scan_stream = NULL;
+
+    jb_batch_free(&scan_batch);
+    jb_reader_free(&scan_reader);
+    free(scan_stats);
+    free(scan_dir_lens);
+
+    if (res == -1) return JB_ERR_LIBC(err, "failed to walk notebook '%s'", db->path);
+
+    return JB_OK_VAL;
+}
+
+jb_res_t db_open(db_t *db) {
     char *path = getenv("ADRUS_DIR");
 
     if (!path) {
@@ -151,21 +404,54 @@ jb_res_t db_init(db_t *db) {
 
     closedir(dir);
 
-    if (!realpath(path, temp.path))
+    if (!realpath(path, db->path))
         return JB_ERR_LIBC(errno, "failed to get real path of '%s'", path);
 
-    jb_info("scanning notebook '%s'", temp.path);
-
     for (size_t i = 0; i < BUCKETS; i++) {
-        temp.bnotes[i] = NULL;
-        temp.btags[i] = NULL;
+        db->bnotes[i] = NULL;
+        db->btags[i] = NULL;
     }
 
-    nftw(temp.path, fs_cb, 0, FTW_CHDIR);
+    return JB_OK_VAL;
+}
 
-    *db = temp;
+jb_res_t db_scan(db_t *db) {
+    jb_info("scanning notebook '%s'", db->path);
 
-    return JB_OK_VAL;
+    return walk(db, NULL);
+}
+
+jb_res_t db_init(db_t *db) {
+    jb_span_begin("db_init", NULL);
+
+    jb_res_t res = db_open(db);
+    if (!(res JB_IS_ERR)) res = db_scan(db);
+
+    jb_span_end();
+
+    return res;
+}
+
+jb_res_t db_stream(db_t *db, const char *glob, db_tag_t *filter, size_t len,
+                   const db_pred_t *pred, size_t limit, void *state, db_cb_t cb) {
+    jb_info("streaming notebook '%s'", db->path);
+
+    stream_t st = {
+        .glob = glob,
+        .filter = filter,
+        .len = len,
+        .pred = pred,
+        .limit = limit,
+        .count = 0,
+        .state = state,
+        .cb = cb,
+        .tags = JB_BUF,
+    };
+
+    jb_res_t res = walk(db, &st);
+    jb_buf_free(st.tags);
+
+    return res;
 }
 
 static void free_note_chain(note_entry_t *chain) {
@@ -191,30 +477,14 @@ void db_free(db_t *db) {
     }
 }
 
-static note_entry_t *get_note_entry(db_t *db, const char *path) {
-    jb_hash_t hash = jb_fnv1a_str(path);
+tag_entry_t *db_get_tag_hashed(db_t *db, const char *tag, jb_hash_t hash) {
     size_t bucket = hash % BUCKETS;
 
-    note_entry_t *cur = db->bnotes[bucket];
-    while (cur) {
-        jb_trace("cur->path = %s, path = %s", cur->path, path);
-        jb_trace("cur->hash = %lx, hash = %lx", cur->hash, hash);
-        if (cur->hash == hash && strcmp(cur->path, path) == 0) {
-            return cur;
-        }
-
-        cur = cur->next;
-    }
-
-    return NULL;
-}
-
-tag_entry_t *db_get_tag(db_t *db, const char *tag) {
-    jb_hash_t hash = jb_fnv1a_str(tag);
-    size_t bucket = hash % BUCKETS;
+    STAT_INC(STAT_LOOKUPS);
 
     tag_entry_t *entry = db->btags[bucket];
     while (entry) {
+        STAT_INC(STAT_CHAIN_STEPS);
         if (entry->hash == hash && strcmp(entry->tag, tag) == 0) return entry;
         entry = entry->next;
     }
@@ -222,12 +492,18 @@ tag_entry_t *db_get_tag(db_t *db, const char *tag) {
     return NULL;
 }
 
-note_entry_t *db_get_note(db_t *db, const char *path) {
-    jb_hash_t hash = jb_fnv1a_str(path);
+tag_entry_t *db_get_tag(db_t *db, const char *tag) {
+    return db_get_tag_hashed(db, tag, jb_hash_str(tag));
+}
+
+note_entry_t *db_get_note_hashed(db_t *db, const char *path, jb_hash_t hash) {
     size_t bucket = hash % BUCKETS;
 
+    STAT_INC(STAT_LOOKUPS);
+
     note_entry_t *entry = db->bnotes[bucket];
     while (entry) {
+        STAT_INC(STAT_CHAIN_STEPS);
         if (entry->hash == hash && strcmp(entry->path, path) == 0) return entry;
         entry = entry->next;
     }
@@ -235,16 +511,20 @@ note_entry_t *db_get_note(db_t *db, const char *path) {
     return NULL;
 }
 
-tag_entry_t *db_def_tag(db_t *db, const char *tag) {
-    tag_entry_t *entry = db_get_tag(db, tag);
+note_entry_t *db_get_note(db_t *db, const char *path) {
+    return db_get_note_hashed(db, path, jb_hash_str(path));
+}
+
+tag_entry_t *db_def_tag_hashed(db_t *db, const char *tag, jb_hash_t hash) {
+    tag_entry_t *entry = db_get_tag_hashed(db, tag, hash);
     if (entry) return entry;
 
-    jb_hash_t hash = jb_fnv1a_str(tag);
     size_t bucket = hash % BUCKETS;
 
     entry = malloc(sizeof(tag_entry_t));
 
-    memcpy(entry->tag, tag, TAG_MAX);
+    strncpy(entry->tag, tag, TAG_MAX - 1);
+    entry->tag[TAG_MAX - 1] = '\0';
     entry->hash = hash;
     entry->len = 0;
     entry->cap = 16;
@@ -256,88 +536,92 @@ tag_entry_t *db_def_tag(db_t *db, const char *tag) {
     return entry;
 }
 
-void db_add_note(db_t *db, const char *path, time_t ctime, time_t mtime) {
-    note_entry_t *entry = get_note_entry(db, path);
+tag_entry_t *db_def_tag(db_t *db, const char *tag) {
+    return db_def_tag_hashed(db, tag, jb_hash_str(tag));
+}
 
-    if (get_note_entry(db, path)) {
-        jb_warn("note '%s' already registered");
-        return;
+note_entry_t *db_add_note_hashed(db_t *db, const char *path, jb_hash_t hash, time_t ctime,
+                                 time_t mtime) {
+    note_entry_t *entry = db_get_note_hashed(db, path, hash);
+
+    if (entry) {
+        jb_warn("note '%s' already registered", path);
+        return entry;
     }
 
     entry = malloc(sizeof(note_entry_t));
 
     strncpy(entry->path, path, PATH_MAX - 1);
-    entry->hash = jb_fnv1a_str(path);
+    entry->path[PATH_MAX - 1] = '\0';
+    entry->hash = hash;
     entry->ctime = ctime;
     entry->mtime = mtime;
-    entry->next = db->bnotes[entry->hash % BUCKETS];
+    entry->next = db->bnotes[hash % BUCKETS];
 
     entry->len = 0;
     entry->cap = 16;
     entry->tags = malloc(sizeof(tag_entry_t *) * entry->cap);
 
-    db->bnotes[entry->hash % BUCKETS] = entry;
+    db->bnotes[hash % BUCKETS] = entry;
+
+    return entry;
 }
 
-void db_tag_note(db_t *db, const char *path, const char *tag) {
-    tag_entry_t *tag_e = db_def_tag(db, tag);
-    note_entry_t *note_e = get_note_entry(db, path);
+note_entry_t *db_add_note(db_t *db, const char *path, time_t ctime, time_t mtime) {
+    return db_add_note_hashed(db, path, jb_hash_str(path), ctime, mtime);
+}
 
-    if (!note_e) {
-        jb_warn("no note '%s'", path);
-        return;
+void db_tag_entry(note_entry_t *note, tag_entry_t *tag) {
+    if (tag->len >= tag->cap) {
+        tag->cap *= 2;
+        tag->notes = realloc(tag->notes, sizeof(note_entry_t *) * tag->cap);
     }
 
-    if (!tag_e) {
-        jb_error("failed to create tag '%s'", tag);
-        return;
+    if (note->len >= note->cap) {
+        note->cap *= 2;
+        note->tags = realloc(note->tags, sizeof(tag_entry_t *) * note->cap);
     }
 
-    if (tag_e->len >= tag_e->cap) {
-        tag_e->cap *= 2;
-        tag_e->notes = realloc(tag_e->notes, sizeof(note_entry_t *) * tag_e->cap);
-    }
+    tag->notes[tag->len++] = note;
+    note->tags[note->len++] = tag;
+}
 
-    if (note_e->len >= note_e->cap) {
-        note_e->cap *= 2;
-        note_e->tags = realloc(note_e->tags, sizeof(tag_entry_t *) * note_e->cap);
+void db_tag_note(db_t *db, const char *path, const char *tag) {
+    note_entry_t *note_e = db_get_note(db, path);
+
+    if (!note_e) {
+        jb_warn("no note '%s'", path);
+        return;
     }
 
-    tag_e->notes[tag_e->len++] = note_e;
-    note_e->tags[note_e->len++] = tag_e;
+    db_tag_entry(note_e, db_def_tag(db, tag));
 }
 
-static bool note_has_tag(note_entry_t *note, tag_entry_t *tag) {
-    for (size_t i = 0; i < note->len; i++)
-        if (note->tags[i] == tag) return true;
+void db_query(db_t *db, void *state, db_tag_t *filter, size_t len, const db_pred_t *pred,
+              db_cb_t cb) {
+    jb_span_begin("db_query", NULL);
+    STAT_BEGIN(PHASE_QUERY);
 
-    return false;
-}
-
-void db_query(db_t *db, void *state, db_tag_t *filter, size_t len, db_cb_t cb) {
     // iterate through buckets
     for (size_t b = 0; b < BUCKETS; b++) {
         note_entry_t *note = db->bnotes[b];
 
         // iterate through notes in bucket
         while (note) {
-            bool matches = true;
-
-            // iterate through filter
-            for (size_t f = 0; f < len; f++) {
-                if (note_has_tag(note, filter[f].tag) != filter[f].sign) {
-                    // fail matching if note has tag, and tag expected
-                    matches = false;
-                    break;
-                }
-            }
+            STAT_INC(STAT_CANDIDATES);
 
             // pass note to callback if matches filter
-            if (matches) cb(db, state, note);
+            if (note_matches(note, filter, len, pred)) {
+                STAT_INC(STAT_MATCHES);
+                cb(db, state, note);
+            }
 
             note = note->next;
         }
     }
+
+    STAT_END(PHASE_QUERY);
+    jb_span_end();
 }
 
 // jb_res_t db_mut(db_t *db, const char *path, db_tag_t *filter, size_t len) {
@@ -351,7 +635,7 @@ void db_query(db_t *db, void *state, db_tag_t *filter, size_t len, db_cb_t cb) {
 //     return JB_OK_VAL;
 // }
 
-jb_res_t db_mutate(db_t *db, const char *name, db_tag_t *filter, size_t len) {
+static jb_res_t mutate(db_t *db, const char *name, db_tag_t *filter, size_t len) {
     note_entry_t *note = db_get_note(db, name);
     tag_entry_t **tags = JB_BUF;  // tags to be serialized
 
@@ -362,39 +646,32 @@ jb_res_t db_mutate(db_t *db, const char *name, db_tag_t *filter, size_t len) {
 
     jb_info("mutating note at '%s'", note->path);
 
-    // open note for reading; we reopen with write later to avoid file overwrite
-    FILE *f = fopen(path, "r");
-    if (!f) return JB_ERR_LIBC(errno, "failed to open note '%s'", note->path);
+    jb_map_t map;
+    jb_errno_t err = jb_map_file(path, &map);
+    if (err) {
+        jb_buf_free(tags);
+        return JB_ERR_LIBC(err, "failed to read note '%s'", note->path);
+    }
 
-    char *line;
-    JB_TRY(read_line(f, &line));
+    jb_reader_t rd;
+    jb_view_t line;
+    bool got;
+    jb_reader_mem(&rd, map.data, map.len);
+    jb_reader_line(&rd, &line, &got);
 
     // make sure it's an adrus note
-    if (!line || !validate_hdr(line) || strncmp(line, "adrus", 5) != 0)
+    if (!got || !validate_hdr(line)) {
+        jb_unmap_file(&map);
+        jb_buf_free(tags);
         return JB_ERR(JB_ERR_USER, "path '%s' is not adrus note", note->path);
+    }
 
-    // get ptr to after header
-    int ptr = ftell(f);
-    if (ptr == -1) return JB_ERR_LIBC(errno, "failed to get position in file");
-
-    // length of file
-    if (fseek(f, 0, SEEK_END) == -1) return JB_ERR_LIBC(errno, "failed to seek in file");
-    int flen = ftell(f);
-    if (flen == -1) return JB_ERR_LIBC(errno, "failed to get position in file");
-
-    // content length
-    size_t clen = flen - ptr;
-
-    fseek(f, ptr, SEEK_SET);
-
-    // read file after header into buffer
-    char *content = NULL;
-    if (clen > 0) {
-        content = malloc(clen);
+    // content follows the header
+    const uint8_t *content = map.data + rd.start;
+    size_t clen = map.len - rd.start;
 
-        if (fread(content, 1, clen, f) != clen)
-            return JB_ERR_LIBC(errno, "failed to read contents of note");
-    }
+    // at most every existing tag plus every added one
+    jb_buf_reserve(tags, note->len + len);
 
     // process negative (-foo) arguments
     for (size_t i = 0; i < note->len; i++) {
@@ -428,25 +705,41 @@ jb_res_t db_mutate(db_t *db, const char *name, db_tag_t *filter, size_t len) {
         if (!dup) jb_buf_push(tags, filter[i].tag);  // NOLINT
     }
 
-    // re-open file for writing
-    f = freopen(NULL, "w", f);
-    if (!f) return JB_ERR_LIBC(errno, "failed to open note for writing");
+    jb_io_buf_t out;
+    err = jb_io_buf_init(&out, clen + 64);
 
     // write magic
-    fprintf(f, "adrus ");
+    if (!err) err = jb_io_buf_printf(&out, "adrus ");
     jb_debug("serialising tags");
-    for (size_t i = 0; i < jb_buf_len(tags); i++) {
+    for (size_t i = 0; !err && i < jb_buf_len(tags); i++) {
         jb_trace("  +%s", tags[i]->tag);
-        fprintf(f, "%s ", tags[i]->tag);  // write tag to file
+        err = jb_io_buf_printf(&out, "%s ", tags[i]->tag);  // write tag to file
     }
-    fprintf(f, "\n");
+    if (!err) err = jb_io_buf_push(&out, '\n');
+
+    // write file contents back after the new header
+    if (!err) err = jb_io_buf_write(&out, content, clen);
+
+    jb_unmap_file(&map);
+    jb_buf_free(tags);
+
+    // replaced atomically, so a crash mid-write can't lose the note
+    if (!err) err = jb_store_file_atomic(path, out.buf, out.len);
+    jb_io_buf_free(&out);
 
-    // write file contents back to file
-    if (content) fwrite(content, 1, clen, f);
+    JB_TRY_IO(err, "failed to write note '%s'", note->path);
 
     return JB_OK_VAL;
 }
 
+jb_res_t db_mutate(db_t *db, const char *name, db_tag_t *filter, size_t len) {
+    jb_span_begin("db_mutate", name);
+    jb_res_t res = mutate(db, name, filter, len);
+    jb_span_end();
+
+    return res;
+}
+
 static jb_res_t delete_empty(const char *path, bool *e) {
     DIR *dir = opendir(path);
     struct dirent *ent;
@@ -509,7 +802,11 @@ static void ls_glob(db_t *db, void *state, note_entry_t *note) {
 
     if (fnmatch(glob, note->path, FNM_EXTMATCH) == 0) {
         jb_debug("match success; glob = '%s', path = '%s'", glob, note->path);
-        fprintf(stdout, "%s\n", note->path);
+
+        STAT_BEGIN(PHASE_OUTPUT);
+        int n = fprintf(stdout, "%s\n", note->path);
+        if (n > 0) STAT_ADD(STAT_BYTES_OUT, n);
+        STAT_END(PHASE_OUTPUT);
     } else {
         jb_debug("match failed; glob = '%s', path = '%s'", glob, note->path);
     }
@@ -539,11 +836,11 @@ static void rm_glob(db_t *db, void *state, note_entry_t *note) {
 
 void db_ls(db_t *db, const char *glob, db_tag_t *filter, size_t filter_len) {
     jb_debug("pattern: %s", glob);
-    db_query(db, (void *)glob, filter, filter_len, ls_glob);
+    db_query(db, (void *)glob, filter, filter_len, NULL, ls_glob);
 }
 
 void db_rm(db_t *db, const char *glob, db_tag_t *filter, size_t filter_len) {
     jb_debug("pattern: %s", glob);
-    db_query(db, (void *)glob, filter, filter_len, rm_glob);
+    db_query(db, (void *)glob, filter, filter_len, NULL, rm_glob);
     db_gc(db);
 }
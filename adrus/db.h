@@ -58,19 +58,50 @@ typedef struct {
     char path[PATH_MAX + 1];
 } db_t;
 
-jb_res_t db_init(db_t *db);
+jb_res_t db_open(db_t *db);  // resolve notebook path and initialise an empty database
+jb_res_t db_scan(db_t *db);  // walk the notebook, registering every note and its tags
+jb_res_t db_init(db_t *db);  // db_open + db_scan
 void db_free(db_t *db);
 
-void db_add_note(db_t *db, const char *path, time_t ctime, time_t mtime);
+// entries are allocated individually and never move, so the note/tag entry pointers returned
+// below act as stable handles until db_free. the `_hashed` variants take a precomputed
+// `jb_hash_str` of the path/tag, so callers can hash once and reuse it
+
+// register a note; returns the existing entry if it was already registered
+note_entry_t *db_add_note(db_t *db, const char *path, time_t ctime, time_t mtime);
+note_entry_t *db_add_note_hashed(db_t *db, const char *path, jb_hash_t hash, time_t ctime,
+                                 time_t mtime);
+
+// attach a tag to a note by handle, without any lookups
+void db_tag_entry(note_entry_t *note, tag_entry_t *tag);
+// attach a tag to a note by name
 void db_tag_note(db_t *db, const char *path, const char *tag);
+
+// look up a tag, creating it if it doesn't exist
 tag_entry_t *db_def_tag(db_t *db, const char *tag);
+tag_entry_t *db_def_tag_hashed(db_t *db, const char *tag, jb_hash_t hash);
 
 tag_entry_t *db_get_tag(db_t *db, const char *name);
+tag_entry_t *db_get_tag_hashed(db_t *db, const char *name, jb_hash_t hash);
 note_entry_t *db_get_note(db_t *db, const char *path);
+note_entry_t *db_get_note_hashed(db_t *db, const char *path, jb_hash_t hash);
 
 typedef void (*db_cb_t)(db_t *db, void *state, note_entry_t *note);
 
-void db_query(db_t *db, void *state, db_tag_t *filter, size_t len, db_cb_t cb);
+// extra test applied to notes that pass the tag filter, such as a saved query
+typedef struct {
+    bool (*fn)(void *state, note_entry_t *note);
+    void *state;
+} db_pred_t;
+
+// `pred` may be NULL
+void db_query(db_t *db, void *state, db_tag_t *filter, size_t len, const db_pred_t *pred,
+              db_cb_t cb);
+// evaluate a query while walking the notebook, without registering notes; only tags defined in
+// `db` (i.e. the filter's) are considered, unless there's a `pred`, which sees all of a note's
+// tags. `glob` and `pred` may be NULL, and a `limit` of 0 is unlimited
+jb_res_t db_stream(db_t *db, const char *glob, db_tag_t *filter, size_t len,
+                   const db_pred_t *pred, size_t limit, void *state, db_cb_t cb);
 jb_res_t db_mutate(db_t *db, const char *note, db_tag_t *filter, size_t len);
 
 jb_res_t db_gc(db_t *db);
@@ -26,7 +26,9 @@
 #include <ftw.h>
 #include <jbase.h>
 #include <libgen.h>
+#include <query.h>
 #include <stdio.h>
+#include <stats.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/wait.h>
@@ -37,7 +39,11 @@ static void callback(db_t *db, void *state, note_entry_t *note) {
     (void)db;
     (void)state;
     // jb_trace("got note '%s'", note->path);
-    fprintf(stdout, "%s\n", note->path);
+
+    STAT_BEGIN(PHASE_OUTPUT);
+    int n = fprintf(stdout, "%s\n", note->path);
+    if (n > 0) STAT_ADD(STAT_BYTES_OUT, n);
+    STAT_END(PHASE_OUTPUT);
 }
 
 // static jb_res_t test_impl(db_t *db, cmdline_t *cmd) {
@@ -98,25 +104,65 @@ static jb_errno_t make_parent(const char *path) {
 }
 
 int main(int argc, char *argv[]) {
-    (void)callback;
     int code = 0;
     jb_errno_t err;
 
     jb_res_t res;
     jb_log_init();
+    stats_init();
+
+    char *trace = getenv("ADRUS_TRACE");
+    if (trace) jb_span_init(trace);
+
+    // zeroed, so that failing part way still reaches the cleanup (and its stats and trace)
+    db_t db = {0};
+    cmdline_t cmd = {0};
+    queries_t queries;
+    db_pred_t pred, *filter = NULL;
+    bool loaded = false; // `queries` needs freeing
 
-    db_t db;
-    res = db_init(&db);
+    res = db_open(&db);
     if (res JB_IS_ERR) {
         jb_report_result(res);
-        return 1;
+        code = 1;
+        goto cleanup;
     }
 
-    cmdline_t cmd;
     res = cmdline_parse(&cmd, &db, argc, argv);
     if (res JB_IS_ERR) {
         jb_report_result(res);
-        return 1;
+        code = 1;
+        goto cleanup;
+    }
+
+    if (cmd.stats) stats_enabled = true;
+
+    // queries and listings are evaluated while scanning; everything else needs the full database
+    if (cmd.cmd != CMD_QUERY && cmd.cmd != CMD_LS) {
+        res = db_scan(&db);
+        if (res JB_IS_ERR) {
+            jb_report_result(res);
+            code = 1;
+            goto cleanup;
+        }
+    }
+
+    // saved queries are compiled (or loaded from the cache) up front, and evaluated per note
+    if (cmd.query) {
+        res = queries_load(&queries, &db);
+        if (res JB_IS_OK) {
+            res = queries_pred(&queries, cmd.query, &pred);
+            if (res JB_IS_ERR) queries_free(&queries);
+        }
+
+        if (res JB_IS_ERR) {
+            jb_report_result(res);
+            code = 1;
+            goto cleanup;
+        }
+
+        loaded = true;
+        filter = &pred;
     }
 
     char path[PATH_MAX];
@@ -124,11 +170,22 @@ int main(int argc, char *argv[]) {
     switch (cmd.cmd) {
         case CMD_QUERY: {
             jb_info("querying notebook");
-            db_query(&db, NULL, cmd.tags, cmd.len, callback);
+            res = db_stream(&db, NULL, cmd.tags, cmd.len, filter, cmd.limit, NULL, callback);
+            if (res JB_IS_ERR) {
+                jb_report_result(res);
+                code = 1;
+                goto cleanup;
+            }
         } break;
 
         case CMD_LS: {
-            db_ls(&db, cmd.path, cmd.tags, cmd.len);
+            jb_debug("pattern: %s", cmd.path);
+            res = db_stream(&db, cmd.path, cmd.tags, cmd.len, filter, cmd.limit, NULL, callback);
+            if (res JB_IS_ERR) {
+                jb_report_result(res);
+                code = 1;
+                goto cleanup;
+            }
         } break;
 
         case CMD_RM: {
@@ -240,6 +297,22 @@ int main(int argc, char *argv[]) {
     }
 
 cleanup:
+    // include buffered output in the timings
+    jb_span_begin("flush", NULL);
+    STAT_BEGIN(PHASE_OUTPUT);
+    fflush(stdout);
+    STAT_END(PHASE_OUTPUT);
+    jb_span_end();
+
+    stats_report(&db);
+
+    err = jb_span_dump();
+    if (err) jb_error("failed to write trace to '%s': %s", trace, strerror(err));
+    if (loaded) {
+        // a query that failed on a note has already been reported
+        if (queries.failed) code = 1;
+        queries_free(&queries);
+    }
     db_free(&db);
     return code;
 }
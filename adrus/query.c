@@ -0,0 +1,305 @@
+/*
+ * adrus - simple CLI note manager
+ * Copyright (C) 2024  Jacob Sinclair <jcbsnclr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <inttypes.h>
+#include <linux/limits.h>
+#include <query.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// identifies the cache, and the version of the script it was compiled from
+typedef struct {
+    char magic[8];
+    int64_t mtime_sec, mtime_nsec;
+    int64_t size;
+} cache_hdr_t;
+
+#define CACHE_MAGIC "AQCACHE1"
+
+//
+// commands
+//
+
+static jb_res_t want_str(const char *cmd, jb_vm_val_t val) {
+    if (val.kind != JB_VM_STR) return JB_ERR(JB_ERR_USER, "`%s`: expected a name", cmd);
+
+    return JB_OK_VAL;
+}
+
+static jb_vm_val_t bool_val(bool b) {
+    return (jb_vm_val_t){.kind = JB_VM_INT, .int_val = b};
+}
+
+// query NAME BLOCK
+static jb_res_t cmd_query(jb_vm_t *vm, jb_vm_val_t *args, size_t argc, jb_vm_val_t *out) {
+    queries_t *q = vm->user;
+
+    if (argc != 2 || args[1].kind != JB_VM_BLOCK)
+        return JB_ERR(JB_ERR_USER, "`query` takes a name and a block");
+    JB_TRY(want_str("query", args[0]));
+
+    saved_query_t saved = {args[0].str_val, args[1].block};
+    jb_buf_push(q->saved, saved);
+
+    *out = args[1];
+    return JB_OK_VAL;
+}
+
+static bool has_tag(note_entry_t *note, jb_view_t name) {
+    for (size_t i = 0; i < note->len; i++) {
+        const char *tag = note->tags[i]->tag;
+        if (strncmp(tag, name.ptr, name.len) == 0 && tag[name.len] == '\0') return true;
+    }
+
+    return false;
+}
+
+// tag NAME...
+static jb_res_t cmd_tag(jb_vm_t *vm, jb_vm_val_t *args, size_t argc, jb_vm_val_t *out) {
+    queries_t *q = vm->user;
+    if (!q->note) return JB_ERR(JB_ERR_USER, "`tag` used outside a query");
+
+    bool all = true;
+    for (size_t i = 0; i < argc && all; i++) {
+        JB_TRY(want_str("tag", args[i]));
+        all = has_tag(q->note, args[i].str_val);
+    }
+
+    *out = bool_val(all);
+    return JB_OK_VAL;
+}
+
+// path GLOB
+static jb_res_t cmd_path(jb_vm_t *vm, jb_vm_val_t *args, size_t argc, jb_vm_val_t *out) {
+    queries_t *q = vm->user;
+    if (!q->note) return JB_ERR(JB_ERR_USER, "`path` used outside a query");
+    if (argc != 1) return JB_ERR(JB_ERR_USER, "`path` takes a pattern");
+    JB_TRY(want_str("path", args[0]));
+
+    // symbols are NUL-terminated
+    *out = bool_val(fnmatch(args[0].str_val.ptr, q->note->path, FNM_EXTMATCH) == 0);
+    return JB_OK_VAL;
+}
+
+#define DAY_SECS (24 * 60 * 60)
+
+// newer DAYS
+static jb_res_t cmd_newer(jb_vm_t *vm, jb_vm_val_t *args, size_t argc, jb_vm_val_t *out) {
+    queries_t *q = vm->user;
+    if (!q->note) return JB_ERR(JB_ERR_USER, "`newer` used outside a query");
+    if (argc != 1 || args[0].kind != JB_VM_INT)
+        return JB_ERR(JB_ERR_USER, "`newer` takes a number of days");
+
+    int64_t days = args[0].int_val;
+    if (days > INT64_MAX / DAY_SECS || days < INT64_MIN / DAY_SECS)
+        return JB_ERR(JB_ERR_USER, "`newer %" PRId64 "` is too many days", days);
+
+    *out = bool_val(q->now - q->note->mtime <= days * DAY_SECS);
+    return JB_OK_VAL;
+}
+
+//
+// loading
+//
+
+static bool same_version(const cache_hdr_t *hdr, const struct stat *sb) {
+    return memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) == 0 &&
+           hdr->mtime_sec == sb->st_mtim.tv_sec && hdr->mtime_nsec == sb->st_mtim.tv_nsec &&
+           hdr->size == sb->st_size;
+}
+
+// load the compiled script from the cache, if it's up to date; sets `*hit` if it was
+static jb_res_t load_cache(queries_t *q, const char *path, const struct stat *sb, bool *hit) {
+    jb_map_t map;
+    *hit = false;
+
+    jb_errno_t err = jb_map_file(path, &map);
+    if (err == ENOENT) return JB_OK_VAL;
+    JB_TRY_IO(err, "failed to read query cache '%s'", path);
+
+    cache_hdr_t hdr;
+    jb_res_t res = JB_OK_VAL;
+
+    if (map.len >= sizeof(hdr)) {
+        memcpy(&hdr, map.data, sizeof(hdr));
+
+        if (same_version(&hdr, sb)) {
+            size_t used;
+            res = jb_prog_load(&q->prog, map.data + sizeof(hdr), map.len - sizeof(hdr), &used);
+            *hit = res JB_IS_OK;
+        }
+    }
+
+    jb_unmap_file(&map);
+
+    // a broken cache is rebuilt
+    if (res JB_IS_ERR) {
+        jb_warn("ignoring query cache '%s': %s", path, res.msg);
+        free(res.msg);
+    }
+
+    return JB_OK_VAL;
+}
+
+static void store_cache(queries_t *q, const char *path, const struct stat *sb) {
+    cache_hdr_t hdr = {
+        .mtime_sec = sb->st_mtim.tv_sec,
+        .mtime_nsec = sb->st_mtim.tv_nsec,
+        .size = sb->st_size,
+    };
+    memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+
+    jb_io_buf_t buf;
+    jb_errno_t err = jb_io_buf_init(&buf, 4096);
+
+    if (!err) err = jb_io_buf_write(&buf, (uint8_t *)&hdr, sizeof(hdr));
+    if (!err) err = jb_prog_save(&q->prog, &buf);
+    if (!err) err = jb_store_file_atomic(path, buf.buf, buf.len);
+
+    // only costs a recompile next time
+    if (err) jb_warn("failed to write query cache '%s': %s", path, strerror(err));
+
+    jb_io_buf_free(&buf);
+}
+
+static jb_res_t compile_script(queries_t *q, const char *path) {
+    uint8_t *src;
+    size_t len;
+
+    JB_TRY_IO(jb_load_file(path, &src, &len), "failed to read query script '%s'", path);
+
+    // jb_parse wants a string
+    uint8_t *str = realloc(src, len + 1);
+    if (!str) {
+        free(src);
+        return JB_ERR_LIBC(ENOMEM, "failed to read query script '%s'", path);
+    }
+    str[len] = '\0';
+
+    jb_arena_t arena;
+    jb_arena_init(&arena, 64 << 10);
+
+    jb_val_t tree;
+    jb_res_t res = jb_parse(&arena, (char *)str, &tree);
+    if (res JB_IS_OK) res = jb_compile(&tree, &q->prog);
+
+    jb_arena_free(&arena);
+    free(str);
+
+    return res;
+}
+
+jb_res_t queries_load(queries_t *q, db_t *db) {
+    char script[PATH_MAX], cache[PATH_MAX];
+
+    memset(q, 0, sizeof(*q));
+    q->now = time(NULL);
+
+    if (snprintf(script, PATH_MAX, "%s%s", db->path, QUERY_SCRIPT) >= PATH_MAX ||
+        snprintf(cache, PATH_MAX, "%s%s", db->path, QUERY_CACHE) >= PATH_MAX)
+        return JB_ERR(JB_ERR_USER, "notebook path too long");
+
+    struct stat sb;
+    jb_errno_t err = jb_fstat(script, &sb);
+    if (err == ENOENT) return JB_ERR(JB_ERR_USER, "no saved queries ('%s' doesn't exist)", script);
+    JB_TRY_IO(err, "failed to stat query script '%s'", script);
+
+    jb_span_begin("queries_load", script);
+
+    bool hit;
+    jb_res_t res = load_cache(q, cache, &sb, &hit);
+
+    if (res JB_IS_OK && !hit) {
+        jb_info("compiling saved queries");
+        res = compile_script(q, script);
+        if (res JB_IS_OK) store_cache(q, cache, &sb);
+    }
+
+    if (res JB_IS_OK) {
+        jb_vm_init(&q->vm);
+        q->vm.user = q;
+
+        jb_vm_register(&q->vm, "query", cmd_query);
+        jb_vm_register(&q->vm, "tag", cmd_tag);
+        jb_vm_register(&q->vm, "path", cmd_path);
+        jb_vm_register(&q->vm, "newer", cmd_newer);
+
+        jb_vm_link(&q->vm, &q->prog);
+
+        // running the script defines the queries
+        jb_vm_val_t out;
+        res = jb_vm_run(&q->vm, &q->prog, &out);
+    }
+
+    jb_span_end();
+
+    if (res JB_IS_ERR) queries_free(q);
+
+    return res;
+}
+
+static bool eval(void *state, note_entry_t *note) {
+    queries_t *q = state;
+    jb_vm_val_t out;
+
+    q->note = note;
+    jb_res_t res = jb_vm_run_block(&q->vm, &q->prog, q->block, &out);
+    q->note = NULL;
+
+    if (res JB_IS_ERR) {
+        // the same error would be reported for every note
+        if (!q->failed)
+            jb_report_result(res);
+        else
+            free(res.msg);
+
+        q->failed = true;
+        return false;
+    }
+
+    return jb_vm_truthy(out);
+}
+
+jb_res_t queries_pred(queries_t *q, const char *name, db_pred_t *pred) {
+    size_t len = strlen(name);
+
+    for (size_t i = 0; i < jb_buf_len(q->saved); i++) {
+        jb_view_t saved = q->saved[i].name;
+
+        if (saved.len == len && memcmp(saved.ptr, name, len) == 0) {
+            q->block = q->saved[i].block;
+            pred->fn = eval;
+            pred->state = q;
+
+            return JB_OK_VAL;
+        }
+    }
+
+    return JB_ERR(JB_ERR_USER, "no saved query '%s'", name);
+}
+
+void queries_free(queries_t *q) {
+    if (q->vm.stack) jb_vm_free(&q->vm);
+    jb_prog_free(&q->prog);
+    jb_buf_free(q->saved);
+}
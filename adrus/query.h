@@ -0,0 +1,58 @@
+/*
+ * adrus - simple CLI note manager
+ * Copyright (C) 2024  Jacob Sinclair <jcbsnclr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <db.h>
+#include <jbase.h>
+
+// saved queries are defined by a script at the root of the notebook, e.g.
+//
+//     set urgent {or {tag urgent} {tag today}};
+//     query inbox {and {tag todo} {not {tag done}}};
+//     query soon {and {urgent} {newer 7}}
+//
+// `query NAME BLOCK` saves a query, run with `adrus @NAME`. a block stored in a variable is a
+// derived predicate, and can be used as a command. predicates are built from the core VM
+// commands plus `tag NAME...` (the note has every tag), `path GLOB` and `newer DAYS` (modified
+// in the last DAYS days)
+#define QUERY_SCRIPT "/.queries"
+// the compiled script, reused until the script changes
+#define QUERY_CACHE "/.queries.cache"
+
+typedef struct {
+    jb_view_t name;
+    uint32_t block;
+} saved_query_t;
+
+typedef struct {
+    jb_vm_t vm;
+    jb_prog_t prog;
+    saved_query_t *saved; // jb_buf
+
+    note_entry_t *note; // note being evaluated
+    uint32_t block;     // query being evaluated
+    time_t now;         // for `newer`
+    bool failed;        // an evaluation error has been reported
+} queries_t;
+
+// load the notebook's saved queries, compiling its script if the cache is out of date
+jb_res_t queries_load(queries_t *q, db_t *db);
+// predicate evaluating saved query `name`
+jb_res_t queries_pred(queries_t *q, const char *name, db_pred_t *pred);
+void queries_free(queries_t *q);
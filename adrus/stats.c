@@ -0,0 +1,108 @@
+/*
+ * adrus - simple CLI note manager
+ * Copyright (C) 2024  Jacob Sinclair <jcbsnclr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <stats.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+bool stats_enabled = false;
+uint64_t stats_count[STAT_MAX];
+uint64_t stats_time[PHASE_MAX];
+
+static const char *stat_str[] = {
+    [STAT_FILES_VISITED] = "files visited",
+    [STAT_FILES_OPENED] = "files opened",
+    [STAT_BYTES_READ] = "bytes read",
+    [STAT_REJECTS] = "non-adrus files",
+    [STAT_TAGS_SEEN] = "tags parsed",
+    [STAT_LOOKUPS] = "hash lookups",
+    [STAT_CHAIN_STEPS] = "chain steps",
+    [STAT_CANDIDATES] = "query candidates",
+    [STAT_MATCHES] = "query matches",
+    [STAT_BYTES_OUT] = "bytes written",
+};
+
+static const char *phase_str[] = {
+    [PHASE_SCAN] = "scan",
+    [PHASE_READ] = "  read",
+    [PHASE_PARSE] = "  parse",
+    [PHASE_INDEX] = "  index",
+    [PHASE_QUERY] = "query",
+    [PHASE_OUTPUT] = "output",
+};
+
+void stats_init() {
+    if (getenv("ADRUS_STATS")) stats_enabled = true;
+}
+
+// power-of-two histogram bins: 0, 1, 2-3, 4-7, ...
+#define HIST_BINS 16
+
+static size_t hist_bin(size_t len) {
+    size_t bin = 0;
+    while (len && bin < HIST_BINS - 1) {
+        len >>= 1;
+        bin++;
+    }
+
+    return bin;
+}
+
+static void report_hist(const char *name, size_t hist[HIST_BINS], size_t longest) {
+    fprintf(stderr, "  %s chains (longest %zu):\n", name, longest);
+
+    for (size_t b = 0; b < HIST_BINS; b++) {
+        if (!hist[b]) continue;
+
+        size_t lo = b ? 1ul << (b - 1) : 0;
+        size_t hi = b ? (1ul << b) - 1 : 0;
+
+        fprintf(stderr, "    %6zu-%-6zu %zu buckets\n", lo, hi, hist[b]);
+    }
+}
+
+void stats_report(db_t *db) {
+    if (!stats_enabled) return;
+
+    fprintf(stderr, "adrus stats:\n");
+
+    for (size_t s = 0; s < STAT_MAX; s++)
+        fprintf(stderr, "  %-18s %" PRIu64 "\n", stat_str[s], stats_count[s]);
+
+    for (size_t p = 0; p < PHASE_MAX; p++)
+        fprintf(stderr, "  %-18s %.3f ms\n", phase_str[p], stats_time[p] / 1e6);
+
+    size_t note_hist[HIST_BINS] = {0}, tag_hist[HIST_BINS] = {0};
+    size_t note_longest = 0, tag_longest = 0;
+
+    for (size_t b = 0; b < BUCKETS; b++) {
+        size_t len = 0;
+        for (note_entry_t *n = db->bnotes[b]; n; n = n->next) len++;
+        note_hist[hist_bin(len)]++;
+        note_longest = JB_MAX(note_longest, len);
+
+        len = 0;
+        for (tag_entry_t *t = db->btags[b]; t; t = t->next) len++;
+        tag_hist[hist_bin(len)]++;
+        tag_longest = JB_MAX(tag_longest, len);
+    }
+
+    report_hist("note", note_hist, note_longest);
+    report_hist("tag", tag_hist, tag_longest);
+}
@@ -0,0 +1,64 @@
+/*
+ * adrus - simple CLI note manager
+ * Copyright (C) 2024  Jacob Sinclair <jcbsnclr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <db.h>
+#include <jbase.h>
+
+typedef enum {
+    STAT_FILES_VISITED, // regular files seen by the notebook walk
+    STAT_FILES_OPENED,  // files successfully opened for reading
+    STAT_BYTES_READ,    // bytes read from notes
+    STAT_REJECTS,       // files without an adrus header
+    STAT_TAGS_SEEN,     // tags parsed out of headers
+    STAT_LOOKUPS,       // hash table lookups
+    STAT_CHAIN_STEPS,   // bucket chain entries visited during lookups
+    STAT_CANDIDATES,    // notes evaluated against a query
+    STAT_MATCHES,       // notes matching a query
+    STAT_BYTES_OUT,     // bytes written to stdout
+    STAT_MAX
+} stat_t;
+
+typedef enum {
+    PHASE_SCAN,   // whole notebook walk
+    PHASE_READ,   // opening and reading headers, a batch at a time (within scan)
+    PHASE_PARSE,  // parsing headers (within scan)
+    PHASE_INDEX,  // registering notes and tags (within scan)
+    PHASE_QUERY,  // evaluating queries over the in-memory database
+    PHASE_OUTPUT, // writing results (within scan when streaming, otherwise within query)
+    PHASE_MAX
+} phase_t;
+
+extern bool stats_enabled;
+extern uint64_t stats_count[STAT_MAX];
+extern uint64_t stats_time[PHASE_MAX];
+
+// enable collection if `ADRUS_STATS` is set
+void stats_init();
+// print counters, timings and the database's bucket chain histogram to stderr
+void stats_report(db_t *db);
+
+// counters are always maintained; a plain add is cheaper than testing `stats_enabled`
+#define STAT_ADD(s, n) (stats_count[(s)] += (n))
+#define STAT_INC(s) STAT_ADD(s, 1)
+
+// timers only read the clock while stats are enabled
+#define STAT_BEGIN(p) uint64_t p##_start = stats_enabled ? jb_now() : 0
+#define STAT_END(p) \
+    if (stats_enabled) stats_time[(p)] += jb_now() - p##_start
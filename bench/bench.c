@@ -0,0 +1,219 @@
+/*
+ * adrus - simple CLI note manager
+ * Copyright (C) 2024  Jacob Sinclair <jcbsnclr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//
+// bench.c: shared benchmark harness utilities
+//
+// timing, result aggregation and CSV/JSON reporting used by every program in `bench/`
+//
+
+#define _XOPEN_SOURCE 500
+#define _GNU_SOURCE
+
+#include <bench.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+void bench_result_init(bench_result_t *res, const char *name, const char *cache, size_t size) {
+    res->name = name;
+    res->cache = cache;
+    res->size = size;
+    res->iters = 0;
+    res->samples = JB_BUF;
+}
+
+void bench_result_add(bench_result_t *res, uint64_t ns) {
+    jb_buf_push(res->samples, ns);
+    res->iters++;
+}
+
+void bench_result_free(bench_result_t *res) {
+    jb_buf_free(res->samples);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    uint64_t min, median, mean, max;
+} stats_t;
+
+static stats_t summarise(bench_result_t *res) {
+    stats_t st = {0};
+    if (res->iters == 0) return st;
+
+    qsort(res->samples, res->iters, sizeof(uint64_t), cmp_u64);
+
+    uint64_t sum = 0;
+    for (size_t i = 0; i < res->iters; i++) sum += res->samples[i];
+
+    st.min = res->samples[0];
+    st.max = res->samples[res->iters - 1];
+    st.median = res->samples[res->iters / 2];
+    st.mean = sum / res->iters;
+
+    return st;
+}
+
+bool bench_fmt_parse(const char *str, bench_fmt_t *fmt) {
+    if (strcmp(str, "csv") == 0)
+        *fmt = BENCH_CSV;
+    else if (strcmp(str, "json") == 0)
+        *fmt = BENCH_JSON;
+    else
+        return false;
+
+    return true;
+}
+
+void bench_report_begin(bench_report_t *rep, bench_fmt_t fmt, FILE *out) {
+    rep->fmt = fmt;
+    rep->out = out;
+    rep->count = 0;
+
+    switch (fmt) {
+        case BENCH_CSV:
+            fprintf(out, "rev,target,bench,cache,size,iters,min_ns,median_ns,mean_ns,max_ns\n");
+            break;
+        case BENCH_JSON:
+            fprintf(out,
+                    "{\n  \"rev\": \"%s\",\n  \"target\": \"%s\",\n  \"results\": [",
+                    BENCH_REV,
+                    BENCH_TARGET);
+            break;
+    }
+}
+
+void bench_report_add(bench_report_t *rep, bench_result_t *res) {
+    stats_t st = summarise(res);
+
+    switch (rep->fmt) {
+        case BENCH_CSV:
+            fprintf(rep->out,
+                    "%s,%s,%s,%s,%zu,%zu,%lu,%lu,%lu,%lu\n",
+                    BENCH_REV,
+                    BENCH_TARGET,
+                    res->name,
+                    res->cache,
+                    res->size,
+                    res->iters,
+                    st.min,
+                    st.median,
+                    st.mean,
+                    st.max);
+            break;
+        case BENCH_JSON:
+            fprintf(rep->out,
+                    "%s\n    {\"bench\": \"%s\", \"cache\": \"%s\", \"size\": %zu, \"iters\": %zu, "
+                    "\"min_ns\": %lu, \"median_ns\": %lu, \"mean_ns\": %lu, \"max_ns\": %lu}",
+                    rep->count ? "," : "",
+                    res->name,
+                    res->cache,
+                    res->size,
+                    res->iters,
+                    st.min,
+                    st.median,
+                    st.mean,
+                    st.max);
+            break;
+    }
+
+    fflush(rep->out);
+    rep->count++;
+}
+
+void bench_report_end(bench_report_t *rep) {
+    if (rep->fmt == BENCH_JSON) fprintf(rep->out, "\n  ]\n}\n");
+    fflush(rep->out);
+}
+
+uint64_t bench_rng_next(bench_rng_t *rng) {
+    uint64_t z = (rng->state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+uint64_t bench_rng_below(bench_rng_t *rng, uint64_t n) {
+    return n ? bench_rng_next(rng) % n : 0;
+}
+
+double bench_rng_unit(bench_rng_t *rng) {
+    return (bench_rng_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int bench_mute_stdout() {
+    fflush(stdout);
+
+    int saved = dup(STDOUT_FILENO);
+    if (saved == -1) return -1;
+
+    int null = open("/dev/null", O_WRONLY);
+    if (null == -1) {
+        close(saved);
+        return -1;
+    }
+
+    dup2(null, STDOUT_FILENO);
+    close(null);
+
+    return saved;
+}
+
+void bench_unmute_stdout(int saved) {
+    if (saved == -1) return;
+
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+static int evict_cb(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
+    (void)sb;
+    (void)ftwbuf;
+
+    if (typeflag != FTW_F) return 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return 0;
+
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+
+    return 0;
+}
+
+void bench_drop_cache(const char *path) {
+    sync();
+    nftw(path, evict_cb, 16, FTW_PHYS);
+
+    // only succeeds as root; evicts dentries and inodes as well as page cache
+    FILE *f = fopen("/proc/sys/vm/drop_caches", "w");
+    if (f) {
+        fputs("3\n", f);
+        fclose(f);
+    }
+}
@@ -0,0 +1,91 @@
+/*
+ * adrus - simple CLI note manager
+ * Copyright (C) 2024  Jacob Sinclair <jcbsnclr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <jbase.h>
+
+// revision/build target the benchmarks were compiled from; set by the makefile
+#ifndef BENCH_REV
+#define BENCH_REV "unknown"
+#endif
+
+#ifndef BENCH_TARGET
+#define BENCH_TARGET "unknown"
+#endif
+
+//
+// timing
+//
+
+typedef struct {
+    const char *name;  // benchmark name (e.g. `db_init`)
+    const char *cache; // cache state (`warm`, `cold`, or `-` where it doesn't apply)
+    size_t size;       // problem size (notes, bytes, ...)
+
+    size_t iters;      // number of samples
+    uint64_t *samples; // per-iteration wall time, in nanoseconds (jb_buf)
+} bench_result_t;
+
+void bench_result_init(bench_result_t *res, const char *name, const char *cache, size_t size);
+void bench_result_add(bench_result_t *res, uint64_t ns);
+void bench_result_free(bench_result_t *res);
+
+//
+// reporting
+//
+
+typedef enum {
+    BENCH_CSV,
+    BENCH_JSON,
+} bench_fmt_t;
+
+typedef struct {
+    bench_fmt_t fmt;
+    FILE *out;
+    size_t count; // results written so far
+} bench_report_t;
+
+// parse `csv`/`json`; returns false if unknown
+bool bench_fmt_parse(const char *str, bench_fmt_t *fmt);
+
+void bench_report_begin(bench_report_t *rep, bench_fmt_t fmt, FILE *out);
+void bench_report_add(bench_report_t *rep, bench_result_t *res);
+void bench_report_end(bench_report_t *rep);
+
+//
+// misc.
+//
+
+// small, fast, seedable PRNG (splitmix64) so generated data is reproducible across runs
+typedef struct {
+    uint64_t state;
+} bench_rng_t;
+
+uint64_t bench_rng_next(bench_rng_t *rng);
+// uniform in [0, n)
+uint64_t bench_rng_below(bench_rng_t *rng, uint64_t n);
+// uniform in [0, 1)
+double bench_rng_unit(bench_rng_t *rng);
+
+// redirect stdout to /dev/null (for timing commands that print); returns saved fd, or -1
+int bench_mute_stdout();
+void bench_unmute_stdout(int saved);
+
+// evict a file tree from the page cache (best-effort; also drops dentries/inodes when root)
+void bench_drop_cache(const char *path);
@@ -0,0 +1,302 @@
+/*
+ * adrus - simple CLI note manager
+ * Copyright (C) 2024  Jacob Sinclair <jcbsnclr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//
+// hash.c: hash function microbenchmark
+//
+// measures throughput of the jbase hash functions over the note paths of a notebook (and over a
+// large buffer), and reports how evenly each distributes those paths across hash buckets
+//
+
+#define _XOPEN_SOURCE 500
+#define _GNU_SOURCE
+
+#include <bench.h>
+#include <db.h>
+#include <errno.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// hashes per timed iteration, roughly
+#define HASHES_PER_ITER (1 << 20)
+#define LONG_BYTES (1 << 20)
+
+typedef struct {
+    const char *name;
+    jb_hash_t (*str)(const char *str);
+    jb_hash_t (*buf)(const void *buf, size_t bytes);
+} hash_fn_t;
+
+static const hash_fn_t fns[] = {
+    {"fnv1a", jb_fnv1a_str, jb_fnv1a},
+    {"mxhash", jb_mxhash_str, jb_mxhash},
+};
+
+#define FN_COUNT (sizeof(fns) / sizeof(fns[0]))
+
+JB_TLOCAL static char **paths;
+JB_TLOCAL static size_t root_len;
+
+static int collect_cb(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
+    (void)sb;
+    (void)ftwbuf;
+
+    // note names are relative to the notebook root, as in the database
+    if (typeflag == FTW_F) jb_buf_push(paths, strdup(path + root_len));
+
+    return 0;
+}
+
+static volatile jb_hash_t sink;
+
+static void bench_paths(bench_report_t *rep, size_t iters, const hash_fn_t *fn, bool fused) {
+    size_t n = jb_buf_len(paths);
+    size_t reps = JB_MAX(1, HASHES_PER_ITER / n);
+
+    size_t *lens = malloc(sizeof(size_t) * n);
+    size_t bytes = 0;
+    for (size_t i = 0; i < n; i++) bytes += lens[i] = strlen(paths[i]);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s%s", fn->name, fused ? "_str" : "");
+
+    bench_result_t res;
+    bench_result_init(&res, name, "-", bytes * reps);
+
+    for (size_t it = 0; it < iters; it++) {
+        jb_hash_t acc = 0;
+
+        uint64_t start = jb_now();
+
+        for (size_t r = 0; r < reps; r++) {
+            if (fused)
+                for (size_t i = 0; i < n; i++) acc ^= fn->str(paths[i]);
+            else
+                for (size_t i = 0; i < n; i++) acc ^= fn->buf(paths[i], lens[i]);
+        }
+
+        bench_result_add(&res, jb_now() - start);
+        sink = acc;
+    }
+
+    uint64_t best = UINT64_MAX;
+    for (size_t i = 0; i < res.iters; i++) best = JB_MIN(best, res.samples[i]);
+
+    fprintf(stderr,
+            "%-12s %8.1f MB/s  %6.2f ns/hash\n",
+            name,
+            (double)(bytes * reps) / (best / 1e9) / 1e6,
+            (double)best / (n * reps));
+
+    bench_report_add(rep, &res);
+    bench_result_free(&res);
+    free(lens);
+}
+
+static void bench_long(bench_report_t *rep, size_t iters, const hash_fn_t *fn) {
+    uint8_t *buf = malloc(LONG_BYTES);
+    bench_rng_t rng = {42};
+    for (size_t i = 0; i < LONG_BYTES; i++) buf[i] = bench_rng_next(&rng);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s_1m", fn->name);
+
+    bench_result_t res;
+    bench_result_init(&res, name, "-", LONG_BYTES);
+
+    for (size_t it = 0; it < iters; it++) {
+        uint64_t start = jb_now();
+        sink = fn->buf(buf, LONG_BYTES);
+        bench_result_add(&res, jb_now() - start);
+    }
+
+    uint64_t best = UINT64_MAX;
+    for (size_t i = 0; i < res.iters; i++) best = JB_MIN(best, res.samples[i]);
+
+    fprintf(stderr, "%-12s %8.1f MB/s\n", name, (double)LONG_BYTES / (best / 1e9) / 1e6);
+
+    bench_report_add(rep, &res);
+    bench_result_free(&res);
+    free(buf);
+}
+
+static int cmp_hash(const void *a, const void *b) {
+    jb_hash_t x = *(const jb_hash_t *)a;
+    jb_hash_t y = *(const jb_hash_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+// chi-squared of bucket occupancy over its expectation (~1.0 for a uniform hash), and the
+// fullest bucket
+static void bucket_quality(jb_hash_t *hashes, size_t n, size_t buckets, double *chi,
+                           size_t *max) {
+    size_t *load = calloc(buckets, sizeof(size_t));
+    for (size_t i = 0; i < n; i++) load[hashes[i] % buckets]++;
+
+    double expect = (double)n / buckets;
+    double sum = 0;
+    *max = 0;
+
+    for (size_t b = 0; b < buckets; b++) {
+        double d = load[b] - expect;
+        sum += d * d / expect;
+        *max = JB_MAX(*max, load[b]);
+    }
+
+    *chi = sum / (buckets - 1);
+    free(load);
+}
+
+static void quality(const hash_fn_t *fn) {
+    size_t n = jb_buf_len(paths);
+    jb_hash_t *hashes = malloc(sizeof(jb_hash_t) * n);
+
+    for (size_t i = 0; i < n; i++) hashes[i] = fn->str(paths[i]);
+
+    size_t pow2 = 2;
+    while (pow2 < n) pow2 <<= 1;
+
+    double chi_db, chi_pow2;
+    size_t max_db, max_pow2;
+    bucket_quality(hashes, n, BUCKETS, &chi_db, &max_db);
+    bucket_quality(hashes, n, pow2, &chi_pow2, &max_pow2);
+
+    qsort(hashes, n, sizeof(jb_hash_t), cmp_hash);
+
+    size_t collisions = 0;
+    for (size_t i = 1; i < n; i++) collisions += hashes[i] == hashes[i - 1];
+
+    fprintf(stderr,
+            "%-12s collisions %zu  chi2/df %.3f (max %zu) @ %d buckets  chi2/df %.3f (max %zu) @ "
+            "%zu buckets\n",
+            fn->name,
+            collisions,
+            chi_db,
+            max_db,
+            BUCKETS,
+            chi_pow2,
+            max_pow2,
+            pow2);
+
+    free(hashes);
+}
+
+// the fused string hashes must agree with their length-based counterparts
+static bool check_fused() {
+    char buf[1024 + 16];
+    bench_rng_t rng = {7};
+
+    for (size_t i = 0; i < jb_buf_len(paths); i++)
+        for (size_t f = 0; f < FN_COUNT; f++)
+            if (fns[f].str(paths[i]) != fns[f].buf(paths[i], strlen(paths[i]))) return false;
+
+    for (size_t len = 0; len < 1024; len++) {
+        for (size_t off = 0; off < 8; off++) {
+            char *s = buf + off;
+            for (size_t i = 0; i < len; i++) s[i] = 'a' + bench_rng_below(&rng, 26);
+            s[len] = '\0';
+
+            for (size_t f = 0; f < FN_COUNT; f++)
+                if (fns[f].str(s) != fns[f].buf(s, len)) return false;
+        }
+    }
+
+    return true;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-i ITERS] [-f csv|json] [-o OUT] DIR...\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+    jb_log_init();
+
+    size_t iters = 5;
+    bench_fmt_t fmt = BENCH_CSV;
+    FILE *out = stdout;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:f:o:h")) != -1) {
+        switch (opt) {
+            case 'i':
+                iters = strtoull(optarg, NULL, 10);
+                break;
+            case 'f':
+                if (!bench_fmt_parse(optarg, &fmt)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'o':
+                out = fopen(optarg, "w");
+                if (!out) {
+                    jb_error("failed to open '%s': %s", optarg, strerror(errno));
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    paths = JB_BUF;
+    for (int i = optind; i < argc; i++) {
+        root_len = strlen(argv[i]);
+        nftw(argv[i], collect_cb, 16, FTW_PHYS);
+    }
+
+    if (jb_buf_len(paths) == 0) {
+        jb_error("no files found");
+        return 1;
+    }
+
+    if (!check_fused()) {
+        jb_error("fused string hash disagrees with buffer hash");
+        return 1;
+    }
+
+    fprintf(stderr, "%zu paths\n", jb_buf_len(paths));
+
+    bench_report_t rep;
+    bench_report_begin(&rep, fmt, out);
+
+    for (size_t f = 0; f < FN_COUNT; f++) {
+        bench_paths(&rep, iters, &fns[f], false);
+        bench_paths(&rep, iters, &fns[f], true);
+        bench_long(&rep, iters, &fns[f]);
+    }
+
+    bench_report_end(&rep);
+    if (out != stdout) fclose(out);
+
+    for (size_t f = 0; f < FN_COUNT; f++) quality(&fns[f]);
+
+    for (size_t i = 0; i < jb_buf_len(paths); i++) free(paths[i]);
+    jb_buf_free(paths);
+
+    return 0;
+}
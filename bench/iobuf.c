@@ -0,0 +1,254 @@
+/*
+ * adrus - simple CLI note manager
+ * Copyright (C) 2024  Jacob Sinclair <jcbsnclr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//
+// iobuf.c: jb_io_buf_t microbenchmark
+//
+// builds buffers of increasing size one byte, one chunk and one formatted record at a time, with
+// `jb_io_buf_t` and with its previous implementation (which zeroed the unused tail on every write),
+// and compares flushing many buffers with writev against one write per buffer
+//
+
+#define _GNU_SOURCE
+
+#include <bench.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// the old implementation is quadratic, so it only runs up to this size
+#define OLD_MAX (64 << 10)
+#define CHUNK 64
+
+#define FLUSH_BUFS 256
+#define FLUSH_BYTES 4096
+
+static const size_t sizes[] = {4 << 10, 64 << 10, 1 << 20};
+
+#define SIZE_COUNT (sizeof(sizes) / sizeof(sizes[0]))
+
+// previous `jb_io_buf_t` implementation, kept as the baseline
+
+static jb_errno_t old_init(jb_io_buf_t *buf, size_t cap) {
+    buf->cap = cap;
+    buf->len = 0;
+    buf->buf = malloc(cap);
+
+    if (!buf->buf) return errno;
+
+    memset(buf->buf, 0, buf->cap);
+
+    return 0;
+}
+
+static jb_errno_t old_write(jb_io_buf_t *buf, const uint8_t *data, size_t len) {
+    size_t new_len = buf->len + len;
+    size_t new_cap = buf->cap;
+    uint8_t *new_buf = buf->buf;
+
+    if (new_len >= buf->cap) {
+        while (new_cap < new_len) new_cap *= 2;
+        new_buf = realloc(buf->buf, new_cap);
+
+        if (!new_buf) return errno;
+    }
+
+    memcpy(new_buf + buf->len, data, len);
+    memset(new_buf + new_len, 0, new_cap - new_len);
+
+    buf->len = new_len;
+    buf->cap = new_cap;
+    buf->buf = new_buf;
+
+    return 0;
+}
+
+typedef enum { WL_BYTE, WL_CHUNK, WL_PRINTF } workload_t;
+
+static const char *wl_str[] = {
+    [WL_BYTE] = "byte",
+    [WL_CHUNK] = "chunk",
+    [WL_PRINTF] = "printf",
+};
+
+static volatile size_t sink;
+
+static void build(workload_t wl, bool old, size_t size) {
+    static const uint8_t chunk[CHUNK] = "the quick brown fox jumps over the lazy dog, again and again..";
+
+    jb_io_buf_t buf;
+    if (old)
+        old_init(&buf, 16);
+    else
+        jb_io_buf_init(&buf, 16);
+
+    size_t i = 0;
+    while (buf.len < size) {
+        switch (wl) {
+            case WL_BYTE: {
+                uint8_t c = 'a' + i % 26;
+                if (old)
+                    old_write(&buf, &c, 1);
+                else
+                    jb_io_buf_push(&buf, c);
+            } break;
+            case WL_CHUNK:
+                if (old)
+                    old_write(&buf, chunk, CHUNK);
+                else
+                    jb_io_buf_write(&buf, chunk, CHUNK);
+                break;
+            case WL_PRINTF:
+                if (old) {
+                    char tmp[64];
+                    int n = snprintf(tmp, sizeof(tmp), "/note/%zu tag%zu\n", i, i % 97);
+                    old_write(&buf, (uint8_t *)tmp, n);
+                } else {
+                    jb_io_buf_printf(&buf, "/note/%zu tag%zu\n", i, i % 97);
+                }
+                break;
+        }
+
+        i++;
+    }
+
+    sink = buf.len;
+    free(buf.buf);
+}
+
+static void bench_build(bench_report_t *rep, size_t iters, workload_t wl, bool old, size_t size) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s_%s", old ? "old" : "new", wl_str[wl]);
+
+    bench_result_t res;
+    bench_result_init(&res, name, "-", size);
+
+    for (size_t it = 0; it < iters; it++) {
+        uint64_t start = jb_now();
+        build(wl, old, size);
+        bench_result_add(&res, jb_now() - start);
+    }
+
+    uint64_t best = UINT64_MAX;
+    for (size_t i = 0; i < res.iters; i++) best = JB_MIN(best, res.samples[i]);
+
+    fprintf(stderr,
+            "%-12s %8zu B %10.3f ms %8.1f MB/s\n",
+            name,
+            size,
+            best / 1e6,
+            (double)size / (best / 1e9) / 1e6);
+
+    bench_report_add(rep, &res);
+    bench_result_free(&res);
+}
+
+static void bench_flush(bench_report_t *rep, size_t iters, bool vectored) {
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd == -1) return;
+
+    jb_io_buf_t bufs[FLUSH_BUFS];
+    for (size_t i = 0; i < FLUSH_BUFS; i++) {
+        jb_io_buf_init(&bufs[i], FLUSH_BYTES);
+        while (bufs[i].len < FLUSH_BYTES) jb_io_buf_push(&bufs[i], 'x');
+    }
+
+    const char *name = vectored ? "flush_writev" : "flush_write";
+
+    bench_result_t res;
+    bench_result_init(&res, name, "-", FLUSH_BUFS * FLUSH_BYTES);
+
+    for (size_t it = 0; it < iters; it++) {
+        uint64_t start = jb_now();
+
+        if (vectored)
+            jb_io_buf_writev(fd, bufs, FLUSH_BUFS);
+        else
+            for (size_t i = 0; i < FLUSH_BUFS; i++) jb_io_buf_flush_fd(&bufs[i], fd);
+
+        bench_result_add(&res, jb_now() - start);
+    }
+
+    uint64_t best = UINT64_MAX;
+    for (size_t i = 0; i < res.iters; i++) best = JB_MIN(best, res.samples[i]);
+
+    fprintf(stderr, "%-12s %8d B %10.3f ms\n", name, FLUSH_BUFS * FLUSH_BYTES, best / 1e6);
+
+    bench_report_add(rep, &res);
+    bench_result_free(&res);
+
+    for (size_t i = 0; i < FLUSH_BUFS; i++) jb_io_buf_free(&bufs[i]);
+    close(fd);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-i ITERS] [-f csv|json] [-o OUT]\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+    jb_log_init();
+
+    size_t iters = 5;
+    bench_fmt_t fmt = BENCH_CSV;
+    FILE *out = stdout;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:f:o:h")) != -1) {
+        switch (opt) {
+            case 'i':
+                iters = strtoull(optarg, NULL, 10);
+                break;
+            case 'f':
+                if (!bench_fmt_parse(optarg, &fmt)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'o':
+                out = fopen(optarg, "w");
+                if (!out) {
+                    jb_error("failed to open '%s': %s", optarg, strerror(errno));
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    bench_report_t rep;
+    bench_report_begin(&rep, fmt, out);
+
+    for (workload_t wl = WL_BYTE; wl <= WL_PRINTF; wl++) {
+        for (size_t s = 0; s < SIZE_COUNT; s++) {
+            if (sizes[s] <= OLD_MAX) bench_build(&rep, iters, wl, true, sizes[s]);
+            bench_build(&rep, iters, wl, false, sizes[s]);
+        }
+    }
+
+    bench_flush(&rep, iters, false);
+    bench_flush(&rep, iters, true);
+
+    bench_report_end(&rep);
+    if (out != stdout) fclose(out);
+
+    return 0;
+}
@@ -0,0 +1,482 @@
+/*
+ * adrus - simple CLI note manager
+ * Copyright (C) 2024  Jacob Sinclair <jcbsnclr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//
+// notebook.c: end-to-end benchmarks over a (generated) notebook
+//
+// times the database operations used by the CLI, plus `jb_parse` over a synthetic script, whole
+// and pushed through `jb_parser_t` in pipe-sized chunks, and loading the same script's saved tree.
+// operations touching the disk are run with a warm and (best-effort) cold page cache
+//
+
+#define _GNU_SOURCE
+
+#include <bench.h>
+#include <db.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// tag with popularity rank 0 in notebooks written by `notegen`
+#define POPULAR_TAG "ta"
+
+// number of notes touched by the mutate/rm benchmarks
+#define TOUCH_MAX 100
+
+typedef struct {
+    const char *dir;
+    size_t iters;
+    size_t script; // size of the synthetic jb_parse script, in bytes
+    bool warm, cold;
+
+    bench_report_t rep;
+    size_t notes; // notes in the notebook, measured by the first scan
+} harness_t;
+
+static void count_cb(db_t *db, void *state, note_entry_t *note) {
+    (void)db;
+    (void)note;
+
+    (*(size_t *)state)++;
+}
+
+typedef struct {
+    note_entry_t **notes;
+    size_t max;
+} collect_t;
+
+static void collect_cb(db_t *db, void *state, note_entry_t *note) {
+    (void)db;
+    collect_t *c = (collect_t *)state;
+
+    if (jb_buf_len(c->notes) < c->max) jb_buf_push(c->notes, note);
+}
+
+static void prepare(harness_t *h, bool cold) {
+    if (cold) bench_drop_cache(h->dir);
+}
+
+static const char *cache_name(bool cold) {
+    return cold ? "cold" : "warm";
+}
+
+static jb_res_t bench_init(harness_t *h, bool cold) {
+    bench_result_t res;
+    bench_result_init(&res, "db_init", cache_name(cold), h->notes);
+
+    for (size_t i = 0; i < h->iters; i++) {
+        db_t db;
+        prepare(h, cold);
+
+        uint64_t start = jb_now();
+        JB_TRY(db_init(&db));
+        bench_result_add(&res, jb_now() - start);
+
+        db_free(&db);
+    }
+
+    bench_report_add(&h->rep, &res);
+    bench_result_free(&res);
+
+    return JB_OK_VAL;
+}
+
+static jb_res_t bench_stream(harness_t *h, bool cold) {
+    bench_result_t res;
+    bench_result_init(&res, "db_stream", cache_name(cold), h->notes);
+
+    for (size_t i = 0; i < h->iters; i++) {
+        db_t db;
+        JB_TRY(db_open(&db));
+
+        db_tag_t filter = {.sign = true, .tag = db_def_tag(&db, POPULAR_TAG)};
+        size_t count = 0;
+
+        prepare(h, cold);
+
+        uint64_t start = jb_now();
+        JB_TRY(db_stream(&db, NULL, &filter, 1, NULL, 0, &count, count_cb));
+        bench_result_add(&res, jb_now() - start);
+
+        db_free(&db);
+    }
+
+    bench_report_add(&h->rep, &res);
+    bench_result_free(&res);
+
+    return JB_OK_VAL;
+}
+
+static void bench_query(harness_t *h, db_t *db) {
+    bench_result_t res;
+    bench_result_init(&res, "db_query", "-", h->notes);
+
+    db_tag_t filter = {.sign = true, .tag = db_def_tag(db, POPULAR_TAG)};
+
+    for (size_t i = 0; i < h->iters; i++) {
+        size_t count = 0;
+
+        uint64_t start = jb_now();
+        db_query(db, &count, &filter, 1, NULL, count_cb);
+        bench_result_add(&res, jb_now() - start);
+    }
+
+    bench_report_add(&h->rep, &res);
+    bench_result_free(&res);
+}
+
+static void bench_ls(harness_t *h, db_t *db) {
+    bench_result_t res;
+    bench_result_init(&res, "db_ls", "-", h->notes);
+
+    for (size_t i = 0; i < h->iters; i++) {
+        int saved = bench_mute_stdout();
+
+        uint64_t start = jb_now();
+        db_ls(db, "/d0/*", NULL, 0);
+        bench_result_add(&res, jb_now() - start);
+
+        bench_unmute_stdout(saved);
+    }
+
+    bench_report_add(&h->rep, &res);
+    bench_result_free(&res);
+}
+
+// adds then removes a tag on up to TOUCH_MAX notes, leaving the notebook unchanged
+static jb_res_t bench_mutate(harness_t *h, db_t *db, bool cold) {
+    collect_t c = {.notes = JB_BUF, .max = TOUCH_MAX};
+    db_query(db, &c, NULL, 0, NULL, collect_cb);
+
+    size_t n = jb_buf_len(c.notes);
+
+    bench_result_t res;
+    bench_result_init(&res, "db_mutate", cache_name(cold), n);
+
+    db_tag_t add = {.sign = true, .tag = db_def_tag(db, "benchmut")};
+    db_tag_t del = {.sign = false, .tag = add.tag};
+
+    for (size_t i = 0; i < h->iters; i++) {
+        prepare(h, cold);
+
+        uint64_t start = jb_now();
+
+        for (size_t j = 0; j < n; j++) {
+            JB_TRY(db_mutate(db, c.notes[j]->path, &add, 1));
+            JB_TRY(db_mutate(db, c.notes[j]->path, &del, 1));
+        }
+
+        bench_result_add(&res, jb_now() - start);
+    }
+
+    bench_report_add(&h->rep, &res);
+    bench_result_free(&res);
+    jb_buf_free(c.notes);
+
+    return JB_OK_VAL;
+}
+
+// writes throwaway notes under `/_bench_rm/` for db_rm to delete
+static jb_res_t make_scratch(harness_t *h, size_t n) {
+    char dir[PATH_MAX + 1];
+    jb_errno_t err = jb_path_cat(h->dir, "_bench_rm", dir);
+    JB_TRY_IO(err, "scratch path too long");
+
+    err = jb_mkdir_rec(dir);
+    JB_TRY_IO(err, "failed to create scratch directory '%s'", dir);
+
+    for (size_t i = 0; i < n; i++) {
+        char path[PATH_MAX + 1];
+        if (snprintf(path, PATH_MAX, "%s/s%03zu", dir, i) >= PATH_MAX)
+            return JB_ERR(JB_ERR_USER, "scratch path too long");
+
+        FILE *f = fopen(path, "w");
+        if (!f) return JB_ERR_LIBC(errno, "failed to create scratch note '%s'", path);
+
+        fputs("adrus benchrm\nscratch\n", f);
+        fclose(f);
+    }
+
+    return JB_OK_VAL;
+}
+
+static jb_res_t bench_rm(harness_t *h, bool cold) {
+    bench_result_t res;
+    bench_result_init(&res, "db_rm", cache_name(cold), TOUCH_MAX);
+
+    for (size_t i = 0; i < h->iters; i++) {
+        JB_TRY(make_scratch(h, TOUCH_MAX));
+
+        db_t db;
+        JB_TRY(db_init(&db));
+
+        db_tag_t filter = {.sign = true, .tag = db_def_tag(&db, "benchrm")};
+
+        prepare(h, cold);
+
+        uint64_t start = jb_now();
+        db_rm(&db, "/_bench_rm/*", &filter, 1);
+        bench_result_add(&res, jb_now() - start);
+
+        db_free(&db);
+    }
+
+    bench_report_add(&h->rep, &res);
+    bench_result_free(&res);
+
+    return JB_OK_VAL;
+}
+
+// synthetic script exercising every syntactic form jb_parse understands, with a command per line
+// ending in `end`
+static char *make_script(size_t bytes, const char *end) {
+    char *src = JB_BUF;
+    char line[256];
+
+    for (size_t i = 0; jb_buf_len(src) < bytes; i++) {
+        int len = snprintf(line,
+                           sizeof(line),
+                           "# item %zu\nset v%zu {puts \"line\\t%zu\\n\" [add $v%zu %zu]; list a b c}%s",
+                           i,
+                           i,
+                           i,
+                           i,
+                           i * 7,
+                           end);
+
+        for (int j = 0; j < len; j++) jb_buf_push(src, line[j]);
+    }
+
+    jb_buf_push(src, '\0');
+
+    return src;
+}
+
+static jb_res_t bench_parse(harness_t *h) {
+    char *src = make_script(h->script, "\n");
+
+    bench_result_t res;
+    bench_result_init(&res, "jb_parse", "-", jb_buf_len(src) - 1);
+
+    for (size_t i = 0; i < h->iters; i++) {
+        jb_arena_t arena;
+        jb_arena_init(&arena, 1 << 20);
+        jb_val_t val;
+
+        uint64_t start = jb_now();
+        jb_res_t parsed = jb_parse(&arena, src, &val);
+        bench_result_add(&res, jb_now() - start);
+
+        jb_arena_free(&arena);
+        JB_TRY(parsed);
+    }
+
+    bench_report_add(&h->rep, &res);
+    bench_result_free(&res);
+    jb_buf_free(src);
+
+    return JB_OK_VAL;
+}
+
+static jb_res_t bench_tree_load(harness_t *h) {
+    char *src = make_script(h->script, "\n");
+
+    jb_arena_t arena;
+    jb_arena_init(&arena, 1 << 20);
+    jb_val_t val;
+    jb_res_t parsed = jb_parse(&arena, src, &val);
+
+    jb_io_buf_t buf;
+    jb_errno_t err = jb_io_buf_init(&buf, 1 << 20);
+    if (!err && parsed JB_IS_OK) err = jb_tree_save(&val, &buf);
+
+    jb_arena_free(&arena);
+    jb_buf_free(src);
+    JB_TRY(parsed);
+    JB_TRY_IO(err, "failed to save tree");
+
+    bench_result_t res;
+    bench_result_init(&res, "jb_tree_load", "-", buf.len);
+
+    for (size_t i = 0; i < h->iters && parsed JB_IS_OK; i++) {
+        jb_arena_init(&arena, 1 << 20);
+        size_t used;
+
+        uint64_t start = jb_now();
+        parsed = jb_tree_load(&arena, buf.buf, buf.len, &val, &used);
+        bench_result_add(&res, jb_now() - start);
+
+        jb_arena_free(&arena);
+    }
+
+    bench_report_add(&h->rep, &res);
+    bench_result_free(&res);
+    jb_io_buf_free(&buf);
+
+    return parsed;
+}
+
+// chunk size of the push parser benchmark, as a pipe would deliver it
+#define PARSE_CHUNK (64 << 10)
+
+static jb_res_t count_cmd(void *state, jb_cmd_t *cmd) {
+    (void)cmd;
+
+    jb_arena_t *arena = state;
+    jb_arena_reset(arena);
+
+    return JB_OK_VAL;
+}
+
+static jb_res_t bench_parse_chunked(harness_t *h) {
+    char *src = make_script(h->script, ";\n");
+    size_t len = jb_buf_len(src) - 1;
+
+    bench_result_t res;
+    bench_result_init(&res, "jb_parser_feed", "-", len);
+
+    for (size_t i = 0; i < h->iters; i++) {
+        jb_arena_t arena;
+        jb_arena_init(&arena, 64 << 10);
+
+        jb_parser_t p;
+        jb_parser_init(&p, &arena, count_cmd, &arena);
+
+        uint64_t start = jb_now();
+        jb_res_t parsed = JB_OK_VAL;
+        for (size_t off = 0; off < len && parsed JB_IS_OK; off += PARSE_CHUNK)
+            parsed = jb_parser_feed(&p, src + off, JB_MIN(len - off, PARSE_CHUNK));
+        if (parsed JB_IS_OK) parsed = jb_parser_finish(&p);
+        bench_result_add(&res, jb_now() - start);
+
+        jb_parser_free(&p);
+        jb_arena_free(&arena);
+        JB_TRY(parsed);
+    }
+
+    bench_report_add(&h->rep, &res);
+    bench_result_free(&res);
+    jb_buf_free(src);
+
+    return JB_OK_VAL;
+}
+
+static jb_res_t run(harness_t *h) {
+    // measure notebook size once, so each result can be tagged with it
+    db_t db;
+    JB_TRY(db_init(&db));
+    db_query(&db, &h->notes, NULL, 0, NULL, count_cb);
+
+    bool modes[] = {false, true};
+    for (size_t m = 0; m < 2; m++) {
+        bool cold = modes[m];
+        if ((cold && !h->cold) || (!cold && !h->warm)) continue;
+
+        JB_TRY(bench_init(h, cold));
+        JB_TRY(bench_stream(h, cold));
+        JB_TRY(bench_mutate(h, &db, cold));
+        JB_TRY(bench_rm(h, cold));
+    }
+
+    bench_query(h, &db);
+    bench_ls(h, &db);
+    db_free(&db);
+
+    JB_TRY(bench_parse(h));
+    JB_TRY(bench_parse_chunked(h));
+    JB_TRY(bench_tree_load(h));
+
+    return JB_OK_VAL;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-i ITERS] [-f csv|json] [-o OUT] [-c warm|cold|both] [-p SCRIPT_BYTES] DIR\n",
+            argv0);
+}
+
+int main(int argc, char *argv[]) {
+    // keep per-note diagnostics out of the timings unless explicitly requested
+    setenv("LOG_FILTER", "error", 0);
+    jb_log_init();
+
+    harness_t h = {
+        .iters = 5,
+        .script = 1 << 20,
+        .warm = true,
+        .cold = true,
+    };
+
+    bench_fmt_t fmt = BENCH_CSV;
+    FILE *out = stdout;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:f:o:c:p:h")) != -1) {
+        switch (opt) {
+            case 'i':
+                h.iters = strtoull(optarg, NULL, 10);
+                break;
+            case 'f':
+                if (!bench_fmt_parse(optarg, &fmt)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'o':
+                out = fopen(optarg, "w");
+                if (!out) {
+                    jb_error("failed to open '%s': %s", optarg, strerror(errno));
+                    return 1;
+                }
+                break;
+            case 'c':
+                h.warm = strcmp(optarg, "cold") != 0;
+                h.cold = strcmp(optarg, "warm") != 0;
+                break;
+            case 'p':
+                h.script = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    h.dir = argv[optind];
+    setenv("ADRUS_DIR", h.dir, 1);
+
+    bench_report_begin(&h.rep, fmt, out);
+
+    jb_res_t res = run(&h);
+
+    bench_report_end(&h.rep);
+    if (out != stdout) fclose(out);
+
+    if (res JB_IS_ERR) {
+        jb_report_result(res);
+        return 1;
+    }
+
+    return 0;
+}
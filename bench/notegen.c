@@ -0,0 +1,271 @@
+/*
+ * adrus - simple CLI note manager
+ * Copyright (C) 2024  Jacob Sinclair <jcbsnclr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//
+// notegen.c: synthetic notebook generator
+//
+// writes a reproducible notebook of a given size, with tags drawn from a Zipfian distribution
+// and notes spread across a directory tree of configurable depth and fan-out
+//
+
+#define _GNU_SOURCE
+
+#include <bench.h>
+#include <errno.h>
+#include <linux/limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    const char *dir; // notebook directory to generate into
+
+    size_t notes;    // number of notes
+    size_t tags;     // size of tag vocabulary
+    double zipf;     // Zipf exponent for tag popularity
+    size_t per_note; // maximum tags per note
+
+    size_t depth;    // maximum directory depth
+    size_t width;    // directories per level
+
+    size_t body;     // approximate body size, in bytes
+    size_t foreign;  // percentage of files that are not adrus notes
+
+    uint64_t seed;
+} gen_cfg_t;
+
+static const char *words[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "note", "idea", "todo", "draft", "review",
+    "meeting", "paper", "reference", "summary", "question", "answer", "list", "plan",
+};
+
+#define WORD_COUNT (sizeof(words) / sizeof(words[0]))
+
+#define TAG_NAME_MAX 32
+
+// tag with popularity rank `r` (0 = most popular); always a valid `[a-z]+` adrus tag
+static void tag_name(size_t r, char out[TAG_NAME_MAX]) {
+    size_t i = 0;
+    out[i++] = 't';
+
+    do {
+        out[i++] = 'a' + r % 26;
+        r /= 26;
+    } while (r && i < TAG_NAME_MAX - 1);
+
+    out[i] = '\0';
+}
+
+// cumulative distribution of tag ranks under Zipf's law
+static double *zipf_cdf(size_t n, double s) {
+    double *cdf = malloc(sizeof(double) * n);
+
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += 1.0 / pow((double)(i + 1), s);
+        cdf[i] = sum;
+    }
+
+    for (size_t i = 0; i < n; i++) cdf[i] /= sum;
+
+    return cdf;
+}
+
+static size_t zipf_sample(bench_rng_t *rng, double *cdf, size_t n) {
+    double u = bench_rng_unit(rng);
+
+    size_t lo = 0, hi = n - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static void write_body(FILE *f, bench_rng_t *rng, size_t bytes) {
+    size_t written = 0, col = 0;
+
+    while (written < bytes) {
+        const char *w = words[bench_rng_below(rng, WORD_COUNT)];
+        size_t len = strlen(w);
+
+        fputs(w, f);
+        written += len;
+        col += len;
+
+        if (col > 72) {
+            fputc('\n', f);
+            col = 0;
+        } else {
+            fputc(' ', f);
+            col++;
+        }
+
+        written++;
+    }
+
+    fputc('\n', f);
+}
+
+static jb_res_t generate(gen_cfg_t *cfg) {
+    bench_rng_t rng = {cfg->seed};
+    double *cdf = zipf_cdf(cfg->tags, cfg->zipf);
+    size_t *chosen = malloc(sizeof(size_t) * (cfg->per_note + 1));
+
+    jb_errno_t err = jb_mkdir_rec(cfg->dir);
+    JB_TRY_IO(err, "failed to create notebook directory '%s'", cfg->dir);
+
+    size_t foreign = 0;
+
+    for (size_t i = 0; i < cfg->notes; i++) {
+        char dir[PATH_MAX];
+        int len = snprintf(dir, PATH_MAX, "%s", cfg->dir);
+
+        size_t depth = bench_rng_below(&rng, cfg->depth + 1);
+        for (size_t d = 0; d < depth; d++)
+            len += snprintf(dir + len, PATH_MAX - len, "/d%lu", bench_rng_below(&rng, cfg->width));
+
+        err = jb_mkdir_rec(dir);
+        JB_TRY_IO(err, "failed to create directory '%s'", dir);
+
+        char path[PATH_MAX + 1];
+        if (snprintf(path, PATH_MAX, "%s/n%07zu.txt", dir, i) >= PATH_MAX)
+            return JB_ERR(JB_ERR_USER, "note path too long");
+
+        FILE *f = fopen(path, "w");
+        if (!f) return JB_ERR_LIBC(errno, "failed to create note '%s'", path);
+
+        if (bench_rng_below(&rng, 100) < cfg->foreign) {
+            // ordinary text file; must be rejected by the scanner
+            foreign++;
+        } else {
+            fputs("adrus", f);
+
+            size_t ntags = bench_rng_below(&rng, cfg->per_note + 1);
+            size_t n = 0;
+
+            // draw distinct tags
+            for (size_t t = 0; t < ntags * 4 && n < ntags; t++) {
+                size_t r = zipf_sample(&rng, cdf, cfg->tags);
+
+                bool dup = false;
+                for (size_t j = 0; j < n; j++) dup |= chosen[j] == r;
+                if (dup) continue;
+
+                chosen[n++] = r;
+
+                char tag[TAG_NAME_MAX];
+                tag_name(r, tag);
+                fprintf(f, " %s", tag);
+            }
+
+            fputc('\n', f);
+        }
+
+        write_body(f, &rng, cfg->body);
+
+        if (fclose(f) == EOF) return JB_ERR_LIBC(errno, "failed to write note '%s'", path);
+    }
+
+    free(chosen);
+    free(cdf);
+
+    jb_info("generated %zu files (%zu non-adrus) in '%s'", cfg->notes, foreign, cfg->dir);
+
+    return JB_OK_VAL;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-n NOTES] [-t TAGS] [-s ZIPF] [-k TAGS_PER_NOTE] [-d DEPTH] [-w WIDTH]\n"
+            "          [-b BODY_BYTES] [-f FOREIGN_PERCENT] [-r SEED] DIR\n",
+            argv0);
+}
+
+int main(int argc, char *argv[]) {
+    jb_log_init();
+
+    gen_cfg_t cfg = {
+        .notes = 1000,
+        .tags = 200,
+        .zipf = 1.0,
+        .per_note = 4,
+        .depth = 3,
+        .width = 8,
+        .body = 256,
+        .foreign = 5,
+        .seed = 0x61647275,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:s:k:d:w:b:f:r:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                cfg.notes = strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                cfg.tags = strtoull(optarg, NULL, 10);
+                break;
+            case 's':
+                cfg.zipf = strtod(optarg, NULL);
+                break;
+            case 'k':
+                cfg.per_note = strtoull(optarg, NULL, 10);
+                break;
+            case 'd':
+                cfg.depth = strtoull(optarg, NULL, 10);
+                break;
+            case 'w':
+                cfg.width = strtoull(optarg, NULL, 10);
+                break;
+            case 'b':
+                cfg.body = strtoull(optarg, NULL, 10);
+                break;
+            case 'f':
+                cfg.foreign = strtoull(optarg, NULL, 10);
+                break;
+            case 'r':
+                cfg.seed = strtoull(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1 || cfg.tags == 0 || cfg.width == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    cfg.dir = argv[optind];
+
+    jb_res_t res = generate(&cfg);
+    if (res JB_IS_ERR) {
+        jb_report_result(res);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * adrus - simple CLI note manager
+ * Copyright (C) 2024  Jacob Sinclair <jcbsnclr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//
+// render.c: offline synth benchmark
+//
+// plays a voice pool through `jb_offline_render` as fast as it goes, and reports seconds rendered
+// per second of wall time. the performance is a standard MIDI file (-m) or, by default, a scripted
+// run of overlapping chords. -w writes the result of the last iteration to a WAV file
+//
+
+#define _GNU_SOURCE
+
+#include <bench.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SRATE 48000
+#define BLOCK 256
+
+// oscillators in the patch, each modulating the one above it
+#define STACK_DEPTH 4
+
+// the scripted performance: a chord of CHORD notes every half second, held for a second
+#define CHORD 8
+#define TAIL SRATE
+
+static jb_midi_event_t event(size_t frame, int kind, uint8_t key) {
+    jb_midi_event_t ev = {.frame = frame, .ev = {.kind = kind, .args = {key, 100}}};
+    return ev;
+}
+
+static jb_midi_event_t *script(size_t seconds) {
+    jb_midi_event_t *events = JB_BUF;
+
+    for (size_t step = 0; step < seconds * 2; step++) {
+        uint8_t root = 36 + (step * 5) % 24;
+
+        for (size_t i = 0; i < CHORD; i++)
+            jb_buf_push(events, event(step * SRATE / 2, JB_NOTE_ON, root + i * 4));
+        for (size_t i = 0; i < CHORD; i++)
+            jb_buf_push(events, event(step * SRATE / 2 + SRATE, JB_NOTE_OFF, root + i * 4));
+    }
+
+    // note offs overlap the next chords
+    for (size_t i = 1; i < jb_buf_len(events); i++) {
+        jb_midi_event_t ev = events[i];
+        size_t j = i;
+
+        for (; j > 0 && events[j - 1].frame > ev.frame; j--) events[j] = events[j - 1];
+        events[j] = ev;
+    }
+
+    return events;
+}
+
+static void make_stack(jb_osc_t *oscs, jb_osc_link_t *links, jb_patch_t *patch) {
+    for (size_t i = 0; i < STACK_DEPTH; i++) {
+        oscs[i] = (jb_osc_t){.fn = jb_wave_sin, .detune = JB_SEMIS(12 * i), .amp = 0.5f};
+        links[i] = (jb_osc_link_t){
+            .osc = &oscs[i],
+            .mod = i % 2 ? JB_MOD_PM : JB_MOD_FM,
+            .next = i + 1 < STACK_DEPTH ? &links[i + 1] : NULL,
+        };
+    }
+
+    // the voices mix at full scale
+    oscs[0].amp = 0.1f;
+
+    jb_res_t err = jb_patch_from_chain(patch, links);
+    if (err JB_IS_ERR) {
+        jb_report_result(err);
+        exit(1);
+    }
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-i ITERS] [-f csv|json] [-o OUT] [-m MIDI] [-w WAV] [-s SECONDS] "
+            "[-v VOICES] [-t THREADS]\n",
+            argv0);
+}
+
+int main(int argc, char *argv[]) {
+    jb_log_init();
+
+    size_t iters = 5, seconds = 10, nvoices = 64, nthreads = 0;
+    const char *midi = NULL, *wav = NULL;
+    bench_fmt_t fmt = BENCH_CSV;
+    FILE *out = stdout;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:f:o:m:w:s:v:t:h")) != -1) {
+        switch (opt) {
+            case 'i':
+                iters = strtoull(optarg, NULL, 10);
+                break;
+            case 'f':
+                if (!bench_fmt_parse(optarg, &fmt)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'o':
+                out = fopen(optarg, "w");
+                if (!out) {
+                    jb_error("failed to open '%s': %s", optarg, strerror(errno));
+                    return 1;
+                }
+                break;
+            case 'm':
+                midi = optarg;
+                break;
+            case 'w':
+                wav = optarg;
+                break;
+            case 's':
+                seconds = strtoull(optarg, NULL, 10);
+                break;
+            case 'v':
+                nvoices = strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                nthreads = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    jb_midi_event_t *events = NULL;
+
+    if (midi) {
+        jb_res_t err = jb_midi_file_load(midi, SRATE, &events);
+        if (err JB_IS_ERR) {
+            jb_report_result(err);
+            return 1;
+        }
+    } else {
+        events = script(seconds);
+    }
+
+    jb_osc_t oscs[STACK_DEPTH];
+    jb_osc_link_t links[STACK_DEPTH];
+    jb_patch_t patch;
+    make_stack(oscs, links, &patch);
+
+    jb_offline_t opts = {
+        .srate = SRATE,
+        .block = BLOCK,
+        .tail = TAIL,
+        .events = events,
+        .nevents = jb_buf_len(events),
+    };
+
+    char name[64];
+    snprintf(name, sizeof(name), "offline_%zu_t%zu", nvoices, nthreads + 1);
+
+    bench_result_t res;
+    bench_result_init(&res, name, "-", 0);
+
+    double best = 0;
+
+    for (size_t it = 0; it < iters; it++) {
+        // every iteration plays from silence
+        jb_voices_t vs;
+        jb_res_t err = jb_voices_init(&vs, &patch, nvoices, SRATE);
+        if (err JB_IS_OK) err = jb_voices_spawn(&vs, nthreads, BLOCK);
+        if (err JB_IS_ERR) {
+            jb_report_result(err);
+            return 1;
+        }
+
+        jb_client_config_t cfg = {
+            .name = "render",
+            .state = &vs,
+            .midi_cb = jb_voices_midi,
+            .audio_cb = jb_voices_audio,
+        };
+
+        opts.wav = it + 1 == iters ? wav : NULL;
+
+        jb_offline_stats_t stats;
+        err = jb_offline_render(cfg, &opts, &stats);
+        jb_voices_free(&vs);
+
+        if (err JB_IS_ERR) {
+            jb_report_result(err);
+            return 1;
+        }
+
+        res.size = stats.frames;
+        bench_result_add(&res, stats.wall_ns);
+        best = JB_MAX(best, stats.speed);
+    }
+
+    fprintf(stderr, "%-16s %8.1fx real time (%zu events)\n", name, best, jb_buf_len(events));
+
+    bench_report_t rep;
+    bench_report_begin(&rep, fmt, out);
+    bench_report_add(&rep, &res);
+    bench_report_end(&rep);
+
+    if (out != stdout) fclose(out);
+
+    bench_result_free(&res);
+    jb_patch_free(&patch);
+    jb_buf_free(events);
+
+    return 0;
+}
@@ -0,0 +1,286 @@
+/*
+ * adrus - simple CLI note manager
+ * Copyright (C) 2024  Jacob Sinclair <jcbsnclr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//
+// synth.c: oscillator rendering microbenchmark
+//
+// renders a second of audio per wave shape, one sample at a time with `jb_osc_sample` and a
+// JACK-sized block at a time with `jb_osc_render`; then the same for a stack of oscillators
+// modulating each other, with `jb_chain_sample` and a compiled `jb_patch_t`; then that patch
+// played by a pool of held voices, on one thread and spread across the cores
+//
+
+#define _GNU_SOURCE
+
+#include <bench.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SRATE 48000
+#define BLOCK 256
+#define NOTE JB_SEMIS(57) // A3
+
+typedef struct {
+    const char *name;
+    jb_wave_fn_t fn;
+} wave_t;
+
+static const wave_t waves[] = {
+    {"sin", jb_wave_sin},
+    {"square", jb_wave_square},
+    {"triangle", jb_wave_triangle},
+    {"saw", jb_wave_saw},
+};
+
+#define WAVE_COUNT (sizeof(waves) / sizeof(waves[0]))
+
+static volatile float sink;
+
+static void render_sample(jb_osc_t *osc, float *buf) {
+    for (size_t base = 0; base < SRATE; base += BLOCK)
+        for (size_t i = 0; i < BLOCK; i++) buf[i] = jb_osc_sample(osc, NOTE, base + i, SRATE);
+
+    sink = buf[0];
+}
+
+static void render_block(jb_osc_t *osc, float *buf) {
+    jb_osc_state_t state = {0};
+
+    for (size_t base = 0; base < SRATE; base += BLOCK)
+        jb_osc_render(osc, &state, NOTE, SRATE, BLOCK, buf);
+
+    sink = buf[0];
+}
+
+static void bench_wave(bench_report_t *rep, size_t iters, const wave_t *wave, bool block) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s_%s", block ? "render" : "sample", wave->name);
+
+    jb_osc_t osc = {.fn = wave->fn, .detune = 0, .amp = 0.5f, .bias = 0.f};
+    float buf[BLOCK];
+
+    bench_result_t res;
+    bench_result_init(&res, name, "-", SRATE);
+
+    for (size_t it = 0; it < iters; it++) {
+        uint64_t start = jb_now();
+
+        if (block)
+            render_block(&osc, buf);
+        else
+            render_sample(&osc, buf);
+
+        bench_result_add(&res, jb_now() - start);
+    }
+
+    uint64_t best = UINT64_MAX;
+    for (size_t i = 0; i < res.iters; i++) best = JB_MIN(best, res.samples[i]);
+
+    fprintf(stderr, "%-16s %8.2f ns/sample\n", name, (double)best / SRATE);
+
+    bench_report_add(rep, &res);
+    bench_result_free(&res);
+}
+
+// four sines, each modulating the one above it
+#define STACK_DEPTH 4
+
+static void render_chain(jb_osc_link_t *chain, float *buf) {
+    for (size_t base = 0; base < SRATE; base += BLOCK)
+        for (size_t i = 0; i < BLOCK; i++) buf[i] = jb_chain_sample(chain, NOTE, base + i, SRATE);
+
+    sink = buf[0];
+}
+
+static void render_patch(jb_patch_t *patch, float *scratch, float *buf) {
+    jb_osc_state_t states[STACK_DEPTH] = {0};
+
+    for (size_t base = 0; base < SRATE; base += BLOCK)
+        jb_patch_render(patch, states, NOTE, SRATE, BLOCK, scratch, buf);
+
+    sink = buf[0];
+}
+
+static void make_stack(jb_osc_t *oscs, jb_osc_link_t *links, jb_patch_t *patch) {
+    for (size_t i = 0; i < STACK_DEPTH; i++) {
+        oscs[i] = (jb_osc_t){.fn = jb_wave_sin, .detune = JB_SEMIS(12 * i), .amp = 0.5f};
+        links[i] = (jb_osc_link_t){
+            .osc = &oscs[i],
+            .mod = i % 2 ? JB_MOD_PM : JB_MOD_FM,
+            .next = i + 1 < STACK_DEPTH ? &links[i + 1] : NULL,
+        };
+    }
+
+    jb_res_t err = jb_patch_from_chain(patch, links);
+    if (err JB_IS_ERR) {
+        jb_report_result(err);
+        exit(1);
+    }
+}
+
+static void bench_stack(bench_report_t *rep, size_t iters, bool block) {
+    const char *name = block ? "render_stack" : "sample_stack";
+
+    jb_osc_t oscs[STACK_DEPTH];
+    jb_osc_link_t links[STACK_DEPTH];
+    jb_patch_t patch;
+    make_stack(oscs, links, &patch);
+
+    float buf[BLOCK];
+    float *scratch = malloc(jb_patch_scratch(&patch) * sizeof(float));
+
+    bench_result_t res;
+    bench_result_init(&res, name, "-", SRATE);
+
+    for (size_t it = 0; it < iters; it++) {
+        uint64_t start = jb_now();
+
+        if (block)
+            render_patch(&patch, scratch, buf);
+        else
+            render_chain(links, buf);
+
+        bench_result_add(&res, jb_now() - start);
+    }
+
+    uint64_t best = UINT64_MAX;
+    for (size_t i = 0; i < res.iters; i++) best = JB_MIN(best, res.samples[i]);
+
+    fprintf(stderr, "%-16s %8.2f ns/sample\n", name, (double)best / SRATE);
+
+    bench_report_add(rep, &res);
+    bench_result_free(&res);
+
+    free(scratch);
+    jb_patch_free(&patch);
+}
+
+static void bench_voices(bench_report_t *rep, size_t iters, size_t nvoices, size_t nthreads) {
+    char name[64];
+    snprintf(name, sizeof(name), "voices_%zu_t%zu", nvoices, nthreads + 1);
+
+    jb_osc_t oscs[STACK_DEPTH];
+    jb_osc_link_t links[STACK_DEPTH];
+    jb_patch_t patch;
+    make_stack(oscs, links, &patch);
+
+    jb_voices_t vs;
+    jb_res_t err = jb_voices_init(&vs, &patch, nvoices, SRATE);
+    if (err JB_IS_ERR) {
+        jb_report_result(err);
+        exit(1);
+    }
+
+    err = jb_voices_spawn(&vs, nthreads, BLOCK);
+    if (err JB_IS_ERR) {
+        jb_report_result(err);
+        exit(1);
+    }
+
+    // a held chord, one note per voice
+    for (size_t i = 0; i < nvoices; i++) jb_voices_note_on(&vs, 36 + i, 100);
+
+    float buf[BLOCK];
+
+    bench_result_t res;
+    bench_result_init(&res, name, "-", SRATE);
+
+    for (size_t it = 0; it < iters; it++) {
+        uint64_t start = jb_now();
+
+        for (size_t base = 0; base < SRATE; base += BLOCK) jb_voices_render(&vs, BLOCK, buf);
+        sink = buf[0];
+
+        bench_result_add(&res, jb_now() - start);
+    }
+
+    uint64_t best = UINT64_MAX;
+    for (size_t i = 0; i < res.iters; i++) best = JB_MIN(best, res.samples[i]);
+
+    fprintf(stderr, "%-16s %8.2f ns/sample\n", name, (double)best / SRATE);
+
+    bench_report_add(rep, &res);
+    bench_result_free(&res);
+
+    jb_voices_free(&vs);
+    jb_patch_free(&patch);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-i ITERS] [-f csv|json] [-o OUT]\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+    jb_log_init();
+
+    size_t iters = 5;
+    bench_fmt_t fmt = BENCH_CSV;
+    FILE *out = stdout;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:f:o:h")) != -1) {
+        switch (opt) {
+            case 'i':
+                iters = strtoull(optarg, NULL, 10);
+                break;
+            case 'f':
+                if (!bench_fmt_parse(optarg, &fmt)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'o':
+                out = fopen(optarg, "w");
+                if (!out) {
+                    jb_error("failed to open '%s': %s", optarg, strerror(errno));
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    bench_report_t rep;
+    bench_report_begin(&rep, fmt, out);
+
+    for (size_t w = 0; w < WAVE_COUNT; w++) {
+        bench_wave(&rep, iters, &waves[w], false);
+        bench_wave(&rep, iters, &waves[w], true);
+    }
+
+    bench_stack(&rep, iters, false);
+    bench_stack(&rep, iters, true);
+
+    // the extra threads are workers; the bench thread renders a share too
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads = ncpus > 1 ? JB_MIN(ncpus, 8) - 1 : 0;
+
+    bench_voices(&rep, iters, 16, 0);
+    bench_voices(&rep, iters, 64, 0);
+    if (nthreads) bench_voices(&rep, iters, 64, nthreads);
+
+    bench_report_end(&rep);
+    if (out != stdout) fclose(out);
+
+    return 0;
+}
@@ -0,0 +1,387 @@
+/*
+ * adrus - simple CLI note manager
+ * Copyright (C) 2024  Jacob Sinclair <jcbsnclr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//
+// vm.c: jbase VM microbenchmark
+//
+// runs the same loop-heavy script by walking its `jb_parse` tree directly (looking commands and
+// variables up by name as it goes) and as compiled bytecode, and times compiling it
+//
+
+#include <bench.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *script_fmt = "set i 0; set sum 0;"
+                                "while {lt $i %zu} {"
+                                "    set sum [add $sum [mul $i 3]];"
+                                "    if [lt $sum 0] {set sum 0};"
+                                "    set i [add $i 1]"
+                                "};"
+                                "do {add $sum 0}";
+
+//
+// tree-walking interpreter, as the baseline
+//
+
+typedef struct {
+    enum { T_NIL, T_INT, T_STR, T_BLOCK } kind;
+
+    union {
+        int64_t int_val;
+        jb_view_t str_val;
+        const jb_cmd_t *body;
+    };
+} tval_t;
+
+typedef struct {
+    jb_view_t name;
+    tval_t val;
+} var_t;
+
+typedef struct interp interp_t;
+typedef jb_res_t (*tnative_t)(interp_t *in, tval_t *args, size_t argc, tval_t *out);
+
+typedef struct {
+    const char *name;
+    tnative_t fn;
+} tcmd_t;
+
+struct interp {
+    var_t *vars; // jb_buf
+    const tcmd_t *cmds;
+};
+
+#define MAX_ARGS 16
+
+static jb_res_t eval_cmds(interp_t *in, const jb_cmd_t *cmds, tval_t *out);
+
+static bool view_eq(jb_view_t a, const char *b) {
+    return strncmp(a.ptr, b, a.len) == 0 && b[a.len] == '\0';
+}
+
+static var_t *find_var(interp_t *in, jb_view_t name) {
+    for (size_t i = 0; i < jb_buf_len(in->vars); i++)
+        if (in->vars[i].name.len == name.len && memcmp(in->vars[i].name.ptr, name.ptr, name.len) == 0)
+            return &in->vars[i];
+
+    return NULL;
+}
+
+static jb_res_t eval_word(interp_t *in, const jb_val_t *word, tval_t *out) {
+    switch (word->kind) {
+        case JB_VAL_INT:
+            *out = (tval_t){.kind = T_INT, .int_val = word->int_val};
+            break;
+        case JB_VAL_STR:
+            *out = (tval_t){.kind = T_STR, .str_val = word->str_val};
+            break;
+        case JB_VAL_REF: {
+            var_t *var = find_var(in, word->str_val);
+            *out = var ? var->val : (tval_t){.kind = T_NIL};
+        } break;
+        case JB_VAL_QUOTE:
+            *out = (tval_t){.kind = T_BLOCK, .body = word->body};
+            break;
+        case JB_VAL_INLINE:
+            return eval_cmds(in, word->body, out);
+    }
+
+    return JB_OK_VAL;
+}
+
+static jb_res_t eval_val(interp_t *in, tval_t val, tval_t *out) {
+    if (val.kind == T_BLOCK) return eval_cmds(in, val.body, out);
+
+    *out = val;
+    return JB_OK_VAL;
+}
+
+static jb_res_t eval_cmd(interp_t *in, const jb_cmd_t *cmd, tval_t *out) {
+    const jb_val_t *words = cmd->body;
+    size_t argc = jb_buf_len(words) - 1;
+
+    if (argc > MAX_ARGS) return JB_ERR(JB_ERR_USER, "too many arguments");
+
+    tval_t name, args[MAX_ARGS];
+    JB_TRY(eval_word(in, &words[0], &name));
+    for (size_t i = 0; i < argc; i++) JB_TRY(eval_word(in, &words[i + 1], &args[i]));
+
+    if (name.kind == T_BLOCK) return eval_cmds(in, name.body, out);
+    if (name.kind != T_STR) return JB_ERR(JB_ERR_USER, "not a command");
+
+    if (view_eq(name.str_val, "set")) {
+        if (argc != 2 || args[0].kind != T_STR) return JB_ERR(JB_ERR_USER, "bad `set`");
+
+        var_t *var = find_var(in, args[0].str_val);
+        if (!var) {
+            var_t new_var = {args[0].str_val, args[1]};
+            jb_buf_push(in->vars, new_var);
+        } else {
+            var->val = args[1];
+        }
+
+        *out = args[1];
+        return JB_OK_VAL;
+    }
+
+    for (const tcmd_t *c = in->cmds; c->name; c++)
+        if (view_eq(name.str_val, c->name)) return c->fn(in, args, argc, out);
+
+    return JB_ERR(JB_ERR_USER, "unknown command '%.*s'", (int)name.str_val.len, name.str_val.ptr);
+}
+
+static jb_res_t eval_cmds(interp_t *in, const jb_cmd_t *cmds, tval_t *out) {
+    *out = (tval_t){.kind = T_NIL};
+
+    for (size_t i = 0; i < jb_buf_len(cmds); i++)
+        if (jb_buf_len(cmds[i].body) > 0) JB_TRY(eval_cmd(in, &cmds[i], out));
+
+    return JB_OK_VAL;
+}
+
+static bool t_truthy(tval_t val) {
+    return (val.kind == T_INT && val.int_val) || (val.kind == T_STR && val.str_val.len) ||
+           val.kind == T_BLOCK;
+}
+
+static jb_res_t t_while(interp_t *in, tval_t *args, size_t argc, tval_t *out) {
+    if (argc != 2) return JB_ERR(JB_ERR_USER, "bad `while`");
+
+    tval_t cond;
+    *out = (tval_t){.kind = T_NIL};
+
+    for (;;) {
+        JB_TRY(eval_val(in, args[0], &cond));
+        if (!t_truthy(cond)) break;
+
+        JB_TRY(eval_val(in, args[1], out));
+    }
+
+    return JB_OK_VAL;
+}
+
+static jb_res_t t_if(interp_t *in, tval_t *args, size_t argc, tval_t *out) {
+    if (argc < 2 || argc > 3) return JB_ERR(JB_ERR_USER, "bad `if`");
+
+    tval_t cond;
+    JB_TRY(eval_val(in, args[0], &cond));
+
+    if (t_truthy(cond)) return eval_val(in, args[1], out);
+    if (argc == 3) return eval_val(in, args[2], out);
+
+    *out = (tval_t){.kind = T_NIL};
+    return JB_OK_VAL;
+}
+
+static jb_res_t t_do(interp_t *in, tval_t *args, size_t argc, tval_t *out) {
+    if (argc != 1) return JB_ERR(JB_ERR_USER, "bad `do`");
+
+    return eval_val(in, args[0], out);
+}
+
+static jb_res_t t_int2(tval_t *args, size_t argc) {
+    if (argc != 2 || args[0].kind != T_INT || args[1].kind != T_INT)
+        return JB_ERR(JB_ERR_USER, "expected two integers");
+
+    return JB_OK_VAL;
+}
+
+static jb_res_t t_lt(interp_t *in, tval_t *args, size_t argc, tval_t *out) {
+    (void)in;
+    JB_TRY(t_int2(args, argc));
+
+    *out = (tval_t){.kind = T_INT, .int_val = args[0].int_val < args[1].int_val};
+    return JB_OK_VAL;
+}
+
+static jb_res_t t_add(interp_t *in, tval_t *args, size_t argc, tval_t *out) {
+    (void)in;
+    JB_TRY(t_int2(args, argc));
+
+    *out = (tval_t){.kind = T_INT, .int_val = args[0].int_val + args[1].int_val};
+    return JB_OK_VAL;
+}
+
+static jb_res_t t_mul(interp_t *in, tval_t *args, size_t argc, tval_t *out) {
+    (void)in;
+    JB_TRY(t_int2(args, argc));
+
+    *out = (tval_t){.kind = T_INT, .int_val = args[0].int_val * args[1].int_val};
+    return JB_OK_VAL;
+}
+
+static const tcmd_t tree_cmds[] = {
+    {"while", t_while},
+    {"if", t_if},
+    {"do", t_do},
+    {"lt", t_lt},
+    {"add", t_add},
+    {"mul", t_mul},
+    {NULL, NULL},
+};
+
+//
+// benchmarks
+//
+
+static void report(bench_report_t *rep, bench_result_t *res, size_t loops) {
+    uint64_t best = UINT64_MAX;
+    for (size_t i = 0; i < res->iters; i++) best = JB_MIN(best, res->samples[i]);
+
+    fprintf(stderr, "%-10s %10.3f ms %8.2f ns/loop\n", res->name, best / 1e6, (double)best / loops);
+
+    bench_report_add(rep, res);
+    bench_result_free(res);
+}
+
+static jb_res_t bench_tree(bench_report_t *rep, size_t iters, size_t loops, jb_val_t *tree,
+                           int64_t *sum) {
+    bench_result_t res;
+    bench_result_init(&res, "tree", "-", loops);
+
+    for (size_t it = 0; it < iters; it++) {
+        interp_t in = {.vars = JB_BUF, .cmds = tree_cmds};
+        tval_t out;
+
+        uint64_t start = jb_now();
+        jb_res_t ran = eval_cmds(&in, tree->body, &out);
+        bench_result_add(&res, jb_now() - start);
+
+        jb_buf_free(in.vars);
+        JB_TRY(ran);
+
+        *sum = out.int_val;
+    }
+
+    report(rep, &res, loops);
+    return JB_OK_VAL;
+}
+
+static jb_res_t bench_bytecode(bench_report_t *rep, size_t iters, size_t loops, jb_val_t *tree,
+                               int64_t *sum) {
+    bench_result_t compile_res, run_res;
+    bench_result_init(&compile_res, "compile", "-", loops);
+    bench_result_init(&run_res, "bytecode", "-", loops);
+
+    jb_vm_t vm;
+    jb_vm_init(&vm);
+
+    for (size_t it = 0; it < iters; it++) {
+        jb_prog_t prog;
+
+        uint64_t start = jb_now();
+        JB_TRY(jb_compile(tree, &prog));
+        jb_vm_link(&vm, &prog);
+        bench_result_add(&compile_res, jb_now() - start);
+
+        jb_vm_val_t out;
+
+        start = jb_now();
+        jb_res_t ran = jb_vm_run(&vm, &prog, &out);
+        bench_result_add(&run_res, jb_now() - start);
+
+        jb_prog_free(&prog);
+        JB_TRY(ran);
+
+        *sum = out.int_val;
+    }
+
+    jb_vm_free(&vm);
+
+    report(rep, &compile_res, loops);
+    report(rep, &run_res, loops);
+
+    return JB_OK_VAL;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-i ITERS] [-n LOOPS] [-f csv|json] [-o OUT]\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+    jb_log_init();
+
+    size_t iters = 5;
+    size_t loops = 1000000;
+    bench_fmt_t fmt = BENCH_CSV;
+    FILE *out = stdout;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:n:f:o:h")) != -1) {
+        switch (opt) {
+            case 'i':
+                iters = strtoull(optarg, NULL, 10);
+                break;
+            case 'n':
+                loops = strtoull(optarg, NULL, 10);
+                break;
+            case 'f':
+                if (!bench_fmt_parse(optarg, &fmt)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'o':
+                out = fopen(optarg, "w");
+                if (!out) {
+                    jb_error("failed to open '%s': %s", optarg, strerror(errno));
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    char src[512];
+    snprintf(src, sizeof(src), script_fmt, loops);
+
+    jb_arena_t arena;
+    jb_arena_init(&arena, 0);
+
+    jb_val_t tree;
+    jb_res_t res = jb_parse(&arena, src, &tree);
+
+    bench_report_t rep;
+    bench_report_begin(&rep, fmt, out);
+
+    int64_t tree_sum = 0, vm_sum = 0;
+    if (res JB_IS_OK) res = bench_tree(&rep, iters, loops, &tree, &tree_sum);
+    if (res JB_IS_OK) res = bench_bytecode(&rep, iters, loops, &tree, &vm_sum);
+
+    bench_report_end(&rep);
+    if (out != stdout) fclose(out);
+
+    jb_arena_free(&arena);
+
+    if (res JB_IS_ERR) {
+        jb_report_result(res);
+        return 1;
+    }
+
+    if (tree_sum != vm_sum) {
+        jb_error("interpreters disagree: %ld != %ld", tree_sum, vm_sum);
+        return 1;
+    }
+
+    return 0;
+}
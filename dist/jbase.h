@@ -22,6 +22,9 @@
 #include "dirent.h"
 #undef JBASE_AUDIO
 #undef JBASE_LOG_META
+#define JBASE_SIMD                 // use SIMD code paths where the target supports them
+#define JBASE_HASH JB_HASH_MX      // hash function behind jb_hash/jb_hash_str (JB_HASH_*)
+#define JBASE_URING                // batch file reads through io_uring where the kernel allows it
 
 // includes
 #include <stdint.h>
@@ -30,6 +33,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <sys/stat.h>
 
@@ -57,20 +61,43 @@ typedef enum {
     JB_ERROR    // something is catastrophically wrong
 } jb_llevel_t;
 
-// initialise logging, read filter from `LOG_FILTER` env var
+// messages below this level are compiled out entirely
+#ifndef JBASE_LOG_MIN
+#ifdef JBASE_ASSERT
+#define JBASE_LOG_MIN JB_TRACE
+#else
+#define JBASE_LOG_MIN JB_INFO
+#endif
+#endif
+
+// runtime filter; messages below it are skipped before their arguments are evaluated
+extern jb_llevel_t jb_log_filter;
+
+// initialise logging, read filter from `LOG_FILTER` env var, and start the async sink if
+// `LOG_ASYNC` is set
 void jb_log_init();
 
+// hand messages to a background writer thread instead of writing them in the caller
+void jb_log_async_start();
+// write out any queued messages and stop the writer thread
+void jb_log_async_stop();
+
 // log an individual message to stderr w/ metadata
-void jb_log_inner(jb_llevel_t level, const char *filename, uint32_t line, const char *func, char *fmt, ...);
+void jb_log_inner(jb_llevel_t level, const char *filename, uint32_t line, const char *func, char *fmt, ...)
+    __attribute__((format(printf, 5, 6)));
 // log an individual line, without any error metadata
-void jb_log_line(char *fmt, ...);
+void jb_log_line(char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#define jb_log(level, ...) \
+    ((level) >= JBASE_LOG_MIN && (level) >= jb_log_filter \
+        ? jb_log_inner((level), __FILE__, __LINE__, __func__, __VA_ARGS__) : (void)0)
 
 // utility macros for logging messages with a given level and printf-formatted message
-#define jb_trace(...) jb_log_inner(JB_TRACE, __FILE__, __LINE__, __func__, __VA_ARGS__)
-#define jb_debug(...) jb_log_inner(JB_DEBUG, __FILE__, __LINE__, __func__, __VA_ARGS__)
-#define jb_info(...)  jb_log_inner(JB_INFO,  __FILE__, __LINE__, __func__, __VA_ARGS__)
-#define jb_warn(...)  jb_log_inner(JB_WARN,  __FILE__, __LINE__, __func__, __VA_ARGS__)
-#define jb_error(...) jb_log_inner(JB_ERROR, __FILE__, __LINE__, __func__, __VA_ARGS__)
+#define jb_trace(...) jb_log(JB_TRACE, __VA_ARGS__)
+#define jb_debug(...) jb_log(JB_DEBUG, __VA_ARGS__)
+#define jb_info(...)  jb_log(JB_INFO,  __VA_ARGS__)
+#define jb_warn(...)  jb_log(JB_WARN,  __VA_ARGS__)
+#define jb_error(...) jb_log(JB_ERROR, __VA_ARGS__)
 
 //
 // hashing: hash.c
@@ -78,9 +105,20 @@ void jb_log_line(char *fmt, ...);
 
 typedef uint64_t jb_hash_t;
 
+// hash functions selectable via JBASE_HASH
+#define JB_HASH_FNV1A 1 // byte-at-a-time FNV-1a
+#define JB_HASH_MX    2 // word-at-a-time multiply-fold hash
+
 jb_hash_t jb_fnv1a(const void *buf, size_t bytes);
 jb_hash_t jb_fnv1a_str(const char *str);
 
+jb_hash_t jb_mxhash(const void *buf, size_t bytes);
+jb_hash_t jb_mxhash_str(const char *str); // hashes while scanning for NUL; same as jb_mxhash
+
+// hash with the configured function
+jb_hash_t jb_hash(const void *buf, size_t bytes);
+jb_hash_t jb_hash_str(const char *str);
+
 //
 // error handling: err.c
 //
@@ -89,10 +127,11 @@ typedef enum {
     JB_OK,        // nothing wrong
     JB_ERR_JACK,  // JACK operation failed
     JB_ERR_LIBC,  // libc operation failed
-    JB_ERR_OOM,   // out of memory (currently unused)
+    JB_ERR_OOM,   // out of memory
     JB_ERR_USER,  // user-defined error info, for users of library
 
-    JB_ERR_PARSER
+    JB_ERR_PARSER,
+    JB_ERR_VM     // script failed while running
 } jb_err_t;
 
 typedef struct{
@@ -158,6 +197,33 @@ bool jb_lx_eof(jb_lexer_t *lx);
 bool jb_lx_tok(char c);
 bool jb_lx_ws(char c);
 
+#define JB_CC_BYTES 16
+#define JB_CC_RANGES 4
+
+// set of bytes; membership is a table lookup, and classes made of a few bytes and ranges are also
+// scanned 16 (SSE2) or 32 (AVX2) bytes at a time
+typedef struct {
+    bool has[256];
+
+    // the class is `bytes` and `ranges`, complemented if `inv`; only exact if `simd` is set
+    uint8_t bytes[JB_CC_BYTES];
+    uint8_t lo[JB_CC_RANGES], hi[JB_CC_RANGES];
+    uint8_t nbytes, nranges;
+    bool inv, simd;
+} jb_cclass_t;
+
+void jb_cc_init(jb_cclass_t *cc);
+void jb_cc_add_chars(jb_cclass_t *cc, const char *chars);
+void jb_cc_add_range(jb_cclass_t *cc, char lo, char hi);
+void jb_cc_invert(jb_cclass_t *cc);
+
+#define jb_cc_has(cc, c) ((cc)->has[(uint8_t)(c)])
+
+// length of the run of class members at the start of `src`
+size_t jb_cc_span(const jb_cclass_t *cc, const char *src, size_t len);
+
+bool jb_lx_take_while_class(jb_lexer_t *lx, const jb_cclass_t *cc);
+
 //
 // iterators: iter.c
 //
@@ -184,6 +250,7 @@ bool jb_iter_next(void *iter, void *out);
 
 typedef int jb_errno_t; // errno, 0 for success
 
+// growable byte builder; `buf[len]` is always a NUL, so the contents can be used as a string
 typedef struct {
     size_t len, cap;
     uint8_t *buf;
@@ -191,8 +258,20 @@ typedef struct {
 
 jb_errno_t jb_io_buf_init(jb_io_buf_t *buf, size_t cap);
 
-jb_errno_t jb_io_buf_write(jb_io_buf_t *buf, uint8_t *data, size_t len);
+// ensure room for `extra` more bytes without reallocating
+jb_errno_t jb_io_buf_reserve(jb_io_buf_t *buf, size_t extra);
+
+jb_errno_t jb_io_buf_write(jb_io_buf_t *buf, const uint8_t *data, size_t len);
+jb_errno_t jb_io_buf_push(jb_io_buf_t *buf, uint8_t c);
+jb_errno_t jb_io_buf_printf(jb_io_buf_t *buf, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
 jb_errno_t jb_io_buf_flush(jb_io_buf_t *buf, FILE *f);
+// write the contents to `fd`, retrying short writes
+jb_errno_t jb_io_buf_flush_fd(jb_io_buf_t *buf, int fd);
+// write several buffers to `fd` with as few syscalls as possible
+jb_errno_t jb_io_buf_writev(int fd, jb_io_buf_t *bufs, size_t n);
+
 void jb_io_buf_clear(jb_io_buf_t *buf);
 void jb_io_buf_free(jb_io_buf_t *buf);
 
@@ -201,8 +280,67 @@ jb_errno_t jb_fstat(const char *path, struct stat *buf);
 jb_errno_t jb_load_file(const char *path, uint8_t **data, size_t *len);
 jb_errno_t jb_store_file(const char *path, uint8_t *data, size_t len);
 
+// read-only contents of a file; mapped for regular files, otherwise read into a heap copy
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    bool mapped;
+} jb_map_t;
+
+jb_errno_t jb_map_file(const char *path, jb_map_t *map);
+void jb_unmap_file(jb_map_t *map);
+
+// replace `path` via a temporary file that is synced and renamed over it, so readers see either
+// the old or the new contents, never a torn file. symlinks are followed, and the owner and mode
+// kept; a file with other hard links is rewritten in place instead, which isn't atomic
+jb_errno_t jb_store_file_atomic(const char *path, const uint8_t *data, size_t len);
+// prefix of the temporaries `jb_store_file_atomic` leaves behind if interrupted, for directory
+// walks to skip
+#define JB_TMP_PREFIX ".jb-tmp."
+
+// append the next line of `f` to `buf`, without its newline; reuse `buf` across lines
 jb_errno_t jb_read_line(FILE *f, jb_io_buf_t *buf);
 
+// non-owning view of a run of bytes
+typedef struct {
+    const char *ptr;
+    size_t len;
+} jb_view_t;
+
+// buffered reader over a file descriptor, FILE* or memory; returns lines as views into its buffer
+typedef struct {
+    enum {
+        JB_READER_NONE,
+        JB_READER_FD,
+        JB_READER_FILE,
+        JB_READER_MEM
+    } kind;
+
+    int fd;
+    FILE *f;
+
+    uint8_t *buf;        // owned buffer (cap + 1 bytes, for a NUL after the last line)
+    size_t cap;
+
+    const uint8_t *data; // bytes being read (`buf`, or the memory source)
+    size_t start, end;   // unconsumed bytes are data[start..end)
+    size_t total;        // bytes pulled from the source so far
+    bool eof;
+} jb_reader_t;
+
+// allocate a reader's buffer; it is detached until given a source
+jb_errno_t jb_reader_init(jb_reader_t *rd, size_t cap);
+void jb_reader_free(jb_reader_t *rd);
+
+// (re)attach a source, discarding any unread data but keeping the buffer
+void jb_reader_fd(jb_reader_t *rd, int fd);
+void jb_reader_file(jb_reader_t *rd, FILE *f);
+void jb_reader_mem(jb_reader_t *rd, const void *data, size_t len);
+
+// read the next line, without its newline; `*got` is false at end of input. the view is valid
+// until the next call, and is NUL-terminated in place for fd/FILE sources
+jb_errno_t jb_reader_line(jb_reader_t *rd, jb_view_t *line, bool *got);
+
 jb_errno_t jb_basename(const char *path, char *out, size_t size);
 jb_errno_t jb_dirname(const char *path, char *out, size_t size);
 
@@ -212,12 +350,149 @@ jb_errno_t jb_mkdir_rec(const char *path);
 
 #define JB_TRY_IO(res, ...) {int result = (res); if ((result) != 0) return JB_ERR_LIBC(result, __VA_ARGS__);}
 
+//
+// batched file reads: batch.c
+//
+
+// one file in a batch; `data` holds (at most) the first `size` bytes of the file, NUL-terminated
+typedef struct {
+    char *path;
+    void *user;
+
+    uint8_t *data;
+    size_t len;
+    jb_errno_t err;   // errno from opening or reading the file
+} jb_batch_item_t;
+
+typedef struct jb_uring jb_uring_t;
+
+// reads the heads of many files at once; with io_uring, every open, read and close of a batch is
+// in flight together, otherwise each file is read in turn
+typedef struct {
+    size_t depth, size;
+    size_t len;
+
+    jb_batch_item_t *items;
+    char *paths;         // `depth` PATH_MAX buffers
+    uint8_t *bufs;       // `depth` buffers of `size + 1` bytes
+    bool *retry;         // per item, whether a failure in the ring is retried synchronously
+
+    jb_uring_t *ring;    // NULL when reading synchronously
+} jb_batch_t;
+
+#define JB_BATCH_SYNC 1  // never use io_uring
+
+jb_errno_t jb_batch_init(jb_batch_t *b, size_t depth, size_t size, int flags);
+void jb_batch_free(jb_batch_t *b);
+
+// queue a file to be read; returns NULL if the batch is full and must be run first
+jb_batch_item_t *jb_batch_add(jb_batch_t *b, const char *path);
+// read every queued file; per-file failures are reported in each item's `err`
+jb_errno_t jb_batch_run(jb_batch_t *b);
+// forget the queued files, once their items have been consumed
+void jb_batch_clear(jb_batch_t *b);
+
+//
+// span tracing: trace.c
+//
+
+// spans are recorded per thread and written out as Chrome trace-event JSON, which Perfetto and
+// chrome://tracing can open. recording is off until `jb_span_init`, and costs a single branch
+// while off
+
+extern bool jb_span_enabled;
+
+// start recording spans, to be written to `path` by `jb_span_dump`
+void jb_span_init(const char *path);
+// `name` must outlive the trace (a string literal); `detail` (may be NULL) is copied
+void jb_span_begin_(const char *name, const char *detail);
+void jb_span_end_();
+// write every thread's spans to the file given to `jb_span_init`
+jb_errno_t jb_span_dump();
+
+#define jb_span_begin(name, detail) (jb_span_enabled ? jb_span_begin_((name), (detail)) : (void)0)
+#define jb_span_end() (jb_span_enabled ? jb_span_end_() : (void)0)
+
+//
+// utilities: util.c
+//
+
+
+// bump allocator; everything allocated from it is released at once
+typedef struct jb_arena_block {
+    struct jb_arena_block *next;
+    size_t used, cap;
+    _Alignas(16) uint8_t data[];
+} jb_arena_block_t;
+
+typedef struct {
+    jb_arena_block_t *head;
+    size_t block_size;   // minimum size of each block
+} jb_arena_t;
+
+void jb_arena_init(jb_arena_t *a, size_t block_size);
+void *jb_arena_alloc(jb_arena_t *a, size_t size);
+// resize `ptr` in place if it is the latest allocation and there's room, otherwise copy it
+void *jb_arena_realloc(jb_arena_t *a, void *ptr, size_t old_size, size_t new_size);
+// release everything allocated so far, keeping one block to allocate from again
+void jb_arena_reset(jb_arena_t *a);
+void jb_arena_free(jb_arena_t *a);
+
+typedef struct {
+	size_t len;
+	size_t cap;
+	jb_arena_t *arena;  // NULL for heap storage
+	_Alignas(16) char buf[];
+} jb_buf_hdr_t;
+
+#define JB_BUF NULL
+
+// Get a pointer to the header of a buffer
+#define jb_buf_hdr(b) ((jb_buf_hdr_t *)((char *)(b) - offsetof(jb_buf_hdr_t, buf)))
+
+// Length, capacity and end index of a buffer
+#define jb_buf_len(b) ((b) ? jb_buf_hdr(b)->len : 0)
+#define jb_buf_cap(b) ((b) ? jb_buf_hdr(b)->cap : 0)
+#define jb_buf_end(b) ((b) + jb_buf_len(b))
+
+#define jb_buf_last(b) (jb_buf_len(b) != 0 ? &(b)[jb_buf_len(b) - 1] : NULL)
+
+// arena-backed buffers are released with their arena
+#define jb_buf_free(b) \
+    ((b) ? ((jb_buf_hdr(b)->arena ? 0 : (free(jb_buf_hdr(b)), 0)), (b) = NULL) : 0)
+#define jb_buf_fit(b, n) ((n) <= jb_buf_cap(b) ? 0 : ((b) = jb_buf_grow((b), (n), sizeof(*(b)))))
+
+#define jb_buf_push(b, v) (jb_buf_fit((b), 1 + jb_buf_len(b)), (b)[jb_buf_hdr(b)->len++] = ((v)))
+#define jb_buf_pop(b, v) (jb_buf_len((b)) != 0 ? (v = (b)[--jb_buf_hdr(b)->len], true) : false)
+
+// append `n` elements from `src` with a single copy
+#define jb_buf_append(b, src, n) ((b) = jb_buf_append_((b), (src), (n), sizeof(*(b))))
+// make room for exactly `n` more elements, without the usual doubling
+#define jb_buf_reserve(b, n) \
+    (jb_buf_len(b) + (n) <= jb_buf_cap(b) ? 0 \
+        : ((b) = jb_buf_resize((b), jb_buf_len(b) + (n), sizeof(*(b)))))
+// drop elements past the first `n`
+#define jb_buf_truncate(b, n) \
+    ((b) && jb_buf_hdr(b)->len > (n) ? (jb_buf_hdr(b)->len = (n)) : 0)
+// release unused capacity (an empty heap buffer becomes JB_BUF)
+#define jb_buf_shrink(b) ((b) = jb_buf_resize((b), jb_buf_len(b), sizeof(*(b))))
+// start an empty buffer, with room for `cap` elements, whose storage comes from `arena`
+#define jb_buf_in(b, arena, cap) ((b) = jb_buf_new_in((arena), (cap), sizeof(*(b))))
+
+void *jb_buf_grow(const void *buf, size_t new_len, size_t elem_size);
+void *jb_buf_resize(const void *buf, size_t new_cap, size_t elem_size);
+void *jb_buf_append_(void *buf, const void *src, size_t n, size_t elem_size);
+void *jb_buf_new_in(jb_arena_t *arena, size_t cap, size_t elem_size);
+
+// monotonic clock, in nanoseconds
+uint64_t jb_now();
+
 //
 // virtual machine: vm.c
 //
 
 typedef struct jb_cmd {
-    struct jb_val *body; 
+    struct jb_val *body; // buffer of values
     size_t start, end;
 } jb_cmd_t;
 
@@ -234,54 +509,185 @@ typedef struct jb_val {
     size_t start, end; // span in source file
 
     union {
-        char *str_val;
+        jb_view_t str_val; // slice of the source, or of the arena if the literal had escapes
         int64_t int_val;
-        jb_cmd_t *body;
+        jb_cmd_t *body;    // buffer of commands
     };
 } jb_val_t;
 
-jb_res_t jb_parse(char *src, jb_val_t *val);
+// parse `src` into a tree allocated from `arena`, which frees it in one `jb_arena_free`. strings
+// may point into `src`, so it must outlive the tree
+jb_res_t jb_parse(jb_arena_t *arena, const char *src, jb_val_t *val);
+
+// receives each top-level command as soon as its closing ';' (or the end of the script) is seen.
+// the command is only valid during the call; everything it refers to is in the parser's arena,
+// which the callback may reset
+typedef jb_res_t (*jb_parse_cb_t)(void *state, jb_cmd_t *cmd);
+
+// push parser, fed a script a chunk at a time. spans are offsets from the start of the stream.
+// values and commands collect on scratch stacks while their enclosing command or delimiter is open,
+// and are copied into the arena, exactly sized, once it closes; only the unfinished token at the
+// end of a chunk is kept, so memory is bounded by the largest top-level command rather than the
+// whole script
+typedef struct {
+    jb_arena_t *arena;
+    const char *src;    // text being scanned
+    size_t base;        // stream offset of `src`
+    bool push;          // strings are copied into the arena, as `src` doesn't outlive a chunk
+    bool final;         // no more input will follow `src`
+    bool more;          // the token at the end of `src` needs more input
+    bool in_comment;    // a comment runs past the end of the last chunk
+
+    struct jb_parse_frame *frames;
+    jb_cmd_t *cmds;     // the last command of each open frame is still being built
+    jb_val_t *vals;
+    char *str;          // unescaped contents of a string literal
+    char *pending;      // unconsumed input
+
+    jb_parse_cb_t cb;
+    void *state;
+} jb_parser_t;
+
+void jb_parser_init(jb_parser_t *p, jb_arena_t *arena, jb_parse_cb_t cb, void *state);
+// parse the next `len` bytes of the script. after an error the parser can only be freed
+jb_res_t jb_parser_feed(jb_parser_t *p, const char *chunk, size_t len);
+// end the script, emitting its last command
+jb_res_t jb_parser_finish(jb_parser_t *p);
+void jb_parser_free(jb_parser_t *p);
 void jb_write_val(FILE *f, jb_val_t *val, size_t indent);
 
-//
-// utilities: util.c
-//
+// bytecode: each instruction is one word, with the opcode in the low 8 bits and its operand in the
+// rest. JB_OP_CALL is followed by a second word, the symbol naming the command
+typedef enum {
+    JB_OP_NIL,   // push nil
+    JB_OP_INT,   // push integer constant `arg`
+    JB_OP_STR,   // push the text of symbol `arg`
+    JB_OP_BLOCK, // push block `arg`
+    JB_OP_LOAD,  // push variable `arg`
+    JB_OP_STORE, // set variable `arg` to the top of the stack, leaving it there
+    JB_OP_POP,   // drop the top of the stack
+    JB_OP_CALL,  // call a command with `arg` arguments; with none, a name that isn't a registered
+                 // command runs the block in the variable of the same name
+    JB_OP_CALLV, // call the command (or run the block) below `arg` arguments on the stack; with
+                 // no arguments, an integer or nil is left as it is
+    JB_OP_RET,   // return the top of the stack from the block
+    JB_OP_MAX
+} jb_op_t;
+
+#define JB_OP_ARG_MAX ((1u << 24) - 1)
+
+typedef struct {
+    enum {
+        JB_VM_NIL,
+        JB_VM_INT,
+        JB_VM_STR,
+        JB_VM_BLOCK
+    } kind;
 
+    union {
+        int64_t int_val;
+        jb_view_t str_val;
+        uint32_t block;
+    };
+} jb_vm_val_t;
 
+// a symbol's text, as an offset into the program's string pool
 typedef struct {
-	size_t len;
-	size_t cap;
-	char buf[];
-} jb_buf_hdr_t;
+    uint32_t off, len;
+} jb_sym_t;
 
-#define JB_BUF NULL
+typedef struct {
+    uint32_t start; // offset of the block's first instruction
+    uint32_t depth; // most values it holds on the stack at once
+} jb_block_t;
 
-// Get a pointer to the header of a buffer
-#define jb_buf_hdr(b) ((jb_buf_hdr_t *)((char *)(b) - offsetof(jb_buf_hdr_t, buf)))
+typedef struct jb_vm jb_vm_t;
 
-// Length, capacity and end index of a buffer
-#define jb_buf_len(b) ((b) ? jb_buf_hdr(b)->len : 0)
-#define jb_buf_cap(b) ((b) ? jb_buf_hdr(b)->cap : 0)
-#define jb_buf_end(b) ((b) + jb_buf_len(b))
+// `args` stay valid until the command returns
+typedef jb_res_t (*jb_native_t)(jb_vm_t *vm, jb_vm_val_t *args, size_t argc, jb_vm_val_t *out);
 
-#define jb_buf_last(b) (jb_buf_len(b) != 0 ? &b[jb_buf_len(b) - 1] : NULL)
+// compiled script; block 0 is the top level. symbols name both commands and variables
+typedef struct {
+    uint32_t *code;     // jb_buf
+    int64_t *ints;      // jb_buf, integer constants
+    jb_sym_t *syms;     // jb_buf
+    jb_block_t *blocks; // jb_buf
+    char *strs;         // jb_buf, NUL-terminated symbol text
 
-#define jb_buf_free(b) ((b) ? (free(jb_buf_hdr(b)), (b) = NULL) : 0)
-#define jb_buf_fit(b, n) ((n) <= jb_buf_cap(b) ? 0 : ((b) = jb_buf_grow((b), (n), sizeof(*(b)))))
+    // filled in by `jb_vm_link`, indexed by symbol
+    jb_native_t *cmds;
+    jb_vm_val_t *slots;
+} jb_prog_t;
 
-#define jb_buf_push(b, v) (jb_buf_fit((b), 1 + jb_buf_len(b)), (b)[jb_buf_hdr(b)->len++] = ((v)))
-#define jb_buf_pop(b, v) (jb_buf_len((b)) != 0 ? (v = (b)[--jb_buf_hdr(b)->len], true) : false)
+typedef struct {
+    const char *name;
+    jb_native_t fn;
+} jb_vm_cmd_t;
+
+#define JB_VM_STACK 4096
+// deepest blocks may call each other, so a block calling itself fails rather than overflowing the
+// C stack
+#define JB_VM_DEPTH 1024
+
+struct jb_vm {
+    jb_vm_cmd_t *cmds;  // jb_buf, registered commands
+    jb_vm_val_t *stack; // fixed, so command arguments never move
+    size_t sp;
+    size_t depth;       // blocks being run
+    jb_prog_t *prog;    // program being run
+    void *user;         // for use by commands
+};
 
-void *jb_buf_grow(const void *buf, size_t new_len, size_t elem_size);
+// compile a tree from `jb_parse`; the program doesn't refer to the tree or its source
+jb_res_t jb_compile(const jb_val_t *tree, jb_prog_t *prog);
+void jb_prog_free(jb_prog_t *prog);
+// append a program, in host byte order, to `buf`
+jb_errno_t jb_prog_save(const jb_prog_t *prog, jb_io_buf_t *buf);
+// load a program saved with `jb_prog_save`, checking that its code is safe to run; `*used` is set
+// to the number of bytes it took up
+jb_res_t jb_prog_load(jb_prog_t *prog, const uint8_t *data, size_t len, size_t *used);
+// text of symbol `sym`
+#define jb_prog_sym(prog, sym) ((prog)->strs + (prog)->syms[(sym)].off)
+
+// set up a VM with the core commands (if, while, do, and, or, not, eq, lt, add, sub, mul)
+void jb_vm_init(jb_vm_t *vm);
+void jb_vm_free(jb_vm_t *vm);
+// `name` must outlive the VM; registering a name again replaces its command
+void jb_vm_register(jb_vm_t *vm, const char *name, jb_native_t fn);
+// bind a program's commands to those registered, and give it fresh variables (all nil)
+void jb_vm_link(jb_vm_t *vm, jb_prog_t *prog);
+jb_res_t jb_vm_run(jb_vm_t *vm, jb_prog_t *prog, jb_vm_val_t *out);
+// run one of a program's blocks, e.g. one saved by an earlier run
+jb_res_t jb_vm_run_block(jb_vm_t *vm, jb_prog_t *prog, uint32_t block, jb_vm_val_t *out);
+// from within a command: run a block of the current program, or pass any other value through
+jb_res_t jb_vm_eval(jb_vm_t *vm, jb_vm_val_t val, jb_vm_val_t *out);
+bool jb_vm_truthy(jb_vm_val_t val);
+
+//
+// saved syntax trees: tree.c
+//
+
+// append a tree from `jb_parse` to `buf`, in a compact form that loads without lexing or parsing
+jb_errno_t jb_tree_save(const jb_val_t *tree, jb_io_buf_t *buf);
+// load a tree saved with `jb_tree_save`, allocating from `arena`. strings point into `data` (e.g. a
+// mapped file), so it must outlive the tree. `*used` is set to the number of bytes it took up
+jb_res_t jb_tree_load(jb_arena_t *arena, const uint8_t *data, size_t len, jb_val_t *tree,
+                      size_t *used);
 
 // 
 // audio client 
 //
 
-#ifdef JBASE_AUDIO 
-
-// individual audio sample
+// individual audio sample, and JACK's frame count and time types
+#ifdef JBASE_AUDIO
 typedef jack_default_audio_sample_t jb_sample_t;
+typedef jack_nframes_t jb_nframes_t;
+typedef jack_time_t jb_time_t;
+#else
+typedef float jb_sample_t;
+typedef uint32_t jb_nframes_t;
+typedef uint64_t jb_time_t;
+#endif
 
 // constants to access MIDI event params 
 enum {
@@ -309,9 +715,9 @@ typedef struct {
     size_t srate;              // sample rate
     size_t cur_sample;         // current base sample (samples processed up to start of current cycle)
 
-    jack_nframes_t cur_frames; // precise time at start of current cycle (?)
-    jack_time_t time;          // absolute time in usecs 
-    jack_time_t next_usecs;    // best estimate of time of next sample 
+    jb_nframes_t cur_frames;   // precise time at start of current cycle (?)
+    jb_time_t time;            // absolute time in usecs 
+    jb_time_t next_usecs;      // best estimate of time of next sample 
     float period_usecs;        // roughly difference between next_usecs and time (?)
 } jb_ctx_t;
 
@@ -320,14 +726,23 @@ typedef void (*jb_midi_fn_t)(void *state, jb_midi_t ev);
 // audio buffer generating callback
 typedef void (*jb_audio_fn_t)(void *state, jb_ctx_t ctx, size_t nframes, jb_sample_t *buf);
 
+// parameter change callback
+typedef void (*jb_param_fn_t)(void *state, uint32_t param, float value);
+
+// callbacks are shared by the JACK client and the offline renderer (offline.c)
 typedef struct {
     char *name;             // name of JACK client
     void *state;            // pointer to user-supplied state (accessible in callbacks)
 
     jb_midi_fn_t midi_cb;   // callback to process MIDI events
     jb_audio_fn_t audio_cb; // callback to generate audio
+    jb_param_fn_t param_cb; // callback to apply parameter changes
+
+    struct jb_events *events; // queue drained at the start of each cycle, or NULL
 } jb_client_config_t;
 
+#ifdef JBASE_AUDIO 
+
 typedef struct {
     jb_client_config_t cfg; // client configuration
     
@@ -347,6 +762,115 @@ jb_res_t jb_client_start(jb_client_t *cl);                        // activate JA
 
 #endif
 
+//
+// event queues: events.c
+//
+
+typedef struct {
+    enum {
+        JB_EVENT_MIDI,  // a MIDI event, for `midi_cb`
+        JB_EVENT_PARAM, // a parameter change, for `param_cb`
+    } kind;
+
+    union {
+        jb_midi_t midi;
+
+        struct {
+            uint32_t id;
+            float value;
+        } param;
+    };
+} jb_event_t;
+
+// wait-free single-producer, single-consumer ring of events, for getting notes and parameter
+// changes from another thread (a UI, a script) into the audio thread
+typedef struct jb_events {
+    jb_event_t *slots;
+    size_t mask;                     // capacity - 1
+
+    _Alignas(64) atomic_size_t head; // next slot to write; only the producer writes this
+    _Alignas(64) atomic_size_t tail; // next slot to read; only the consumer writes this
+} jb_events_t;
+
+// allocate a queue holding at least `cap` events
+jb_res_t jb_events_init(jb_events_t *q, size_t cap);
+// producer: queue an event, or return false if the queue is full
+bool jb_events_push(jb_events_t *q, jb_event_t ev);
+bool jb_events_midi(jb_events_t *q, jb_midi_t ev);
+bool jb_events_param(jb_events_t *q, uint32_t id, float value);
+// consumer: take the oldest event, if any
+bool jb_events_pop(jb_events_t *q, jb_event_t *ev);
+// consumer: hand every queued event to a client's callbacks
+void jb_events_drain(jb_events_t *q, const jb_client_config_t *cfg);
+void jb_events_free(jb_events_t *q);
+
+typedef struct {
+    float *dst;   // value being smoothed, read by the audio thread
+    float target;
+    float from;   // value at the start of the last block ticked
+    float step;   // change per frame
+    size_t left;  // frames until `target` is reached
+    float smooth; // seconds a change is spread over
+} jb_param_t;
+
+// values updated by the audio thread, each change ramped over a short time rather than applied
+// at once, which would click (or "zip", as a control is swept). ramps advance a block at a time,
+// so `*dst` steps once per block: that's smooth enough for an oscillator's amplitude, which
+// rendering ramps across the block itself, but anything else read straight from `*dst` (pitch, a
+// modulation depth) steps audibly, and should take per-frame values from `jb_params_fill`
+typedef struct {
+    jb_param_t *params; // jb_buf
+} jb_params_t;
+
+void jb_params_init(jb_params_t *ps);
+// register a parameter driving `*dst`; do so before the audio thread starts, as it allocates
+uint32_t jb_params_add(jb_params_t *ps, float *dst, float smooth);
+// start a ramp to `value` (ignored if `id` isn't a parameter)
+void jb_params_set(jb_params_t *ps, uint32_t id, float value, size_t srate);
+// advance the ramps over `nframes`
+void jb_params_tick(jb_params_t *ps, size_t nframes);
+// write the value of parameter `id` at each of the `nframes` just ticked, ramping from where the
+// block started to `*dst` (nothing, if `id` isn't a parameter)
+void jb_params_fill(const jb_params_t *ps, uint32_t id, size_t nframes, float *out);
+void jb_params_free(jb_params_t *ps);
+
+//
+// offline rendering: offline.c
+//
+// drives a client's callbacks without JACK, as fast as they'll go: MIDI events are handed to
+// `midi_cb` at the start of the block they fall in (as JACK does), then `audio_cb` renders the
+// block, and the output can be written to a WAV file
+//
+
+typedef struct {
+    size_t frame; // when the event happens
+    jb_midi_t ev;
+} jb_midi_event_t;
+
+typedef struct {
+    size_t srate;                  // sample rate
+    size_t block;                  // frames per `audio_cb` call
+    size_t nframes;                // frames to render; 0 renders the events plus `tail`
+    size_t tail;                   // frames rendered after the last event, when `nframes` is 0
+
+    const jb_midi_event_t *events; // in order of `frame`
+    size_t nevents;
+
+    const char *wav;               // mono 32-bit float WAV to write, or NULL
+} jb_offline_t;
+
+typedef struct {
+    size_t frames;    // frames rendered
+    uint64_t wall_ns; // time spent in the callbacks and writing output
+    double speed;     // seconds rendered per second of wall time
+} jb_offline_stats_t;
+
+jb_res_t jb_offline_render(jb_client_config_t cfg, const jb_offline_t *opts,
+                           jb_offline_stats_t *stats);
+// read a standard MIDI file (format 0 or 1) as events at `srate`, following its tempo changes.
+// `*events` is a jb_buf
+jb_res_t jb_midi_file_load(const char *path, size_t srate, jb_midi_event_t **events);
+
 // 
 // audio synthesis: synth.c
 //
@@ -362,11 +886,18 @@ typedef enum {
     JB_MOD_MAX
 } jb_mod_t;
 
+// how rendering reads between the points of a wavetable
+typedef enum {
+    JB_INTERP_LINEAR,
+    JB_INTERP_CUBIC,
+} jb_interp_t;
+
 typedef struct {
-    jb_wave_fn_t fn;   // wave function
-    jb_cents_t detune; // detune (in cents)
-    float amp;         // wave amplitude
-    float bias;        // amount of folding, or pulse width
+    jb_wave_fn_t fn;    // wave function
+    jb_cents_t detune;  // detune (in cents)
+    float amp;          // wave amplitude
+    float bias;         // amount of folding, or pulse width
+    jb_interp_t interp; // wavetable interpolation, for the built-in shapes
 } jb_osc_t;
 
 typedef struct jb_osc_link {
@@ -375,6 +906,13 @@ typedef struct jb_osc_link {
     struct jb_osc_link *next; // next in chain
 } jb_osc_link_t;
 
+// an oscillator's position in its cycle, carried from one rendered block to the next (one per
+// voice)
+typedef struct {
+    float phase; // 0 <= phase < 1
+    float amp;   // amplitude the last block ended at, ramped from in the next (from 0 at first)
+} jb_osc_state_t;
+
 // macro to convert semitones to cents
 #define JB_SEMIS(semi) ((semi) * 100)
 
@@ -387,12 +925,164 @@ float jb_cents_hz(jb_cents_t cents);
 float jb_osc_sample(jb_osc_t *osc, jb_cents_t note, size_t idx, size_t srate);         // sample an oscillator at a given note in cents
 float jb_chain_sample(jb_osc_link_t *link, jb_cents_t note, size_t idx, size_t srate); // sample a chain of oscillators modulating eachother
 
+// build the wavetables behind the built-in shapes; rendering does so on first use, so call this
+// before rendering from a real-time thread
+void jb_synth_init();
+// render `nframes` samples of an oscillator at `note` into `out`, continuing from `state`. the
+// frequency is worked out once per block. the built-in shapes (other than noise, and a folded
+// triangle) are read from band-limited wavetables rather than sampled from their functions
+void jb_osc_render(jb_osc_t *osc, jb_osc_state_t *state, jb_cents_t note, size_t srate,
+                   size_t nframes, float *out);
+
+// frames rendered at a time by patches (and the size of each of their scratch buffers)
+#define JB_SYNTH_BLOCK 256
+
+// one oscillator modulating another
+typedef struct {
+    uint32_t from, to; // nodes
+    jb_mod_t mod;
+} jb_patch_edge_t;
+
+// step of a compiled patch, over scratch buffers of JB_SYNTH_BLOCK frames
+typedef struct {
+    enum {
+        JB_PATCH_COPY,   // buffer `dst` = buffer `src`
+        JB_PATCH_ADD,    // buffer `dst` += buffer `src`
+        JB_PATCH_MUL,    // buffer `dst` *= buffer `src`
+        JB_PATCH_RENDER, // render oscillator `node` into buffer `dst`
+    } kind;
+
+    uint32_t dst, src, node;
+    int32_t in[JB_MOD_MAX]; // JB_PATCH_RENDER: buffer of each kind of modulation, or -1
+} jb_patch_op_t;
+
+// a graph of oscillators modulating each other, compiled to a flat list of block operations so
+// rendering neither recurses nor chases links. amplitude modulators multiply; frequency (scaling
+// the frequency by 1 + the modulator), phase (in radians) and bias modulators add
+typedef struct {
+    jb_osc_t **nodes;       // jb_buf
+    jb_patch_edge_t *edges; // jb_buf
+    uint32_t out;           // node heard as the patch's output
+
+    // filled in by `jb_patch_compile`
+    jb_patch_op_t *ops;     // jb_buf, in evaluation order
+    uint32_t out_buf;       // scratch buffer holding the output
+    size_t nbufs;           // scratch buffers needed
+} jb_patch_t;
+
+void jb_patch_init(jb_patch_t *patch);
+uint32_t jb_patch_add(jb_patch_t *patch, jb_osc_t *osc);                      // add a node
+void jb_patch_connect(jb_patch_t *patch, uint32_t from, uint32_t to, jb_mod_t mod); // modulate `to` by `from`
+// order the nodes feeding `out`, failing on cycles; call again after changing the graph
+jb_res_t jb_patch_compile(jb_patch_t *patch);
+// compile a chain as `jb_chain_sample` plays it, with the first link as the output
+jb_res_t jb_patch_from_chain(jb_patch_t *patch, jb_osc_link_t *chain);
+void jb_patch_free(jb_patch_t *patch);
+
+// floats of scratch space `jb_patch_render` needs
+#define jb_patch_scratch(patch) ((patch)->nbufs * JB_SYNTH_BLOCK)
+// render `nframes` of a patch at `note`; `states` holds one state per node (per voice)
+void jb_patch_render(const jb_patch_t *patch, jb_osc_state_t *states, jb_cents_t note,
+                     size_t srate, size_t nframes, float *scratch, float *out);
+
 float jb_wave_sin(float x, float bias);
 float jb_wave_square(float x, float bias);
 float jb_wave_triangle(float x, float bias);
 float jb_wave_saw(float x, float bias);
 float jb_wave_noise(float x, float bias);
 
+//
+// polyphony: voice.c
+//
+
+// ADSR envelope; times in seconds
+typedef struct {
+    float attack, decay;
+    float sustain; // level held while the note is down
+    float release;
+} jb_env_t;
+
+typedef struct {
+    enum {
+        JB_ENV_IDLE,
+        JB_ENV_ATTACK,
+        JB_ENV_DECAY,
+        JB_ENV_SUSTAIN,
+        JB_ENV_RELEASE,
+    } stage;
+
+    float level; // current gain
+    float step;  // change in gain per frame
+    size_t left; // frames until the next stage
+} jb_env_state_t;
+
+typedef struct {
+    uint8_t key;          // MIDI note
+    float velocity;       // 0-1
+    uint64_t started;     // note-on order, for stealing the oldest
+    jb_env_state_t env;
+    jb_osc_state_t *osc;  // one per patch node
+} jb_voice_t;
+
+// which voice a note takes when they're all playing
+typedef enum {
+    JB_STEAL_OLDEST,
+    JB_STEAL_QUIETEST,
+} jb_steal_t;
+
+// a fixed pool of voices playing a compiled patch. everything is allocated by `jb_voices_init`,
+// so notes and rendering neither allocate nor lock, and can run in the JACK process callback
+typedef struct {
+    const jb_patch_t *patch;
+    jb_env_t env;         // shared by every voice; takes effect from each voice's next stage
+    jb_steal_t steal;
+    size_t srate;
+
+    jb_voice_t *voices;
+    size_t nvoices;
+    jb_osc_state_t *states; // backing `voices[i].osc`
+    float *scratch;         // for `jb_patch_render`
+    uint64_t clock;         // note-ons so far
+
+    struct jb_voice_workers *workers; // set by `jb_voices_spawn`
+    jb_params_t params;               // smoothed over each call to `jb_voices_render`
+} jb_voices_t;
+
+// fewest sounding voices worth spreading across workers
+#define JB_VOICES_PARALLEL_MIN 8
+// share of a cycle's length the caller waits on workers before dropping their mix for the cycle
+#define JB_VOICES_DEADLINE 0.5
+
+// allocate `nvoices` voices of `patch`, which must stay compiled and alive while they're in use
+jb_res_t jb_voices_init(jb_voices_t *vs, const jb_patch_t *patch, size_t nvoices, size_t srate);
+// start a note, retriggering the voice already playing `key` or taking a free (or stolen) one;
+// a velocity of 0 is a note off
+void jb_voices_note_on(jb_voices_t *vs, uint8_t key, uint8_t velocity);
+void jb_voices_note_off(jb_voices_t *vs, uint8_t key); // release `key`
+// render `nframes` of every sounding voice, mixed, into `out`
+void jb_voices_render(jb_voices_t *vs, size_t nframes, float *out);
+size_t jb_voices_active(const jb_voices_t *vs); // voices sounding (including releasing)
+void jb_voices_free(jb_voices_t *vs);           // also stops any workers
+
+// split rendering between the calling thread and `nthreads` workers, pinned to their own cores
+// and run at the rendering thread's priority where allowed. each cycle renders up to
+// `max_frames` (e.g. the JACK buffer size) at once. the caller renders any of a worker's voices
+// it hasn't started on by the time it finishes its own, and waits on the rest only until
+// JB_VOICES_DEADLINE, so a late worker costs a block of its voices rather than an xrun
+jb_res_t jb_voices_spawn(jb_voices_t *vs, size_t nthreads, size_t max_frames);
+// parallel cycles rendered, workers' voices the calling thread ended up rendering itself, and
+// worker mixes dropped for missing the deadline
+void jb_voices_stats(const jb_voices_t *vs, size_t *cycles, size_t *inline_voices, size_t *late);
+
+// smooth changes to `*dst` (e.g. an oscillator's `amp`, or `vs->env.sustain`) made through
+// `jb_voices_param`; returns the parameter's ID
+uint32_t jb_voices_add_param(jb_voices_t *vs, float *dst, float smooth);
+
+// client callbacks driving a pool, with it as the client's `state`
+void jb_voices_midi(void *state, jb_midi_t ev);
+void jb_voices_audio(void *state, jb_ctx_t ctx, size_t nframes, jb_sample_t *buf);
+void jb_voices_param(void *state, uint32_t id, float value);
+
 // terminal control
 //
 
@@ -49,6 +49,9 @@ static int jack_process(jack_nframes_t nframes, void *arg) {
     void *midi_buf = jack_port_get_buffer(cl->midi_in, nframes);
     jb_sample_t *audio_buf = (jb_sample_t *)jack_port_get_buffer(cl->audio_out, nframes);
 
+    // events queued by other threads come first
+    if (cl->cfg.events) jb_events_drain(cl->cfg.events, &cl->cfg);
+
     jb_midi_t ev;
     jack_midi_event_t raw_ev;
     size_t ev_count = jack_midi_get_event_count(midi_buf);
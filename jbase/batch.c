@@ -0,0 +1,423 @@
+/*
+ * jbase - C utility library
+ * Copyright (C) 2024  Jacob Sinclair <jcbsnclr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//
+// batch.c: batched reads of file heads
+//
+// with io_uring, each file becomes a hard-linked openat -> read -> close chain on a direct (ring
+// registered) descriptor, and a whole batch is submitted with one syscall, so the device sees the
+// batch's reads together rather than one round trip at a time. the ring is driven with raw
+// syscalls; if it can't be set up, or the kernel can't be trusted with direct descriptors, files
+// are read synchronously instead, as is any file the ring fails on
+//
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <jbase.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef JBASE_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef JBASE_URING
+
+struct jb_uring {
+    int fd;
+
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+};
+
+// operations in each file's chain; user_data is `index * OPS + op`
+enum { OP_OPEN, OP_READ, OP_CLOSE, OPS };
+
+static void uring_free(jb_uring_t *r) {
+    if (r->sqes) munmap(r->sqes, r->sqes_size);
+    if (r->cq_ptr && r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_size);
+    if (r->sq_ptr) munmap(r->sq_ptr, r->sq_size);
+
+    close(r->fd);
+    free(r);
+}
+
+// kernels before 5.15 accept openat and close with a `file_index` but ignore it: the open hands
+// back an ordinary fd, and the close closes fd 0. there's no feature flag for direct descriptors,
+// so require the first one added after them (5.17), and check the probe for the ops themselves
+static bool uring_supported(int fd, const struct io_uring_params *p) {
+    if (!(p->features & IORING_FEAT_CQE_SKIP)) return false;
+
+    size_t len = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    if (!probe) return false;
+
+    bool ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) != -1;
+
+    static const uint8_t ops[] = {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE};
+    for (size_t i = 0; i < sizeof(ops) && ok; i++)
+        ok = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+
+    free(probe);
+    return ok;
+}
+
+static jb_uring_t *uring_init(size_t depth) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    unsigned entries = 1;
+    while (entries < depth * OPS) entries <<= 1;
+
+    int fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd == -1) return NULL;
+
+    if (!uring_supported(fd, &p)) {
+        close(fd);
+        return NULL;
+    }
+
+    jb_uring_t *r = calloc(1, sizeof(jb_uring_t));
+    if (!r) {
+        close(fd);
+        return NULL;
+    }
+
+    r->fd = fd;
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) r->sq_size = r->cq_size = JB_MAX(r->sq_size, r->cq_size);
+
+    r->sq_ptr = mmap(NULL,
+                     r->sq_size,
+                     PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE,
+                     fd,
+                     IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) {
+        r->sq_ptr = NULL;
+        goto fail;
+    }
+
+    if (single) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL,
+                         r->cq_size,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE,
+                         fd,
+                         IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED) {
+            r->cq_ptr = NULL;
+            goto fail;
+        }
+    }
+
+    r->sqes = mmap(NULL,
+                   r->sqes_size,
+                   PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE,
+                   fd,
+                   IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        goto fail;
+    }
+
+    uint8_t *sq = r->sq_ptr, *cq = r->cq_ptr;
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // one empty direct descriptor slot per file in the batch
+    int *slots = malloc(depth * sizeof(int));
+    if (!slots) goto fail;
+
+    for (size_t i = 0; i < depth; i++) slots[i] = -1;
+
+    int res = syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, slots, depth);
+    free(slots);
+
+    if (res == -1) goto fail;
+
+    return r;
+
+fail:
+    uring_free(r);
+    return NULL;
+}
+
+static void uring_prep(jb_uring_t *r, unsigned tail, uint8_t op, uint64_t data) {
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->user_data = data;
+
+    r->sq_array[idx] = idx;
+}
+
+// submit every item that hasn't already failed; sets `*direct` if the kernel turns out not to
+// honour direct descriptors after all
+static jb_errno_t uring_run(jb_batch_t *b, bool *direct) {
+    jb_uring_t *r = b->ring;
+    unsigned tail = *r->sq_tail;
+    size_t submitted = 0;
+
+    *direct = true;
+
+    for (size_t i = 0; i < b->len; i++) {
+        jb_batch_item_t *item = &b->items[i];
+        struct io_uring_sqe *sqe;
+
+        if (item->err) continue;
+        submitted++;
+
+        // hard links keep the chain going when a step fails, so the slot is always closed
+        uring_prep(r, tail, IORING_OP_OPENAT, i * OPS + OP_OPEN);
+        sqe = &r->sqes[tail++ & *r->sq_mask];
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uintptr_t)item->path;
+        sqe->open_flags = O_RDONLY;
+        sqe->file_index = i + 1;
+        sqe->flags = IOSQE_IO_HARDLINK;
+
+        uring_prep(r, tail, IORING_OP_READ, i * OPS + OP_READ);
+        sqe = &r->sqes[tail++ & *r->sq_mask];
+        sqe->fd = i;
+        sqe->addr = (uintptr_t)item->data;
+        sqe->len = b->size;
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+
+        uring_prep(r, tail, IORING_OP_CLOSE, i * OPS + OP_CLOSE);
+        sqe = &r->sqes[tail++ & *r->sq_mask];
+        sqe->file_index = i + 1;
+    }
+
+    __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+    size_t pending = submitted * OPS;
+    size_t submit = pending;
+
+    while (pending > 0) {
+        int res = syscall(__NR_io_uring_enter, r->fd, submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+        if (res == -1) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+
+        submit -= JB_MIN(submit, (size_t)res);
+
+        unsigned head = *r->cq_head;
+        unsigned ctail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != ctail; head++, pending--) {
+            struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            jb_batch_item_t *item = &b->items[cqe->user_data / OPS];
+
+            switch (cqe->user_data % OPS) {
+                case OP_OPEN:
+                    // a direct open reports 0; an fd means `file_index` was ignored, and the read
+                    // of the empty slot will fail
+                    if (cqe->res > 0) {
+                        close(cqe->res);
+                        *direct = false;
+                        if (!item->err) item->err = EBADF;
+                    } else if (cqe->res < 0 && !item->err) {
+                        item->err = -cqe->res;
+                    }
+                    break;
+                case OP_READ:
+                    if (cqe->res >= 0)
+                        item->len = cqe->res;
+                    else if (!item->err)
+                        item->err = -cqe->res;
+                    break;
+            }
+        }
+
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+
+#endif
+
+static void sync_read(jb_batch_t *b, jb_batch_item_t *item) {
+    item->err = 0;
+    item->len = 0;
+
+    int fd = open(item->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        item->err = errno;
+        return;
+    }
+
+    while (item->len < b->size) {
+        ssize_t n = read(fd, item->data + item->len, b->size - item->len);
+
+        if (n == -1 && errno == EINTR) continue;
+
+        if (n == -1) {
+            item->err = errno;
+            break;
+        }
+
+        if (n == 0) break;
+
+        item->len += n;
+    }
+
+    close(fd);
+}
+
+jb_errno_t jb_batch_init(jb_batch_t *b, size_t depth, size_t size, int flags) {
+    b->depth = depth;
+    b->size = size;
+    b->len = 0;
+    b->ring = NULL;
+    b->retry = NULL;
+
+    b->items = malloc(depth * sizeof(jb_batch_item_t));
+    b->paths = malloc(depth * PATH_MAX);
+    b->bufs = malloc(depth * (size + 1));
+    b->retry = malloc(depth * sizeof(bool));
+
+    if (!b->items || !b->paths || !b->bufs || !b->retry) {
+        jb_batch_free(b);
+        return ENOMEM;
+    }
+
+#ifdef JBASE_URING
+    if (!(flags & JB_BATCH_SYNC)) b->ring = uring_init(depth);
+#else
+    (void)flags;
+#endif
+
+    jb_debug("batched reads: %s, depth %zu", b->ring ? "io_uring" : "synchronous", depth);
+
+    return 0;
+}
+
+void jb_batch_free(jb_batch_t *b) {
+#ifdef JBASE_URING
+    if (b->ring) uring_free(b->ring);
+#endif
+
+    free(b->items);
+    free(b->paths);
+    free(b->bufs);
+    free(b->retry);
+
+    b->items = NULL;
+    b->paths = NULL;
+    b->bufs = NULL;
+    b->retry = NULL;
+    b->ring = NULL;
+}
+
+jb_batch_item_t *jb_batch_add(jb_batch_t *b, const char *path) {
+    if (b->len == b->depth) return NULL;
+
+    size_t i = b->len;
+    jb_batch_item_t *item = &b->items[i];
+
+    item->path = b->paths + i * PATH_MAX;
+    item->data = b->bufs + i * (b->size + 1);
+    item->user = NULL;
+    item->len = 0;
+    item->err = 0;
+
+    if (strlen(path) >= PATH_MAX) {
+        item->path[0] = '\0';
+        item->err = ENAMETOOLONG;
+    } else {
+        strcpy(item->path, path);
+    }
+
+    b->len++;
+
+    return item;
+}
+
+jb_errno_t jb_batch_run(jb_batch_t *b) {
+#ifdef JBASE_URING
+    if (b->ring) {
+        // only items the ring fails on are retried, not those that failed before it
+        for (size_t i = 0; i < b->len; i++) b->retry[i] = !b->items[i].err;
+
+        bool direct;
+        jb_errno_t err = uring_run(b, &direct);
+
+        // a failed submit leaves the ring holding requests that were never reaped, which the
+        // next batch would mistake for its own, so it's dropped and the whole batch read again
+        if (err) {
+            jb_warn("io_uring failed (%s); reading files synchronously", strerror(err));
+            uring_free(b->ring);
+            b->ring = NULL;
+
+            for (size_t i = 0; i < b->len; i++)
+                if (b->retry[i]) sync_read(b, &b->items[i]);
+        } else {
+            if (!direct) {
+                jb_warn("io_uring ignored direct descriptors; reading files synchronously");
+                uring_free(b->ring);
+                b->ring = NULL;
+            }
+
+            // whatever went wrong in the ring (unsupported ops, a short-lived kernel quirk, or a
+            // real error the synchronous read will report again), the file gets a plain read
+            for (size_t i = 0; i < b->len; i++)
+                if (b->retry[i] && b->items[i].err) sync_read(b, &b->items[i]);
+        }
+    } else
+#endif
+    {
+        for (size_t i = 0; i < b->len; i++)
+            if (!b->items[i].err) sync_read(b, &b->items[i]);
+    }
+
+    for (size_t i = 0; i < b->len; i++) b->items[i].data[b->items[i].len] = '\0';
+
+    return 0;
+}
+
+void jb_batch_clear(jb_batch_t *b) {
+    b->len = 0;
+}
@@ -0,0 +1,427 @@
+/*
+ * jbase - C utility library
+ * Copyright (C) 2024  Jacob Sinclair <jcbsnclr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//
+// compile.c: bytecode compiler
+//
+// each command compiles to its arguments followed by a call, and each block to its commands with
+// the result of all but the last popped. `[inline]` commands are compiled in place, while `{quote}`
+// blocks are queued and compiled after the block that contains them, so each block's code is
+// contiguous. command names, variable names and string literals are all interned as symbols, and
+// `set NAME VALUE` compiles to a store into NAME's slot
+//
+
+#include <jbase.h>
+#include <string.h>
+
+typedef struct {
+    uint32_t block;
+    const jb_cmd_t *body;
+} pending_t;
+
+typedef struct {
+    jb_prog_t *prog;
+
+    uint32_t *table; // open-addressed symbol indices plus one, 0 for empty
+    size_t table_cap;
+
+    pending_t *queue; // quoted blocks still to compile
+    uint32_t depth, max_depth;
+} compiler_t;
+
+// `set` is interned before anything else
+#define SET_SYM 0
+
+static void table_insert(compiler_t *c, uint32_t sym) {
+    jb_sym_t *s = &c->prog->syms[sym];
+    size_t mask = c->table_cap - 1;
+    size_t i = jb_hash(c->prog->strs + s->off, s->len) & mask;
+
+    while (c->table[i]) i = (i + 1) & mask;
+    c->table[i] = sym + 1;
+}
+
+static jb_res_t intern(compiler_t *c, jb_view_t str, uint32_t *out) {
+    jb_prog_t *prog = c->prog;
+    size_t mask = c->table_cap - 1;
+
+    for (size_t i = jb_hash(str.ptr, str.len) & mask; c->table[i]; i = (i + 1) & mask) {
+        jb_sym_t *s = &prog->syms[c->table[i] - 1];
+
+        if (s->len == str.len && memcmp(prog->strs + s->off, str.ptr, str.len) == 0) {
+            *out = c->table[i] - 1;
+            return JB_OK_VAL;
+        }
+    }
+
+    if (jb_buf_len(prog->syms) >= JB_OP_ARG_MAX || jb_buf_len(prog->strs) + str.len >= UINT32_MAX)
+        return JB_ERR(JB_ERR_PARSER, "too many symbols");
+
+    jb_sym_t sym = {.off = jb_buf_len(prog->strs), .len = str.len};
+    jb_buf_append(prog->strs, str.ptr, str.len);
+    jb_buf_push(prog->strs, '\0');
+
+    *out = jb_buf_len(prog->syms);
+    jb_buf_push(prog->syms, sym);
+
+    // keep the table at most half full
+    if (jb_buf_len(prog->syms) * 2 > c->table_cap) {
+        free(c->table);
+        c->table_cap *= 2;
+        c->table = calloc(c->table_cap, sizeof(uint32_t));
+
+        for (uint32_t i = 0; i < jb_buf_len(prog->syms); i++) table_insert(c, i);
+    } else {
+        table_insert(c, *out);
+    }
+
+    return JB_OK_VAL;
+}
+
+// emit an instruction that leaves the stack `delta` values deeper
+static jb_res_t emit(compiler_t *c, jb_op_t op, size_t arg, int delta) {
+    if (arg > JB_OP_ARG_MAX) return JB_ERR(JB_ERR_PARSER, "operand too large (%zu)", arg);
+
+    jb_buf_push(c->prog->code, (uint32_t)op | (uint32_t)arg << 8);
+
+    c->depth += delta;
+    if (c->depth > c->max_depth) c->max_depth = c->depth;
+
+    return JB_OK_VAL;
+}
+
+static jb_res_t compile_cmds(compiler_t *c, const jb_cmd_t *cmds);
+
+static jb_res_t compile_word(compiler_t *c, const jb_val_t *val) {
+    uint32_t sym;
+
+    switch (val->kind) {
+        case JB_VAL_INT:
+            JB_TRY(emit(c, JB_OP_INT, jb_buf_len(c->prog->ints), 1));
+            jb_buf_push(c->prog->ints, val->int_val);
+            break;
+
+        case JB_VAL_STR:
+            JB_TRY(intern(c, val->str_val, &sym));
+            JB_TRY(emit(c, JB_OP_STR, sym, 1));
+            break;
+
+        case JB_VAL_REF:
+            JB_TRY(intern(c, val->str_val, &sym));
+            JB_TRY(emit(c, JB_OP_LOAD, sym, 1));
+            break;
+
+        case JB_VAL_QUOTE: {
+            pending_t pending = {.block = jb_buf_len(c->prog->blocks), .body = val->body};
+            jb_block_t block = {0, 0};
+
+            jb_buf_push(c->prog->blocks, block);
+            jb_buf_push(c->queue, pending);
+
+            JB_TRY(emit(c, JB_OP_BLOCK, pending.block, 1));
+        } break;
+
+        case JB_VAL_INLINE:
+            JB_TRY(compile_cmds(c, val->body));
+            break;
+    }
+
+    return JB_OK_VAL;
+}
+
+static jb_res_t compile_cmd(compiler_t *c, const jb_cmd_t *cmd) {
+    const jb_val_t *words = cmd->body;
+    size_t argc = jb_buf_len(words) - 1;
+    uint32_t name;
+
+    if (words[0].kind != JB_VAL_STR) {
+        for (size_t i = 0; i <= argc; i++) JB_TRY(compile_word(c, &words[i]));
+
+        return emit(c, JB_OP_CALLV, argc, -(int)argc);
+    }
+
+    JB_TRY(intern(c, words[0].str_val, &name));
+
+    if (name == SET_SYM) {
+        if (argc != 2 || words[1].kind != JB_VAL_STR)
+            return JB_ERR(JB_ERR_PARSER, "`set` takes a variable name and a value");
+
+        uint32_t var;
+        JB_TRY(intern(c, words[1].str_val, &var));
+        JB_TRY(compile_word(c, &words[2]));
+
+        return emit(c, JB_OP_STORE, var, 0);
+    }
+
+    for (size_t i = 1; i <= argc; i++) JB_TRY(compile_word(c, &words[i]));
+
+    JB_TRY(emit(c, JB_OP_CALL, argc, 1 - (int)argc));
+    jb_buf_push(c->prog->code, name);
+
+    return JB_OK_VAL;
+}
+
+static jb_res_t compile_cmds(compiler_t *c, const jb_cmd_t *cmds) {
+    size_t compiled = 0;
+
+    for (size_t i = 0; i < jb_buf_len(cmds); i++) {
+        if (jb_buf_len(cmds[i].body) == 0) continue;
+
+        if (compiled++ > 0) JB_TRY(emit(c, JB_OP_POP, 0, -1));
+        JB_TRY(compile_cmd(c, &cmds[i]));
+    }
+
+    if (compiled == 0) JB_TRY(emit(c, JB_OP_NIL, 0, 1));
+
+    return JB_OK_VAL;
+}
+
+static jb_res_t compile_block(compiler_t *c, uint32_t block, const jb_cmd_t *body) {
+    c->depth = c->max_depth = 0;
+
+    size_t start = jb_buf_len(c->prog->code);
+    if (start > UINT32_MAX) return JB_ERR(JB_ERR_PARSER, "program too large");
+
+    JB_TRY(compile_cmds(c, body));
+    JB_TRY(emit(c, JB_OP_RET, 0, 0));
+
+    c->prog->blocks[block].start = start;
+    c->prog->blocks[block].depth = c->max_depth;
+
+    return JB_OK_VAL;
+}
+
+static jb_res_t compile(compiler_t *c, const jb_val_t *tree) {
+    uint32_t set;
+    JB_TRY(intern(c, (jb_view_t){"set", 3}, &set));
+
+    jb_block_t top = {0, 0};
+    jb_buf_push(c->prog->blocks, top);
+    JB_TRY(compile_block(c, 0, tree->body));
+
+    // blocks queued while compiling may queue more
+    for (size_t i = 0; i < jb_buf_len(c->queue); i++) {
+        pending_t pending = c->queue[i];
+        JB_TRY(compile_block(c, pending.block, pending.body));
+    }
+
+    return JB_OK_VAL;
+}
+
+jb_res_t jb_compile(const jb_val_t *tree, jb_prog_t *prog) {
+    if (tree->kind != JB_VAL_QUOTE) return JB_ERR(JB_ERR_PARSER, "can only compile a script");
+
+    memset(prog, 0, sizeof(*prog));
+
+    compiler_t c = {
+        .prog = prog,
+        .table_cap = 64,
+        .table = calloc(64, sizeof(uint32_t)),
+        .queue = JB_BUF,
+    };
+
+    jb_span_begin("jb_compile", NULL);
+    jb_res_t res = compile(&c, tree);
+    jb_span_end();
+
+    free(c.table);
+    jb_buf_free(c.queue);
+
+    if (res JB_IS_ERR) jb_prog_free(prog);
+
+    return res;
+}
+
+void jb_prog_free(jb_prog_t *prog) {
+    jb_buf_free(prog->code);
+    jb_buf_free(prog->ints);
+    jb_buf_free(prog->syms);
+    jb_buf_free(prog->blocks);
+    jb_buf_free(prog->strs);
+
+    free(prog->cmds);
+    free(prog->slots);
+
+    memset(prog, 0, sizeof(*prog));
+}
+
+//
+// saved programs
+//
+// a header of magic, version and the length of each array, followed by the arrays themselves
+//
+
+#define PROG_MAGIC 0x43504a42 // "JBPC"
+#define PROG_VERSION 1
+
+typedef struct {
+    uint32_t magic, version;
+    uint32_t code, ints, syms, blocks, strs;
+    uint32_t pad;
+} prog_hdr_t;
+
+// an empty jb_buf is NULL, so there's nothing to copy
+static jb_errno_t write_array(jb_io_buf_t *buf, const void *data, size_t bytes) {
+    if (bytes == 0) return 0;
+
+    return jb_io_buf_write(buf, data, bytes);
+}
+
+jb_errno_t jb_prog_save(const jb_prog_t *prog, jb_io_buf_t *buf) {
+    prog_hdr_t hdr = {
+        .magic = PROG_MAGIC,
+        .version = PROG_VERSION,
+        .code = jb_buf_len(prog->code),
+        .ints = jb_buf_len(prog->ints),
+        .syms = jb_buf_len(prog->syms),
+        .blocks = jb_buf_len(prog->blocks),
+        .strs = jb_buf_len(prog->strs),
+        .pad = 0,
+    };
+
+    jb_errno_t err;
+    if ((err = jb_io_buf_write(buf, (uint8_t *)&hdr, sizeof(hdr)))) return err;
+    if ((err = write_array(buf, prog->code, hdr.code * sizeof(uint32_t)))) return err;
+    if ((err = write_array(buf, prog->ints, hdr.ints * sizeof(int64_t)))) return err;
+    if ((err = write_array(buf, prog->syms, hdr.syms * sizeof(jb_sym_t)))) return err;
+    if ((err = write_array(buf, prog->blocks, hdr.blocks * sizeof(jb_block_t)))) return err;
+
+    return write_array(buf, prog->strs, hdr.strs);
+}
+
+// run through each block as the interpreter would, checking operands and stack depth
+static jb_res_t check(const jb_prog_t *prog) {
+    size_t ncode = jb_buf_len(prog->code), nsyms = jb_buf_len(prog->syms);
+    size_t nstrs = jb_buf_len(prog->strs);
+
+    if (jb_buf_len(prog->blocks) == 0) return JB_ERR(JB_ERR_PARSER, "program has no blocks");
+
+    for (size_t i = 0; i < nsyms; i++) {
+        jb_sym_t sym = prog->syms[i];
+        if ((size_t)sym.off + sym.len >= nstrs || prog->strs[sym.off + sym.len] != '\0')
+            return JB_ERR(JB_ERR_PARSER, "symbol %zu out of bounds", i);
+    }
+
+    for (size_t b = 0; b < jb_buf_len(prog->blocks); b++) {
+        jb_block_t block = prog->blocks[b];
+        if (block.depth > JB_VM_STACK) return JB_ERR(JB_ERR_PARSER, "block %zu too deep", b);
+
+        int64_t depth = 0;
+        size_t pc = block.start;
+
+        for (;;) {
+            if (pc >= ncode) return JB_ERR(JB_ERR_PARSER, "block %zu runs off the end", b);
+
+            uint32_t ins = prog->code[pc++];
+            uint32_t op = ins & 0xff, arg = ins >> 8;
+            bool ok = true;
+
+            switch (op) {
+                case JB_OP_NIL:
+                    depth++;
+                    break;
+                case JB_OP_INT:
+                    ok = arg < jb_buf_len(prog->ints);
+                    depth++;
+                    break;
+                case JB_OP_STR:
+                case JB_OP_LOAD:
+                    ok = arg < nsyms;
+                    depth++;
+                    break;
+                case JB_OP_BLOCK:
+                    ok = arg < jb_buf_len(prog->blocks);
+                    depth++;
+                    break;
+                case JB_OP_STORE:
+                    ok = arg < nsyms && depth >= 1;
+                    break;
+                case JB_OP_POP:
+                    ok = depth >= 1;
+                    depth--;
+                    break;
+                case JB_OP_CALL:
+                    ok = pc < ncode && prog->code[pc++] < nsyms && depth >= arg;
+                    depth += 1 - (int64_t)arg;
+                    break;
+                case JB_OP_CALLV:
+                    ok = depth >= (int64_t)arg + 1;
+                    depth -= arg;
+                    break;
+                case JB_OP_RET:
+                    ok = depth >= 1;
+                    break;
+                default:
+                    ok = false;
+                    break;
+            }
+
+            if (!ok || depth > block.depth)
+                return JB_ERR(JB_ERR_PARSER, "bad instruction at %zu in block %zu", pc - 1, b);
+
+            if (op == JB_OP_RET) break;
+        }
+    }
+
+    return JB_OK_VAL;
+}
+
+// copy `n` elements out of a saved program into a new buffer
+static const uint8_t *take_array(const uint8_t *p, void **buf, size_t n, size_t elem_size) {
+    *buf = JB_BUF;
+    if (n == 0) return p;
+
+    *buf = jb_buf_grow(NULL, n, elem_size);
+    memcpy(*buf, p, n * elem_size);
+    jb_buf_hdr(*buf)->len = n;
+
+    return p + n * elem_size;
+}
+
+jb_res_t jb_prog_load(jb_prog_t *prog, const uint8_t *data, size_t len, size_t *used) {
+    memset(prog, 0, sizeof(*prog));
+
+    prog_hdr_t hdr;
+    if (len < sizeof(hdr)) return JB_ERR(JB_ERR_PARSER, "saved program truncated");
+    memcpy(&hdr, data, sizeof(hdr));
+
+    if (hdr.magic != PROG_MAGIC) return JB_ERR(JB_ERR_PARSER, "not a saved program");
+    if (hdr.version != PROG_VERSION)
+        return JB_ERR(JB_ERR_PARSER, "unsupported saved program version %u", hdr.version);
+
+    size_t size = sizeof(hdr) + (size_t)hdr.code * sizeof(uint32_t) +
+                  (size_t)hdr.ints * sizeof(int64_t) + (size_t)hdr.syms * sizeof(jb_sym_t) +
+                  (size_t)hdr.blocks * sizeof(jb_block_t) + hdr.strs;
+    if (len < size) return JB_ERR(JB_ERR_PARSER, "saved program truncated");
+
+    const uint8_t *p = data + sizeof(hdr);
+    p = take_array(p, (void **)&prog->code, hdr.code, sizeof(uint32_t));
+    p = take_array(p, (void **)&prog->ints, hdr.ints, sizeof(int64_t));
+    p = take_array(p, (void **)&prog->syms, hdr.syms, sizeof(jb_sym_t));
+    p = take_array(p, (void **)&prog->blocks, hdr.blocks, sizeof(jb_block_t));
+    p = take_array(p, (void **)&prog->strs, hdr.strs, 1);
+
+    jb_res_t res = check(prog);
+    if (res JB_IS_ERR) {
+        jb_prog_free(prog);
+        return res;
+    }
+
+    *used = size;
+    return JB_OK_VAL;
+}
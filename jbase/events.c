@@ -0,0 +1,133 @@
+#include <jbase.h>
+
+//
+// queue
+//
+// the producer owns `head` and the consumer `tail`; each reads the other's with acquire ordering
+// and publishes its own with release, so an event is fully written before it can be read and
+// fully read before its slot can be reused. indices run freely and are masked into the ring
+//
+
+jb_res_t jb_events_init(jb_events_t *q, size_t cap) {
+    size_t size = 1;
+    while (size < cap) size <<= 1;
+
+    q->slots = malloc(size * sizeof(jb_event_t));
+    if (!q->slots) return JB_ERR(JB_ERR_OOM, "failed to allocate event queue");
+
+    q->mask = size - 1;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+
+    return JB_OK_VAL;
+}
+
+bool jb_events_push(jb_events_t *q, jb_event_t ev) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+    if (head - tail > q->mask) return false;
+
+    q->slots[head & q->mask] = ev;
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+
+    return true;
+}
+
+bool jb_events_midi(jb_events_t *q, jb_midi_t ev) {
+    return jb_events_push(q, (jb_event_t){.kind = JB_EVENT_MIDI, .midi = ev});
+}
+
+bool jb_events_param(jb_events_t *q, uint32_t id, float value) {
+    return jb_events_push(q, (jb_event_t){.kind = JB_EVENT_PARAM, .param = {id, value}});
+}
+
+bool jb_events_pop(jb_events_t *q, jb_event_t *ev) {
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+    if (tail == head) return false;
+
+    *ev = q->slots[tail & q->mask];
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+
+    return true;
+}
+
+void jb_events_drain(jb_events_t *q, const jb_client_config_t *cfg) {
+    jb_event_t ev;
+
+    // only what's queued now; a busy producer can't keep the audio thread here
+    size_t pending = atomic_load_explicit(&q->head, memory_order_acquire) -
+                     atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+    for (size_t i = 0; i < pending && jb_events_pop(q, &ev); i++) {
+        switch (ev.kind) {
+            case JB_EVENT_MIDI:
+                if (cfg->midi_cb) cfg->midi_cb(cfg->state, ev.midi);
+                break;
+            case JB_EVENT_PARAM:
+                if (cfg->param_cb) cfg->param_cb(cfg->state, ev.param.id, ev.param.value);
+                break;
+        }
+    }
+}
+
+void jb_events_free(jb_events_t *q) {
+    free(q->slots);
+}
+
+//
+// smoothed parameters
+//
+
+void jb_params_init(jb_params_t *ps) {
+    ps->params = JB_BUF;
+}
+
+uint32_t jb_params_add(jb_params_t *ps, float *dst, float smooth) {
+    jb_param_t param = {.dst = dst, .target = *dst, .from = *dst, .smooth = smooth};
+    jb_buf_push(ps->params, param);
+
+    return jb_buf_len(ps->params) - 1;
+}
+
+void jb_params_set(jb_params_t *ps, uint32_t id, float value, size_t srate) {
+    if (id >= jb_buf_len(ps->params)) return;
+
+    jb_param_t *p = &ps->params[id];
+    size_t frames = JB_MAX((size_t)1, (size_t)(p->smooth * srate));
+
+    // a new value mid-ramp ramps on from wherever the last one got to
+    p->target = value;
+    p->left = frames;
+    p->step = (value - *p->dst) / frames;
+}
+
+void jb_params_tick(jb_params_t *ps, size_t nframes) {
+    for (size_t i = 0; i < jb_buf_len(ps->params); i++) {
+        jb_param_t *p = &ps->params[i];
+        p->from = *p->dst;
+        if (!p->left) continue;
+
+        size_t n = JB_MIN(p->left, nframes);
+        p->left -= n;
+
+        // land exactly on the target
+        *p->dst = p->left ? *p->dst + p->step * n : p->target;
+    }
+}
+
+void jb_params_fill(const jb_params_t *ps, uint32_t id, size_t nframes, float *out) {
+    if (id >= jb_buf_len(ps->params) || nframes == 0) return;
+
+    const jb_param_t *p = &ps->params[id];
+    float step = (*p->dst - p->from) / nframes;
+
+    // the same ramp `apply_amp` takes, ending on the block's value
+    for (size_t i = 0; i < nframes; i++) out[i] = p->from + step * (float)(i + 1);
+}
+
+void jb_params_free(jb_params_t *ps) {
+    jb_buf_free(ps->params);
+}
@@ -16,7 +16,22 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+//
+// hash.c: non-cryptographic hash functions
+//
+// `jb_mxhash` consumes input a word at a time, folding pairs of words together with a 64x64->128
+// bit multiply (as in wyhash). inputs of at least MX_LONG bytes are first reduced by 8 independent
+// lanes of 64-byte stripes, which map directly onto SSE2 when JBASE_SIMD is enabled. the scalar
+// and SIMD paths, and the fused `_str` variant, all produce identical hashes
+//
+
 #include <jbase.h>
+#include <stdint.h>
+
+#if defined(JBASE_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define MX_SSE2
+#endif
 
 #define FNV_OFFSET_BASIS 0xcbf29ce484222325
 #define FNV_PRIME 0x100000001b3
@@ -27,15 +42,234 @@ jb_hash_t jb_fnv1a(const void *buf, size_t bytes) {
     jb_hash_t hash = FNV_OFFSET_BASIS;
 
     for (size_t i = 0; i < bytes; i++) {
-        hash *= FNV_PRIME;
         hash ^= ptr[i];
+        hash *= FNV_PRIME;
     }
 
     return hash;
 }
 
 jb_hash_t jb_fnv1a_str(const char *str) {
-    size_t len = strlen(str);
+    jb_hash_t hash = FNV_OFFSET_BASIS;
+
+    // no separate strlen pass
+    for (const uint8_t *ptr = (const uint8_t *)str; *ptr; ptr++) {
+        hash ^= *ptr;
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+#define MX_SEED 0xa0761d6478bd642full
+#define MX_P1 0xe7037ed1a0b428dbull
+#define MX_P2 0x8ebc6af09c88c6e3ull
+#define MX_P3 0x589965cc75374cc3ull
+
+// inputs this long or longer go through the striped accumulator
+#define MX_LONG 256
+#define MX_STRIPE 64
+#define MX_LANES 8
+
+static const uint64_t mx_secret[MX_LANES] = {
+    0xbe4ba423396cfeb8ull,
+    0x1cad21f72c81017cull,
+    0xdb979083e96dd4deull,
+    0x1f67b3b7a4a44072ull,
+    0x78e5c0cc4ee679cbull,
+    0x2172ffcc7dd05a82ull,
+    0x8e2443f7744608b8ull,
+    0x4c263a81e69035e0ull,
+};
+
+// multiply, and fold the 128-bit product back to 64 bits
+static inline uint64_t mum(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t load64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// trailing 0-7 bytes, packed into the low bytes of a word
+static inline uint64_t load_tail(const uint8_t *p, size_t n) {
+    uint64_t v = 0;
+    memcpy(&v, p, n);
+    return v;
+}
+
+#ifdef MX_SSE2
+
+static void mx_accumulate(uint64_t acc[MX_LANES], const uint8_t *p, size_t stripes) {
+    __m128i a[MX_LANES / 2], k[MX_LANES / 2];
+
+    for (size_t j = 0; j < MX_LANES / 2; j++) {
+        a[j] = _mm_loadu_si128((const __m128i *)&acc[2 * j]);
+        k[j] = _mm_loadu_si128((const __m128i *)&mx_secret[2 * j]);
+    }
+
+    for (size_t s = 0; s < stripes; s++, p += MX_STRIPE) {
+        for (size_t j = 0; j < MX_LANES / 2; j++) {
+            __m128i d = _mm_loadu_si128((const __m128i *)(p + 16 * j));
+            __m128i dk = _mm_xor_si128(d, k[j]);
+            __m128i prod = _mm_mul_epu32(dk, _mm_srli_epi64(dk, 32));
+
+            a[j] = _mm_add_epi64(a[j], _mm_add_epi64(d, prod));
+        }
+    }
+
+    for (size_t j = 0; j < MX_LANES / 2; j++) _mm_storeu_si128((__m128i *)&acc[2 * j], a[j]);
+}
+
+#else
+
+static void mx_accumulate(uint64_t acc[MX_LANES], const uint8_t *p, size_t stripes) {
+    for (size_t s = 0; s < stripes; s++, p += MX_STRIPE) {
+        for (size_t i = 0; i < MX_LANES; i++) {
+            uint64_t d = load64(p + 8 * i);
+            uint64_t dk = d ^ mx_secret[i];
+
+            acc[i] += d + (dk & 0xffffffff) * (dk >> 32);
+        }
+    }
+}
+
+#endif
+
+// hash `bytes` bytes as a sequence of full words followed by one (possibly empty) tail word,
+// taken in pairs
+static uint64_t mx_words(uint64_t h, const uint8_t *p, size_t bytes) {
+    size_t words = bytes / 8;
+    size_t i = 0;
+
+    for (; i + 1 < words; i += 2) h = mum(load64(p + 8 * i) ^ MX_P1, load64(p + 8 * i + 8) ^ h);
+
+    uint64_t tail = load_tail(p + 8 * words, bytes % 8);
+
+    if (i < words)
+        return mum(load64(p + 8 * i) ^ MX_P1, tail ^ h);
+    else
+        return mum(tail ^ MX_P1, h);
+}
+
+jb_hash_t jb_mxhash(const void *buf, size_t bytes) {
+    const uint8_t *p = (const uint8_t *)buf;
+    uint64_t h = MX_SEED;
+    size_t rest = bytes;
+
+    if (bytes >= MX_LONG) {
+        uint64_t acc[MX_LANES];
+        for (size_t i = 0; i < MX_LANES; i++) acc[i] = mx_secret[i];
+
+        size_t stripes = bytes / MX_STRIPE;
+        mx_accumulate(acc, p, stripes);
+
+        for (size_t i = 0; i < MX_LANES; i += 2) h = mum(acc[i] ^ MX_P1, acc[i + 1] ^ h);
+
+        p += stripes * MX_STRIPE;
+        rest -= stripes * MX_STRIPE;
+    }
+
+    h = mx_words(h, p, rest);
+
+    return mum(h ^ MX_P2, bytes ^ MX_P3);
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+
+#define ONES 0x0101010101010101ull
+#define HIGHS 0x8080808080808080ull
+#define PAGE_SIZE 4096
+
+// load the next word of a string; returns the number of bytes before the NUL terminator (8 if
+// there is none), with bytes from the terminator onwards cleared
+static inline size_t load_str_word(const uint8_t *p, uint64_t *out) {
+    // whole-word loads are only safe if they can't cross into the next (possibly unmapped) page
+    if (((uintptr_t)p & (PAGE_SIZE - 1)) > PAGE_SIZE - 8) {
+        uint64_t v = 0;
+        size_t n = 0;
+
+        while (n < 8 && p[n]) {
+            v |= (uint64_t)p[n] << (8 * n);
+            n++;
+        }
+
+        *out = v;
+        return n;
+    }
+
+    uint64_t v = load64(p);
+    uint64_t zero = (v - ONES) & ~v & HIGHS;
+
+    if (!zero) {
+        *out = v;
+        return 8;
+    }
+
+    // lowest flagged byte is always the first NUL
+    size_t n = __builtin_ctzll(zero) / 8;
+    *out = n ? v & ((1ull << (8 * n)) - 1) : 0;
+
+    return n;
+}
+
+jb_hash_t jb_mxhash_str(const char *str) {
+    const uint8_t *p = (const uint8_t *)str;
+    uint64_t h = MX_SEED;
+    uint64_t pend = 0;
+    bool has_pend = false;
+    size_t len = 0;
+
+    for (;;) {
+        uint64_t w;
+        size_t n = load_str_word(p, &w);
+
+        if (n < 8) {
+            // `w` is the tail word
+            len += n;
+            h = has_pend ? mum(pend ^ MX_P1, w ^ h) : mum(w ^ MX_P1, h);
+            break;
+        }
+
+        if (has_pend)
+            h = mum(pend ^ MX_P1, w ^ h);
+        else
+            pend = w;
+
+        has_pend = !has_pend;
+        len += 8;
+        p += 8;
+
+        // long strings take the striped path, which needs the length up front
+        if (len >= MX_LONG) return jb_mxhash(str, len + strlen((const char *)p));
+    }
+
+    return mum(h ^ MX_P2, len ^ MX_P3);
+}
+
+#else
+
+jb_hash_t jb_mxhash_str(const char *str) {
+    return jb_mxhash(str, strlen(str));
+}
+
+#endif
+
+jb_hash_t jb_hash(const void *buf, size_t bytes) {
+#if JBASE_HASH == JB_HASH_FNV1A
+    return jb_fnv1a(buf, bytes);
+#else
+    return jb_mxhash(buf, bytes);
+#endif
+}
 
-    return jb_fnv1a(str, len);
+jb_hash_t jb_hash_str(const char *str) {
+#if JBASE_HASH == JB_HASH_FNV1A
+    return jb_fnv1a_str(str);
+#else
+    return jb_mxhash_str(str);
+#endif
 }
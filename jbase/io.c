@@ -16,73 +16,309 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <jbase.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "stdlib.h"
 
-jb_errno_t jb_load_file(const char *path, uint8_t **data, size_t *len) {
-    FILE *f = fopen(path, "r");
-    if (!f) return errno;
+// read the rest of `fd` into a heap buffer; `hint` is the expected size, if known
+static jb_errno_t read_all(int fd, size_t hint, uint8_t **data, size_t *len) {
+    size_t cap = hint ? hint + 1 : 4096;
+    size_t used = 0;
+    uint8_t *buf = malloc(cap);
+    if (!buf) return errno;
 
-    if (fseeko(f, 0, SEEK_END) == -1) return errno;
+    for (;;) {
+        if (used == cap) {
+            uint8_t *new_buf = realloc(buf, cap * 2);
+            if (!new_buf) {
+                free(buf);
+                return ENOMEM;
+            }
 
-    off_t l = ftello(f);
-    if (l == -1) return errno;
-    *len = l;
+            buf = new_buf;
+            cap *= 2;
+        }
 
-    rewind(f);
+        ssize_t n = read(fd, buf + used, cap - used);
 
-    *data = malloc(*len);
-    if (fread(*data, 1, *len, f) != *len) return errno;
+        if (n == -1) {
+            if (errno == EINTR) continue;
 
-    if (fclose(f) == EOF) return errno;
+            jb_errno_t err = errno;
+            free(buf);
+            return err;
+        }
+
+        if (n == 0) break;
+
+        used += n;
+    }
+
+    *data = buf;
+    *len = used;
 
     return 0;
 }
 
+jb_errno_t jb_load_file(const char *path, uint8_t **data, size_t *len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return errno;
+
+    struct stat sb;
+    jb_errno_t err = fstat(fd, &sb) == -1 ? errno : 0;
+
+    if (!err) err = read_all(fd, S_ISREG(sb.st_mode) ? sb.st_size : 0, data, len);
+
+    close(fd);
+
+    return err;
+}
+
 jb_errno_t jb_store_file(const char *path, uint8_t *data, size_t len) {
     FILE *f = fopen(path, "w");
     if (!f) return errno;
 
-    if (fwrite(data, 1, len, f) != len) return errno;
+    if (fwrite(data, 1, len, f) != len) {
+        jb_errno_t err = errno;
+        fclose(f);
+        return err;
+    }
 
     if (fclose(f) == EOF) return errno;
 
     return 0;
 }
 
+jb_errno_t jb_map_file(const char *path, jb_map_t *map) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return errno;
+
+    struct stat sb;
+    if (fstat(fd, &sb) == -1) {
+        jb_errno_t err = errno;
+        close(fd);
+        return err;
+    }
+
+    // pipes, devices and procfs files (which report a size of 0) can't be mapped
+    if (S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        void *data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED) {
+            close(fd);
+
+            // callers read front to back; start readahead for the whole file now
+            madvise(data, sb.st_size, MADV_SEQUENTIAL);
+            madvise(data, sb.st_size, MADV_WILLNEED);
+
+            map->data = data;
+            map->len = sb.st_size;
+            map->mapped = true;
+
+            return 0;
+        }
+    }
+
+    map->mapped = false;
+    jb_errno_t err = read_all(fd, 0, &map->data, &map->len);
+    close(fd);
+
+    return err;
+}
+
+void jb_unmap_file(jb_map_t *map) {
+    if (map->mapped)
+        munmap(map->data, map->len);
+    else
+        free(map->data);
+
+    map->data = NULL;
+    map->len = 0;
+}
+
+// write all of `data` to `fd`, then flush it to disk
+static jb_errno_t write_synced(int fd, const uint8_t *data, size_t len) {
+    for (size_t off = 0; off < len;) {
+        ssize_t n = write(fd, data + off, len - off);
+
+        if (n == -1 && errno != EINTR) return errno;
+        if (n > 0) off += n;
+    }
+
+    return fsync(fd) == -1 ? errno : 0;
+}
+
+// a file with other hard links can't be replaced without splitting it from them, so it's
+// rewritten where it is instead
+static jb_errno_t store_in_place(const char *path, const uint8_t *data, size_t len) {
+    int fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+    if (fd == -1) return errno;
+
+    jb_errno_t err = write_synced(fd, data, len);
+    if (close(fd) == -1 && !err) err = errno;
+
+    return err;
+}
+
+// create a uniquely named temporary next to `path`; like mkstemp, but the file gets the usual
+// 0666 less the umask, as a plain `open` would give a new file
+static int open_tmp(const char *path, int dir_len, char *tmp) {
+    static atomic_uint seq;
+
+    for (int tries = 0; tries < 100; tries++) {
+        unsigned id = atomic_fetch_add_explicit(&seq, 1, memory_order_relaxed);
+        int n = snprintf(tmp, PATH_MAX, "%.*s" JB_TMP_PREFIX "%s.%d.%u", dir_len, path,
+                         path + dir_len, (int)getpid(), id);
+        if (n >= PATH_MAX) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+
+        int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (fd != -1 || errno != EEXIST) return fd;
+    }
+
+    errno = EEXIST;
+    return -1;
+}
+
+jb_errno_t jb_store_file_atomic(const char *path, const uint8_t *data, size_t len) {
+    // replace what a symlink points to, not the link
+    char real[PATH_MAX];
+    if (realpath(path, real))
+        path = real;
+    else if (errno != ENOENT)
+        return errno;
+
+    struct stat sb;
+    bool exists = stat(path, &sb) == 0;
+    if (!exists && errno != ENOENT) return errno;
+
+    if (exists && sb.st_nlink > 1) return store_in_place(path, data, len);
+
+    // the temporary lives next to the target, so the rename can't cross filesystems
+    const char *slash = strrchr(path, '/');
+    int dir_len = slash ? (int)(slash - path + 1) : 0;
+
+    char tmp[PATH_MAX];
+    int fd = open_tmp(path, dir_len, tmp);
+    if (fd == -1) return errno;
+
+    jb_errno_t err = 0;
+
+    // keep the owner and permissions of the file being replaced
+    if (exists && (fchown(fd, sb.st_uid, sb.st_gid) == -1 || fchmod(fd, sb.st_mode & 07777) == -1))
+        err = errno;
+
+    if (!err) err = write_synced(fd, data, len);
+    if (close(fd) == -1 && !err) err = errno;
+    if (!err && rename(tmp, path) == -1) err = errno;
+
+    if (err) {
+        unlink(tmp);
+        return err;
+    }
+
+    // make the rename itself durable
+    char dir[PATH_MAX];
+    snprintf(dir, PATH_MAX, "%.*s", dir_len ? dir_len : 1, dir_len ? path : ".");
+
+    int dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd != -1) {
+        fsync(dfd);
+        close(dfd);
+    }
+
+    return 0;
+}
+
 jb_errno_t jb_io_buf_init(jb_io_buf_t *buf, size_t cap) {
-    buf->cap = cap;
+    buf->cap = JB_MAX(cap, 16);
     buf->len = 0;
-    buf->buf = malloc(cap);
+    // one spare byte past `cap` for the terminator
+    buf->buf = malloc(buf->cap + 1);
 
     if (!buf->buf) return errno;
 
-    memset(buf->buf, 0, buf->cap);
+    buf->buf[0] = '\0';
 
     return 0;
 }
 
-jb_errno_t jb_io_buf_write(jb_io_buf_t *buf, uint8_t *data, size_t len) {
-    size_t new_len = buf->len + len;
-    size_t new_cap = buf->cap;
-    uint8_t *new_buf = buf->buf;
+jb_errno_t jb_io_buf_reserve(jb_io_buf_t *buf, size_t extra) {
+    if (extra <= buf->cap - buf->len) return 0;
 
-    if (new_len >= buf->cap) {
-        while (new_cap < new_len) new_cap *= 2;
-        new_buf = realloc(buf->buf, new_cap);
+    if (extra > SIZE_MAX / 2 - buf->len) return ENOMEM;
 
-        if (!new_buf) return errno;
-    }
+    // grow geometrically, so a run of appends costs amortised O(1) per byte
+    size_t new_cap = buf->cap * 2;
+    while (new_cap < buf->len + extra) new_cap *= 2;
 
-    memcpy(new_buf + buf->len, data, len);
-    memset(new_buf + new_len, 0, new_cap - new_len);
+    uint8_t *new_buf = realloc(buf->buf, new_cap + 1);
+    if (!new_buf) return errno;
 
-    buf->len = new_len;
-    buf->cap = new_cap;
     buf->buf = new_buf;
+    buf->cap = new_cap;
+
+    return 0;
+}
+
+jb_errno_t jb_io_buf_write(jb_io_buf_t *buf, const uint8_t *data, size_t len) {
+    // `data` may be NULL (e.g. an empty jb_buf), which memcpy doesn't allow even for no bytes
+    if (len == 0) return 0;
+
+    jb_errno_t err = jb_io_buf_reserve(buf, len);
+    if (err) return err;
+
+    memcpy(buf->buf + buf->len, data, len);
+    buf->len += len;
+    buf->buf[buf->len] = '\0';
+
+    return 0;
+}
+
+jb_errno_t jb_io_buf_push(jb_io_buf_t *buf, uint8_t c) {
+    if (buf->len == buf->cap) {
+        jb_errno_t err = jb_io_buf_reserve(buf, 1);
+        if (err) return err;
+    }
+
+    buf->buf[buf->len++] = c;
+    buf->buf[buf->len] = '\0';
+
+    return 0;
+}
+
+jb_errno_t jb_io_buf_printf(jb_io_buf_t *buf, const char *fmt, ...) {
+    va_list args;
+
+    // format straight into the spare capacity, and again only if it didn't fit
+    va_start(args, fmt);
+    int n = vsnprintf((char *)buf->buf + buf->len, buf->cap - buf->len + 1, fmt, args);
+    va_end(args);
+
+    if (n < 0) return errno;
+
+    if ((size_t)n > buf->cap - buf->len) {
+        jb_errno_t err = jb_io_buf_reserve(buf, n);
+        if (err) {
+            buf->buf[buf->len] = '\0';
+            return err;
+        }
+
+        va_start(args, fmt);
+        vsnprintf((char *)buf->buf + buf->len, n + 1, fmt, args);
+        va_end(args);
+    }
+
+    buf->len += n;
 
     return 0;
 }
@@ -94,9 +330,53 @@ jb_errno_t jb_io_buf_flush(jb_io_buf_t *buf, FILE *f) {
     return 0;
 }
 
+jb_errno_t jb_io_buf_flush_fd(jb_io_buf_t *buf, int fd) {
+    return jb_io_buf_writev(fd, buf, 1);
+}
+
+#define IOV_BATCH 64
+
+jb_errno_t jb_io_buf_writev(int fd, jb_io_buf_t *bufs, size_t n) {
+    struct iovec iov[IOV_BATCH];
+
+    for (size_t i = 0; i < n;) {
+        size_t cnt = 0;
+        for (; cnt < IOV_BATCH && i + cnt < n; cnt++) {
+            iov[cnt].iov_base = bufs[i + cnt].buf;
+            iov[cnt].iov_len = bufs[i + cnt].len;
+        }
+
+        i += cnt;
+
+        // advance through the batch until every byte is written
+        struct iovec *cur = iov;
+        while (cnt > 0) {
+            ssize_t w = writev(fd, cur, cnt);
+
+            if (w == -1) {
+                if (errno == EINTR) continue;
+                return errno;
+            }
+
+            while (cnt > 0 && (size_t)w >= cur->iov_len) {
+                w -= cur->iov_len;
+                cur++;
+                cnt--;
+            }
+
+            if (cnt > 0) {
+                cur->iov_base = (uint8_t *)cur->iov_base + w;
+                cur->iov_len -= w;
+            }
+        }
+    }
+
+    return 0;
+}
+
 void jb_io_buf_clear(jb_io_buf_t *buf) {
     buf->len = 0;
-    memset(buf->buf, 0, buf->cap);
+    buf->buf[0] = '\0';
 }
 
 void jb_io_buf_free(jb_io_buf_t *buf) {
@@ -104,19 +384,145 @@ void jb_io_buf_free(jb_io_buf_t *buf) {
 }
 
 jb_errno_t jb_read_line(FILE *f, jb_io_buf_t *buf) {
-    jb_errno_t err;
+    jb_errno_t err = 0;
+    int c;
 
-    char c;
-    while (fread(&c, 1, 1, f) == 1 && c != '\n') {
-        err = jb_io_buf_write(buf, (uint8_t *)&c, 1);
-        if (err) return err;
+    // copied straight from stdio's buffer into `buf`, so once `buf` has grown to fit, a line
+    // costs no allocation
+    flockfile(f);
+    while ((c = getc_unlocked(f)) != EOF && c != '\n')
+        if ((err = jb_io_buf_push(buf, c))) break;
+    funlockfile(f);
+
+    if (!err && c == EOF && ferror(f)) err = errno;
+
+    return err;
+}
+
+jb_errno_t jb_reader_init(jb_reader_t *rd, size_t cap) {
+    rd->kind = JB_READER_NONE;
+    rd->fd = -1;
+    rd->f = NULL;
+    rd->cap = cap;
+    rd->buf = malloc(cap + 1);
+
+    if (!rd->buf) return errno;
+
+    rd->data = rd->buf;
+    rd->start = rd->end = rd->total = 0;
+    rd->eof = true;
+
+    return 0;
+}
+
+void jb_reader_free(jb_reader_t *rd) {
+    free(rd->buf);
+    rd->buf = NULL;
+}
+
+static void reader_reset(jb_reader_t *rd) {
+    rd->data = rd->buf;
+    rd->start = rd->end = rd->total = 0;
+    rd->eof = false;
+}
+
+void jb_reader_fd(jb_reader_t *rd, int fd) {
+    reader_reset(rd);
+    rd->kind = JB_READER_FD;
+    rd->fd = fd;
+}
+
+void jb_reader_file(jb_reader_t *rd, FILE *f) {
+    reader_reset(rd);
+    rd->kind = JB_READER_FILE;
+    rd->f = f;
+}
+
+void jb_reader_mem(jb_reader_t *rd, const void *data, size_t len) {
+    rd->kind = JB_READER_MEM;
+    rd->data = data;
+    rd->start = 0;
+    rd->end = rd->total = len;
+    rd->eof = true;
+}
+
+// pull more data from the source, moving unconsumed bytes to the front of the buffer first
+static jb_errno_t reader_fill(jb_reader_t *rd) {
+    if (rd->kind == JB_READER_MEM || rd->kind == JB_READER_NONE) {
+        rd->eof = true;
+        return 0;
+    }
+
+    if (rd->start > 0) {
+        memmove(rd->buf, rd->buf + rd->start, rd->end - rd->start);
+        rd->end -= rd->start;
+        rd->start = 0;
+    }
+
+    // a line longer than the buffer; grow it
+    if (rd->end == rd->cap) {
+        uint8_t *buf = realloc(rd->buf, rd->cap * 2 + 1);
+        if (!buf) return errno;
+
+        rd->buf = buf;
+        rd->cap *= 2;
+    }
+
+    rd->data = rd->buf;
+
+    ssize_t n;
+    if (rd->kind == JB_READER_FD) {
+        do n = read(rd->fd, rd->buf + rd->end, rd->cap - rd->end);
+        while (n == -1 && errno == EINTR);
+
+        if (n == -1) return errno;
+    } else {
+        n = fread(rd->buf + rd->end, 1, rd->cap - rd->end, rd->f);
+        if (n == 0 && ferror(rd->f)) return errno;
     }
 
-    if (ferror(f)) return errno;
+    if (n == 0) rd->eof = true;
+
+    rd->end += n;
+    rd->total += n;
 
     return 0;
 }
 
+jb_errno_t jb_reader_line(jb_reader_t *rd, jb_view_t *line, bool *got) {
+    // bytes already searched for a newline, relative to `start`
+    size_t searched = 0;
+
+    for (;;) {
+        size_t from = rd->start + searched;
+        const uint8_t *nl = memchr(rd->data + from, '\n', rd->end - from);
+
+        if (nl || rd->eof) {
+            size_t pos = nl ? (size_t)(nl - rd->data) : rd->end;
+
+            if (!nl && pos == rd->start) {
+                *got = false;
+                return 0;
+            }
+
+            line->ptr = (const char *)rd->data + rd->start;
+            line->len = pos - rd->start;
+
+            if (rd->kind != JB_READER_MEM) rd->buf[pos] = '\0';
+
+            rd->start = nl ? pos + 1 : pos;
+            *got = true;
+
+            return 0;
+        }
+
+        searched = rd->end - rd->start;
+
+        jb_errno_t err = reader_fill(rd);
+        if (err) return err;
+    }
+}
+
 jb_errno_t jb_open(const char *path, FILE **out, const char *mode) {
     FILE *f = fopen(path, mode);
     if (!f) return errno;
@@ -193,6 +599,28 @@ jb_errno_t jb_path_res(const char *path, char *out) {
     return 0;
 }
 
+jb_errno_t jb_mkdir_rec(const char *path) {
+    char buf[PATH_MAX + 1];
+
+    size_t len = strnlen(path, PATH_MAX + 1);
+    if (len > PATH_MAX) return ENAMETOOLONG;
+
+    memcpy(buf, path, len + 1);
+
+    // create each parent in turn, ignoring ones that already exist
+    for (char *p = buf + 1; *p; p++) {
+        if (*p != '/') continue;
+
+        *p = '\0';
+        if (mkdir(buf, S_IRWXU) == -1 && errno != EEXIST) return errno;
+        *p = '/';
+    }
+
+    if (mkdir(buf, S_IRWXU) == -1 && errno != EEXIST) return errno;
+
+    return 0;
+}
+
 jb_errno_t jb_fstat(const char *path, struct stat *buf) {
     struct stat temp;
     struct stat *sbuf = buf ? buf : &temp;
@@ -104,7 +104,7 @@ bool jb_iter_next(void *iter, void *out) {
     jb_iter_t *i = (jb_iter_t *)iter;
 
     if (i->magic != ITER_MAGIC) {
-        jb_error("object %p is not iterator");
+        jb_error("object %p is not iterator", iter);
         return false;
     }
 
@@ -16,29 +16,147 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include <ctype.h>
 #include <jbase.h>
+#include <pthread.h>
+
+#if defined(JBASE_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define CC_AVX2
+#elif defined(JBASE_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define CC_SSE2
+#endif
 
 static char *symbols = "!£$%^&*;:@#~,<.>/?\\|";
 
-static bool str_has(const char *str, char c) {
-    while (*str) {
-        if (*str == c) {
-            return true;
-        }
-        str++;
-    }
+static jb_cclass_t tok_class, ws_class;
+static pthread_once_t classes_once = PTHREAD_ONCE_INIT;
 
-    return false;
+static void classes_init() {
+    jb_cc_init(&tok_class);
+    jb_cc_add_range(&tok_class, 'a', 'z');
+    jb_cc_add_range(&tok_class, 'A', 'Z');
+    jb_cc_add_range(&tok_class, '0', '9');
+    jb_cc_add_chars(&tok_class, symbols);
+
+    // isspace() in the C locale
+    jb_cc_init(&ws_class);
+    jb_cc_add_range(&ws_class, '\t', '\r');
+    jb_cc_add_chars(&ws_class, " ");
 }
 
 bool jb_lx_tok(char c) {
-    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
-           str_has(symbols, c);
+    pthread_once(&classes_once, classes_init);
+    return jb_cc_has(&tok_class, c);
 }
 
 bool jb_lx_ws(char c) {
-    return isspace(c);
+    pthread_once(&classes_once, classes_init);
+    return jb_cc_has(&ws_class, c);
+}
+
+void jb_cc_init(jb_cclass_t *cc) {
+    memset(cc, 0, sizeof(*cc));
+    cc->simd = true;
+}
+
+// members added after inverting can't be described for SIMD; those classes use the table alone
+void jb_cc_add_chars(jb_cclass_t *cc, const char *chars) {
+    for (const uint8_t *c = (const uint8_t *)chars; *c; c++) {
+        if (cc->has[*c]) continue;
+
+        cc->has[*c] = true;
+
+        if (!cc->inv && cc->nbytes < JB_CC_BYTES)
+            cc->bytes[cc->nbytes++] = *c;
+        else
+            cc->simd = false;
+    }
+}
+
+void jb_cc_add_range(jb_cclass_t *cc, char lo, char hi) {
+    for (int c = (uint8_t)lo; c <= (uint8_t)hi; c++) cc->has[c] = true;
+
+    if (!cc->inv && cc->nranges < JB_CC_RANGES) {
+        cc->lo[cc->nranges] = lo;
+        cc->hi[cc->nranges] = hi;
+        cc->nranges++;
+    } else {
+        cc->simd = false;
+    }
+}
+
+void jb_cc_invert(jb_cclass_t *cc) {
+    for (size_t c = 0; c < 256; c++) cc->has[c] = !cc->has[c];
+    cc->inv = !cc->inv;
+}
+
+#if defined(CC_AVX2)
+
+#define VEC __m256i
+#define VEC_BYTES 32
+#define VEC_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define VEC_SET1(b) _mm256_set1_epi8((char)(b))
+#define VEC_ZERO() _mm256_setzero_si256()
+#define VEC_OR(a, b) _mm256_or_si256((a), (b))
+#define VEC_EQ(a, b) _mm256_cmpeq_epi8((a), (b))
+#define VEC_SUB(a, b) _mm256_sub_epi8((a), (b))
+#define VEC_MAXU(a, b) _mm256_max_epu8((a), (b))
+#define VEC_MASK(v) (uint32_t) _mm256_movemask_epi8(v)
+#define VEC_ALL 0xffffffffu
+
+#elif defined(CC_SSE2)
+
+#define VEC __m128i
+#define VEC_BYTES 16
+#define VEC_LOAD(p) _mm_loadu_si128((const __m128i *)(p))
+#define VEC_SET1(b) _mm_set1_epi8((char)(b))
+#define VEC_ZERO() _mm_setzero_si128()
+#define VEC_OR(a, b) _mm_or_si128((a), (b))
+#define VEC_EQ(a, b) _mm_cmpeq_epi8((a), (b))
+#define VEC_SUB(a, b) _mm_sub_epi8((a), (b))
+#define VEC_MAXU(a, b) _mm_max_epu8((a), (b))
+#define VEC_MASK(v) (uint32_t) _mm_movemask_epi8(v)
+#define VEC_ALL 0xffffu
+
+#endif
+
+size_t jb_cc_span(const jb_cclass_t *cc, const char *src, size_t len) {
+    size_t i = 0;
+
+#ifdef VEC
+    if (cc->simd) {
+        uint32_t flip = cc->inv ? VEC_ALL : 0;
+
+        for (; i + VEC_BYTES <= len; i += VEC_BYTES) {
+            VEC v = VEC_LOAD(src + i);
+            VEC m = VEC_ZERO();
+
+            for (size_t b = 0; b < cc->nbytes; b++) m = VEC_OR(m, VEC_EQ(v, VEC_SET1(cc->bytes[b])));
+
+            // lo <= c <= hi, as an unsigned (c - lo) <= (hi - lo)
+            for (size_t r = 0; r < cc->nranges; r++) {
+                VEC width = VEC_SET1(cc->hi[r] - cc->lo[r]);
+                VEC off = VEC_SUB(v, VEC_SET1(cc->lo[r]));
+                m = VEC_OR(m, VEC_EQ(VEC_MAXU(off, width), width));
+            }
+
+            uint32_t members = VEC_MASK(m) ^ flip;
+            if (members != VEC_ALL) return i + __builtin_ctz(~members);
+        }
+    }
+#endif
+
+    while (i < len && jb_cc_has(cc, src[i])) i++;
+
+    return i;
+}
+
+bool jb_lx_take_while_class(jb_lexer_t *lx, const jb_cclass_t *cc) {
+    size_t n = jb_cc_span(cc, lx->src + lx->pos, lx->len - lx->pos);
+    lx->pos += n;
+
+    return n > 0;
 }
 
 void jb_lx_init_str(jb_lexer_t *lx, const char *src) {
@@ -22,12 +22,20 @@
 // provides utilities for logging messages to stderr. filters messages if their level
 // is lower than the filter provided by the `LOG_FILTER` env var at initialisation
 //
+// each message is formatted into one buffer and written with a single call. if `LOG_ASYNC` is set,
+// messages are instead queued on a lock-free ring and written by a background thread, so logging
+// costs the caller little more than the formatting; messages are dropped (and counted) rather than
+// blocking when the ring is full
+//
 
 #include <jbase.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 // used to map from jb__llevel_t to a coloured string
 static const char *log_level_str[] = {[JB_TRACE] = JB_FG_MAGENTA "TRACE" JB_RESET,
@@ -37,7 +45,136 @@ static const char *log_level_str[] = {[JB_TRACE] = JB_FG_MAGENTA "TRACE" JB_RESE
                                       [JB_ERROR] = JB_FG_RED "ERROR" JB_RESET};
 
 // global loging filter
-static jb_llevel_t filter = JB_INFO;
+jb_llevel_t jb_log_filter = JB_INFO;
+
+#define LOG_MSG_MAX 512
+#define RING_SLOTS 4096  // power of two
+
+typedef struct {
+    atomic_size_t seq;  // slot is free for producer `pos` when seq == pos, full when seq == pos + 1
+    size_t len;
+    char msg[LOG_MSG_MAX];
+} slot_t;
+
+static struct {
+    slot_t *slots;  // RING_SLOTS, allocated when the writer first starts and never freed, as a
+                    // producer may still be pushing as it stops
+    atomic_size_t head;  // next position for producers
+    size_t tail;         // next position for the writer thread
+    atomic_size_t dropped;
+    atomic_bool stop;
+
+    pthread_t thread;
+    atomic_bool running;
+} ring;
+
+// queue a formatted message; never blocks
+static void ring_push(const char *msg, size_t len) {
+    size_t pos = atomic_load_explicit(&ring.head, memory_order_relaxed);
+    slot_t *slot;
+
+    for (;;) {
+        slot = &ring.slots[pos & (RING_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &ring.head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // full; the writer hasn't freed this slot yet
+            atomic_fetch_add_explicit(&ring.dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&ring.head, memory_order_relaxed);
+        }
+    }
+
+    slot->len = JB_MIN(len, LOG_MSG_MAX);
+    memcpy(slot->msg, msg, slot->len);
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+}
+
+// write out every queued message; returns false if there were none
+static bool ring_drain() {
+    char out[1 << 16];
+    size_t len = 0;
+    bool any = false;
+
+    for (;;) {
+        slot_t *slot = &ring.slots[ring.tail & (RING_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+        if (seq != ring.tail + 1) break;
+
+        if (len + slot->len > sizeof(out)) {
+            fwrite(out, 1, len, stderr);
+            len = 0;
+        }
+
+        memcpy(out + len, slot->msg, slot->len);
+        len += slot->len;
+
+        atomic_store_explicit(&slot->seq, ring.tail + RING_SLOTS, memory_order_release);
+        ring.tail++;
+        any = true;
+    }
+
+    fwrite(out, 1, len, stderr);
+
+    size_t dropped = atomic_exchange_explicit(&ring.dropped, 0, memory_order_relaxed);
+    if (dropped) fprintf(stderr, "%s  %zu log messages dropped\n", log_level_str[JB_WARN], dropped);
+
+    return any;
+}
+
+static void *writer_thread(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        bool stop = atomic_load_explicit(&ring.stop, memory_order_acquire);
+
+        if (!ring_drain()) {
+            if (stop) break;
+
+            struct timespec ts = {0, 100000};
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+void jb_log_async_start() {
+    if (atomic_load_explicit(&ring.running, memory_order_acquire)) return;
+
+    if (!ring.slots) ring.slots = malloc(RING_SLOTS * sizeof(slot_t));
+    if (!ring.slots) return;
+
+    for (size_t i = 0; i < RING_SLOTS; i++) atomic_init(&ring.slots[i].seq, i);
+    atomic_init(&ring.head, 0);
+    atomic_init(&ring.dropped, 0);
+    atomic_init(&ring.stop, false);
+    ring.tail = 0;
+
+    if (pthread_create(&ring.thread, NULL, writer_thread, NULL) != 0) return;
+
+    atomic_store_explicit(&ring.running, true, memory_order_release);
+}
+
+void jb_log_async_stop() {
+    if (!atomic_load_explicit(&ring.running, memory_order_acquire)) return;
+
+    // new messages go straight to stderr from here; one already on its way to the ring is
+    // picked up by the last drain
+    atomic_store_explicit(&ring.running, false, memory_order_release);
+    atomic_store_explicit(&ring.stop, true, memory_order_release);
+    pthread_join(ring.thread, NULL);
+
+    ring_drain();
+    fflush(stderr);
+}
 
 void jb_log_init() {
     char *level;
@@ -45,29 +182,82 @@ void jb_log_init() {
     if ((level = getenv("LOG_FILTER"))) {
         // if LOG_FILTER env variable has a value, pasrse it and set the filter accordingly
         if (strcmp(level, "trace") == 0)
-            filter = JB_TRACE;
+            jb_log_filter = JB_TRACE;
         else if (strcmp(level, "debug") == 0)
-            filter = JB_DEBUG;
+            jb_log_filter = JB_DEBUG;
         else if (strcmp(level, "info") == 0)
-            filter = JB_INFO;
+            jb_log_filter = JB_INFO;
         else if (strcmp(level, "warn") == 0)
-            filter = JB_WARN;
+            jb_log_filter = JB_WARN;
         else if (strcmp(level, "error") == 0)
-            filter = JB_ERROR;
+            jb_log_filter = JB_ERROR;
+    }
+
+    if (getenv("LOG_ASYNC")) {
+        jb_log_async_start();
+        atexit(jb_log_async_stop);
     }
 }
 
-// print a line to stderr, offset with a whitespace and an arrow, and printf-formatted string
-static void vlog_line(char *fmt, va_list args) {
-    fprintf(stderr, "      ⤷ ");
-    vfprintf(stderr, fmt, args);
+// send a formatted message to the ring, or straight to stderr
+static void emit(const char *msg, size_t len) {
+    if (atomic_load_explicit(&ring.running, memory_order_acquire))
+        ring_push(msg, len);
+    else
+        fwrite(msg, 1, len, stderr);
+}
+
+// format a message into `buf`, followed by a newline; returns the length it needed
+static size_t vformat(char *buf, size_t size, const char *prefix, char *fmt, va_list args) {
+    int n = snprintf(buf, size, "%s", prefix);
+    size_t len = n < 0 ? 0 : n;
+
+    if (fmt) {
+        n = vsnprintf(buf + JB_MIN(len, size), size - JB_MIN(len, size), fmt, args);
+        if (n > 0) len += n;
+    }
+
+    if (len + 1 < size) {
+        buf[len] = '\n';
+        buf[len + 1] = '\0';
+    } else if (size >= 2) {
+        buf[size - 2] = '\n';
+        buf[size - 1] = '\0';
+    }
+
+    return len + 1;
+}
+
+// format and emit a message, spilling to the heap if it doesn't fit in LOG_MSG_MAX
+static void vlog(const char *prefix, char *fmt, va_list args) {
+    char buf[LOG_MSG_MAX];
+
+    va_list copy;
+    va_copy(copy, args);
+    size_t len = vformat(buf, sizeof(buf), prefix, fmt, args);
+
+    if (len < sizeof(buf) || atomic_load_explicit(&ring.running, memory_order_relaxed)) {
+        emit(buf, JB_MIN(len, sizeof(buf) - 1));
+    } else {
+        char *big = malloc(len + 1);
+
+        if (big) {
+            vformat(big, len + 1, prefix, fmt, copy);
+            emit(big, len);
+            free(big);
+        } else {
+            emit(buf, sizeof(buf) - 1);
+        }
+    }
+
+    va_end(copy);
 }
 
 void jb_log_line(char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
 
-    vlog_line(fmt, args);
+    vlog("      ⤷ ", fmt, args);
 
     va_end(args);
 }
@@ -79,37 +269,28 @@ void jb_log_inner(jb_llevel_t level, const char *filename, uint32_t line, const
     (void)func;
 
     // filter log messages below filter severity
-    if (level < filter) return;
-
-    fprintf(stderr, "%s ", log_level_str[level]);
-
-#ifdef JBASE_LOG_META
-    // print metadata to stderr
-    fprintf(stderr,
-            "" JB_BOLD "[" JB_FG_CYAN_BRIGHT "%s " JB_RESET JB_BOLD
-            "%s:%d]:\t\t" JB_RESET JB_FG_WHITE,
-            func,
-            filename,
-            line);
-
-    fputc('\n', stderr);
-#endif
-
-    fputs(" ", stderr);
+    if (level < jb_log_filter) return;
 
-    // if a format string is provided, then print a line to stderr with printf-formatted message
-    if (fmt) {
-        va_list args;
-        va_start(args, fmt);
+    char prefix[256];
 
 #ifdef JBASE_LOG_META
-        vlog_line(fmt, args);
+    // metadata goes on its own line, and the message on the next
+    snprintf(prefix,
+             sizeof(prefix),
+             "%s " JB_BOLD "[" JB_FG_CYAN_BRIGHT "%s " JB_RESET JB_BOLD "%s:%d]:\t\t" JB_RESET
+             JB_FG_WHITE "\n       ⤷ ",
+             log_level_str[level],
+             func,
+             filename,
+             line);
 #else
-        vfprintf(stderr, fmt, args);
+    snprintf(prefix, sizeof(prefix), "%s  ", log_level_str[level]);
 #endif
 
-        va_end(args);
-    }
+    va_list args;
+    va_start(args, fmt);
 
-    fputc('\n', stderr);
+    vlog(prefix, fmt, args);
+
+    va_end(args);
 }
@@ -0,0 +1,372 @@
+#include <errno.h>
+#include <jbase.h>
+#include <string.h>
+
+//
+// WAV output
+//
+
+#define WAV_HEADER 58 // RIFF, fmt (extended, as non-PCM formats need), fact and data chunk headers
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    put_u16(p, v);
+    put_u16(p + 2, v >> 16);
+}
+
+// header for `nframes` of mono 32-bit float at `srate`
+static void wav_header(uint8_t *h, size_t srate, size_t nframes) {
+    uint32_t data = nframes * sizeof(float);
+
+    memcpy(h, "RIFF", 4);
+    put_u32(h + 4, WAV_HEADER - 8 + data);
+    memcpy(h + 8, "WAVE", 4);
+
+    memcpy(h + 12, "fmt ", 4);
+    put_u32(h + 16, 18);
+    put_u16(h + 20, 3); // WAVE_FORMAT_IEEE_FLOAT
+    put_u16(h + 22, 1); // channels
+    put_u32(h + 24, srate);
+    put_u32(h + 28, srate * sizeof(float));
+    put_u16(h + 32, sizeof(float));
+    put_u16(h + 34, 32);
+    put_u16(h + 36, 0);
+
+    memcpy(h + 38, "fact", 4);
+    put_u32(h + 42, 4);
+    put_u32(h + 46, nframes);
+
+    memcpy(h + 50, "data", 4);
+    put_u32(h + 54, data);
+}
+
+// samples are written as little-endian floats
+static bool wav_write(FILE *f, const float *buf, size_t n) {
+    uint8_t out[4096];
+
+    while (n) {
+        size_t chunk = JB_MIN(n, sizeof(out) / sizeof(float));
+
+        for (size_t i = 0; i < chunk; i++) {
+            uint32_t bits;
+            memcpy(&bits, &buf[i], sizeof(bits));
+            put_u32(out + i * sizeof(float), bits);
+        }
+
+        if (fwrite(out, sizeof(float), chunk, f) != chunk) return false;
+
+        buf += chunk;
+        n -= chunk;
+    }
+
+    return true;
+}
+
+//
+// rendering
+//
+
+jb_res_t jb_offline_render(jb_client_config_t cfg, const jb_offline_t *opts,
+                           jb_offline_stats_t *stats) {
+    if (opts->srate == 0 || opts->block == 0)
+        return JB_ERR(JB_ERR_USER, "offline rendering needs a sample rate and block size");
+
+    size_t nframes = opts->nframes;
+    if (nframes == 0)
+        nframes = (opts->nevents ? opts->events[opts->nevents - 1].frame + 1 : 0) + opts->tail;
+
+    // WAV sizes are 32 bits
+    if (opts->wav && nframes > (UINT32_MAX - WAV_HEADER) / sizeof(float))
+        return JB_ERR(JB_ERR_USER, "%zu frames is too long for a WAV file", nframes);
+
+    FILE *wav = NULL;
+    if (opts->wav) {
+        wav = fopen(opts->wav, "wb");
+        if (!wav) return JB_ERR_LIBC(errno, "failed to open '%s'", opts->wav);
+
+        uint8_t h[WAV_HEADER];
+        wav_header(h, opts->srate, nframes);
+
+        if (fwrite(h, 1, sizeof(h), wav) != sizeof(h)) {
+            fclose(wav);
+            return JB_ERR_LIBC(errno, "failed to write '%s'", opts->wav);
+        }
+    }
+
+    jb_sample_t *buf = malloc(opts->block * sizeof(jb_sample_t));
+    if (!buf) {
+        if (wav) fclose(wav);
+        return JB_ERR(JB_ERR_OOM, "failed to allocate audio buffer");
+    }
+
+    jb_span_begin("offline_render", opts->wav ? opts->wav : "-");
+
+    jb_ctx_t ctx = {.srate = opts->srate, .period_usecs = opts->block * 1e6f / opts->srate};
+    jb_res_t res = JB_OK_VAL;
+    size_t next = 0;
+    bool is_nan = false;
+
+    uint64_t start = jb_now();
+
+    for (size_t base = 0; base < nframes; base += opts->block) {
+        size_t n = JB_MIN(opts->block, nframes - base);
+
+        if (cfg.events) jb_events_drain(cfg.events, &cfg);
+
+        // events are seen at the start of their block, as through JACK
+        for (; next < opts->nevents && opts->events[next].frame < base + n; next++)
+            if (cfg.midi_cb) cfg.midi_cb(cfg.state, opts->events[next].ev);
+
+        ctx.cur_sample = base;
+        ctx.cur_frames = base;
+        ctx.time = (jb_time_t)base * 1000000 / opts->srate;
+        ctx.next_usecs = (jb_time_t)(base + n) * 1000000 / opts->srate;
+
+        if (cfg.audio_cb)
+            cfg.audio_cb(cfg.state, ctx, n, buf);
+        else
+            memset(buf, 0, n * sizeof(jb_sample_t));
+
+        for (size_t i = 0; i < n; i++)
+            if (buf[i] != buf[i]) is_nan = true;
+
+        if (wav && !wav_write(wav, buf, n)) {
+            res = JB_ERR_LIBC(errno, "failed to write '%s'", opts->wav);
+            break;
+        }
+    }
+
+    if (wav && fclose(wav) != 0 && res JB_IS_OK)
+        res = JB_ERR_LIBC(errno, "failed to write '%s'", opts->wav);
+
+    uint64_t wall = jb_now() - start;
+
+    jb_span_end();
+    free(buf);
+
+    if (is_nan) jb_warn("NaN samples detected");
+
+    if (stats) {
+        stats->frames = nframes;
+        stats->wall_ns = wall;
+        stats->speed = wall ? ((double)nframes / opts->srate) / (wall / 1e9) : 0;
+    }
+
+    return res;
+}
+
+//
+// standard MIDI files
+//
+
+typedef struct {
+    const uint8_t *p, *end;
+} reader_t;
+
+// an event before its time is worked out
+typedef struct {
+    uint64_t tick;
+    uint32_t track, seq; // keeps simultaneous events in file order
+    uint32_t tempo;      // microseconds per quarter note, for tempo changes; 0 otherwise
+    jb_midi_t ev;
+} raw_event_t;
+
+#define MIDI_CORRUPT(path) JB_ERR(JB_ERR_PARSER, "'%s': corrupt MIDI file", (path))
+
+#define MIDI_TEMPO 500000 // 120bpm, until the file says otherwise
+
+static bool get_bytes(reader_t *r, size_t n, const uint8_t **out) {
+    if ((size_t)(r->end - r->p) < n) return false;
+
+    *out = r->p;
+    r->p += n;
+    return true;
+}
+
+static uint32_t be(const uint8_t *p, size_t n) {
+    uint32_t v = 0;
+    for (size_t i = 0; i < n; i++) v = v << 8 | p[i];
+
+    return v;
+}
+
+// MIDI's varints are big-endian, and at most 4 bytes
+static bool get_varlen(reader_t *r, uint32_t *out) {
+    uint32_t v = 0;
+
+    for (size_t i = 0; i < 4; i++) {
+        if (r->p == r->end) return false;
+
+        uint8_t b = *r->p++;
+        v = v << 7 | (b & 0x7f);
+
+        if (!(b & 0x80)) {
+            *out = v;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool read_track(reader_t *r, uint32_t track, raw_event_t **events) {
+    uint64_t tick = 0;
+    uint8_t status = 0;
+
+    for (uint32_t seq = 0; r->p < r->end; seq++) {
+        uint32_t delta;
+        const uint8_t *b;
+        if (!get_varlen(r, &delta) || !get_bytes(r, 1, &b)) return false;
+
+        tick += delta;
+        raw_event_t raw = {.tick = tick, .track = track, .seq = seq};
+
+        if (*b == 0xff) {
+            // meta event; only tempo changes matter here
+            const uint8_t *type, *data;
+            uint32_t len;
+            if (!get_bytes(r, 1, &type) || !get_varlen(r, &len) || !get_bytes(r, len, &data))
+                return false;
+
+            if (*type == 0x2f) break; // end of track
+
+            if (*type == 0x51 && len == 3) {
+                raw.tempo = be(data, 3);
+                jb_buf_push(*events, raw);
+            }
+
+            continue;
+        }
+
+        if (*b == 0xf0 || *b == 0xf7) {
+            uint32_t len;
+            const uint8_t *data;
+            if (!get_varlen(r, &len) || !get_bytes(r, len, &data)) return false;
+
+            status = 0;
+            continue;
+        }
+
+        // running status reuses the last status byte
+        if (*b & 0x80) {
+            status = *b;
+        } else {
+            if (!status) return false;
+            r->p--;
+        }
+
+        uint8_t kind = status & 0xf0;
+        size_t nargs = kind == 0xc0 || kind == 0xd0 ? 1 : 2;
+
+        const uint8_t *args;
+        if (!get_bytes(r, nargs, &args)) return false;
+
+        if (kind == JB_NOTE_ON || kind == JB_NOTE_OFF || kind == JB_CTRL) {
+            raw.ev = (jb_midi_t){.kind = kind, .chan = status & 0x0f, .args = {args[0], args[1]}};
+            jb_buf_push(*events, raw);
+        }
+    }
+
+    return true;
+}
+
+static int cmp_raw(const void *a, const void *b) {
+    const raw_event_t *x = a, *y = b;
+
+    if (x->tick != y->tick) return x->tick < y->tick ? -1 : 1;
+    if (x->track != y->track) return x->track < y->track ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+jb_res_t jb_midi_file_load(const char *path, size_t srate, jb_midi_event_t **events) {
+    uint8_t *data;
+    size_t len;
+
+    JB_TRY_IO(jb_load_file(path, &data, &len), "failed to read MIDI file '%s'", path);
+
+    reader_t r = {data, data + len};
+    raw_event_t *raw = JB_BUF;
+    jb_res_t res = JB_OK_VAL;
+
+    const uint8_t *hdr;
+    if (!get_bytes(&r, 14, &hdr) || memcmp(hdr, "MThd", 4) != 0 || be(hdr + 4, 4) < 6) {
+        res = JB_ERR(JB_ERR_PARSER, "'%s': not a MIDI file", path);
+        goto done;
+    }
+
+    // skip any extra header the format grows in future
+    const uint8_t *extra;
+    if (!get_bytes(&r, be(hdr + 4, 4) - 6, &extra)) {
+        res = MIDI_CORRUPT(path);
+        goto done;
+    }
+
+    uint32_t format = be(hdr + 8, 2), ntracks = be(hdr + 10, 2), division = be(hdr + 12, 2);
+    if (format > 1) {
+        res = JB_ERR(JB_ERR_PARSER, "'%s': MIDI format %u isn't supported", path, format);
+        goto done;
+    }
+
+    if (division == 0 || division == 0x8000 || (division & 0x80ff) == 0x8000) {
+        res = MIDI_CORRUPT(path);
+        goto done;
+    }
+
+    for (uint32_t t = 0; t < ntracks; t++) {
+        const uint8_t *chunk, *body;
+        if (!get_bytes(&r, 8, &chunk)) break;
+
+        uint32_t chunk_len = be(chunk + 4, 4);
+        if (!get_bytes(&r, chunk_len, &body)) {
+            res = MIDI_CORRUPT(path);
+            goto done;
+        }
+
+        // unknown chunks are skipped, as the spec asks
+        if (memcmp(chunk, "MTrk", 4) != 0) {
+            t--;
+            continue;
+        }
+
+        reader_t track = {body, body + chunk_len};
+        if (!read_track(&track, t, &raw)) {
+            res = MIDI_CORRUPT(path);
+            goto done;
+        }
+    }
+
+    qsort(raw, jb_buf_len(raw), sizeof(raw_event_t), cmp_raw);
+
+    // ticks are quarter-note divisions at the current tempo, or fixed SMPTE frame divisions
+    bool smpte = division & 0x8000;
+    double smpte_tick = smpte ? 1e6 / (-(int8_t)(division >> 8) * (double)(division & 0xff)) : 0;
+
+    uint32_t tempo = MIDI_TEMPO;
+    uint64_t last_tick = 0;
+    double usecs = 0;
+
+    *events = JB_BUF;
+
+    for (size_t i = 0; i < jb_buf_len(raw); i++) {
+        usecs += (raw[i].tick - last_tick) * (smpte ? smpte_tick : (double)tempo / division);
+        last_tick = raw[i].tick;
+
+        if (raw[i].tempo) {
+            tempo = raw[i].tempo;
+            continue;
+        }
+
+        jb_midi_event_t ev = {.frame = (size_t)(usecs * srate / 1e6), .ev = raw[i].ev};
+        jb_buf_push(*events, ev);
+    }
+
+done:
+    jb_buf_free(raw);
+    free(data);
+
+    return res;
+}
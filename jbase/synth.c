@@ -1,5 +1,7 @@
 #include <jbase.h>
 #include <math.h>
+#include <pthread.h>
+#include <string.h>
 
 float jb_cents_hz(jb_cents_t cents) {
     return powf(2, (float)(cents - JB_A4_MIDI) / JB_SEMIS(12.)) * JB_A4_HZ;
@@ -43,11 +45,9 @@ float jb_wave_triangle(float x, float bias) {
 }
 
 float jb_wave_saw(float x, float bias) {
-    (void)bias;
+    float s = 2 * (fmod(x / (2 * M_PI), 1) - 0.5);
 
-    float s = 2 * (fmod(x, 1) - 0.5);
-
-    return fold(s, bias);
+    return fold(s, 1.0 - bias);
 }
 
 float jb_wave_noise(float x, float bias) {
@@ -61,6 +61,447 @@ float jb_osc_sample(jb_osc_t *osc, jb_cents_t note, size_t idx, size_t srate) {
     return osc->fn(step * phase, osc->bias) * osc->amp;
 }
 
+// `p` wrapped into [0, 1). a tiny negative phase wraps to exactly 1 once rounded, so that's
+// folded back to 0
+static inline float wrap_phase(float p) {
+    p -= (float)(int32_t)p;
+    if (p < 0) p += 1;
+
+    return p >= 1 ? 0 : p;
+}
+
+// phase of each frame of a block, in cycles, starting at `phase` and advancing `inc` per frame. each
+// frame's phase is computed from the block's start rather than accumulated, so the loop vectorises
+static float render_phase(float phase, float inc, size_t nframes, float *out) {
+    for (size_t i = 0; i < nframes; i++) {
+        float p = phase + (float)i * inc;
+        out[i] = p - (float)(int32_t)p;
+    }
+
+    float end = phase + (float)nframes * inc;
+    return end - (float)(int32_t)end;
+}
+
+//
+// wavetables
+//
+// each shape is summed from its harmonics into a table per octave, the first with every harmonic
+// that fits in the table and each after with half as many as the one before. a block is rendered
+// from the fullest table whose harmonics all stay under Nyquist at the block's frequency, so
+// nothing aliases. tables carry a guard point before and three after, so interpolation never wraps,
+// even from a phase that has rounded up to a whole cycle
+//
+
+#define WT_SIZE 2048
+#define WT_LEVELS 11 // WT_SIZE / 2 harmonics down to 1
+
+typedef enum { SHAPE_SIN, SHAPE_TRIANGLE, SHAPE_SAW, SHAPE_MAX } shape_t;
+
+static float tables[SHAPE_MAX][WT_LEVELS][WT_SIZE + 4];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+// amplitude of harmonic `k`, matching the shapes of `jb_wave_triangle` and `jb_wave_saw`
+static double harmonic(shape_t shape, size_t k) {
+    switch (shape) {
+        case SHAPE_SIN:
+            return k == 1;
+        case SHAPE_TRIANGLE:
+            // asin(sin(x)) peaks at pi/2
+            return k % 2 ? (k % 4 == 1 ? 4 : -4) / (M_PI * k * k) : 0;
+        case SHAPE_SAW:
+            return -2 / (M_PI * k);
+        default:
+            return 0;
+    }
+}
+
+static void tables_init() {
+    static double acc[WT_SIZE], sines[WT_SIZE];
+
+    for (size_t i = 0; i < WT_SIZE; i++) sines[i] = sin(2 * M_PI * (double)i / WT_SIZE);
+
+    for (shape_t shape = 0; shape < SHAPE_MAX; shape++) {
+        memset(acc, 0, sizeof(acc));
+        size_t done = 0;
+
+        // from the sparsest table up, adding the harmonics each level has over the one above
+        for (int level = WT_LEVELS - 1; level >= 0; level--) {
+            size_t harmonics = (WT_SIZE / 2) >> level;
+
+            for (size_t k = done + 1; k <= harmonics; k++) {
+                double a = harmonic(shape, k);
+                if (a == 0) continue;
+
+                for (size_t i = 0; i < WT_SIZE; i++) acc[i] += a * sines[(k * i) % WT_SIZE];
+            }
+
+            done = harmonics;
+
+            float *t = tables[shape][level];
+            for (size_t i = 0; i < WT_SIZE; i++) t[i + 1] = acc[i];
+
+            t[0] = t[WT_SIZE];
+            t[WT_SIZE + 1] = t[1];
+            t[WT_SIZE + 2] = t[2];
+            t[WT_SIZE + 3] = t[3];
+        }
+    }
+}
+
+void jb_synth_init() {
+    pthread_once(&tables_once, tables_init);
+}
+
+// the table of `shape` to render at `inc` cycles per frame; indexable from -1 to WT_SIZE + 2
+static const float *table_for(shape_t shape, float inc) {
+    float max_harmonics = 0.5f / inc;
+
+    int level = 0;
+    while (level < WT_LEVELS - 1 && (float)((WT_SIZE / 2) >> level) > max_harmonics) level++;
+
+    return tables[shape][level] + 1;
+}
+
+static inline float lookup_linear(const float *t, float phase) {
+    float x = phase * WT_SIZE;
+    int32_t i = (int32_t)x;
+    float f = x - (float)i;
+
+    return t[i] + f * (t[i + 1] - t[i]);
+}
+
+// Catmull-Rom through the two points either side
+static inline float lookup_cubic(const float *t, float phase) {
+    float x = phase * WT_SIZE;
+    int32_t i = (int32_t)x;
+    float f = x - (float)i;
+
+    float a = t[i - 1], b = t[i], c = t[i + 1], d = t[i + 2];
+
+    return b + 0.5f * f * (c - a + f * (2 * a - 5 * b + 4 * c - d + f * (3 * (b - c) + d - a)));
+}
+
+// replace each phase in `buf` with the table's value there
+static void render_table(const float *t, jb_interp_t interp, size_t nframes, float *buf) {
+    if (interp == JB_INTERP_CUBIC)
+        for (size_t i = 0; i < nframes; i++) buf[i] = lookup_cubic(t, buf[i]);
+    else
+        for (size_t i = 0; i < nframes; i++) buf[i] = lookup_linear(t, buf[i]);
+}
+
+// a pulse is the difference of two saws, one shifted by the pulse's width. the width and offset
+// follow `jb_wave_square`, which is high while sin(x) > bias
+static void render_pulse(const float *saw, jb_interp_t interp, float bias, size_t nframes,
+                         float *buf) {
+    float b = fmaxf(-1.f, fminf(1.f, bias));
+    float width = 0.5f - asinf(b) / (float)M_PI;
+
+    // shift the saws so the pulse is high from asin(bias) onwards
+    float offset = 1.f - width - asinf(b) / (float)(2 * M_PI);
+    offset = wrap_phase(offset);
+
+    for (size_t i = 0; i < nframes; i++) {
+        float p = wrap_phase(buf[i] + offset);
+        float q = wrap_phase(p + width);
+
+        float s = interp == JB_INTERP_CUBIC ? lookup_cubic(saw, p) - lookup_cubic(saw, q)
+                                            : lookup_linear(saw, p) - lookup_linear(saw, q);
+        buf[i] = s + 2 * width - 1;
+    }
+}
+
+// replace the phases in `buf` with an oscillator's wave (before its amplitude), playing at `inc`
+// cycles per frame
+static void render_shape(const jb_osc_t *osc, float inc, size_t nframes, float *buf) {
+    float bias = osc->bias;
+
+    jb_synth_init();
+
+    // table-backed shapes; folding is applied on top, as it was to the functions
+    if (osc->fn == jb_wave_sin || osc->fn == jb_wave_saw) {
+        shape_t shape = osc->fn == jb_wave_sin ? SHAPE_SIN : SHAPE_SAW;
+        render_table(table_for(shape, inc), osc->interp, nframes, buf);
+
+        if (bias != 0)
+            for (size_t i = 0; i < nframes; i++) buf[i] = fold(buf[i], 1.0 - bias);
+    } else if (osc->fn == jb_wave_square) {
+        render_pulse(table_for(SHAPE_SAW, inc), osc->interp, bias, nframes, buf);
+    } else if (osc->fn == jb_wave_triangle && bias == 0) {
+        render_table(table_for(SHAPE_TRIANGLE, inc), osc->interp, nframes, buf);
+    } else {
+        for (size_t i = 0; i < nframes; i++) buf[i] = osc->fn(buf[i] * (float)(2 * M_PI), bias);
+    }
+}
+
+// scale a block by the oscillator's amplitude (and an amplitude modulator, if any). a change in
+// amplitude since the last block is ramped across this one, so stepping it doesn't click
+static void apply_amp(const jb_osc_t *osc, jb_osc_state_t *state, size_t nframes, const float *am,
+                      float *buf) {
+    float from = state->amp, step = (osc->amp - from) / nframes;
+
+    if (am)
+        for (size_t i = 0; i < nframes; i++) buf[i] *= (from + step * (float)(i + 1)) * am[i];
+    else
+        for (size_t i = 0; i < nframes; i++) buf[i] *= from + step * (float)(i + 1);
+
+    state->amp = osc->amp;
+}
+
+void jb_osc_render(jb_osc_t *osc, jb_osc_state_t *state, jb_cents_t note, size_t srate,
+                   size_t nframes, float *out) {
+    float inc = jb_cents_hz(note + osc->detune) / srate;
+    state->phase = render_phase(state->phase, inc, nframes, out);
+    render_shape(osc, inc, nframes, out);
+
+    apply_amp(osc, state, nframes, NULL, out);
+}
+
+//
+// patches
+//
+// compiling a patch orders the oscillators feeding its output so each comes after everything
+// modulating it, gives each a scratch buffer, and emits a flat list of block operations: combining
+// the modulators of each kind where there's more than one, then rendering the oscillator
+//
+
+void jb_patch_init(jb_patch_t *patch) {
+    *patch = (jb_patch_t){
+        .nodes = JB_BUF,
+        .edges = JB_BUF,
+        .out = 0,
+        .ops = JB_BUF,
+        .out_buf = 0,
+        .nbufs = 0,
+    };
+}
+
+uint32_t jb_patch_add(jb_patch_t *patch, jb_osc_t *osc) {
+    jb_buf_push(patch->nodes, osc);
+    return jb_buf_len(patch->nodes) - 1;
+}
+
+void jb_patch_connect(jb_patch_t *patch, uint32_t from, uint32_t to, jb_mod_t mod) {
+    jb_patch_edge_t edge = {.from = from, .to = to, .mod = mod};
+    jb_buf_push(patch->edges, edge);
+}
+
+static void emit_op(jb_patch_t *patch, jb_patch_op_t op) {
+    jb_buf_push(patch->ops, op);
+}
+
+jb_res_t jb_patch_compile(jb_patch_t *patch) {
+    size_t nnodes = jb_buf_len(patch->nodes), nedges = jb_buf_len(patch->edges);
+    if (patch->out >= nnodes) return JB_ERR(JB_ERR_USER, "patch output %u out of range", patch->out);
+
+    for (size_t e = 0; e < nedges; e++) {
+        jb_patch_edge_t edge = patch->edges[e];
+        if (edge.from >= nnodes || edge.to >= nnodes || edge.mod >= JB_MOD_MAX)
+            return JB_ERR(JB_ERR_USER, "bad patch connection %zu", e);
+    }
+
+    jb_buf_truncate(patch->ops, 0);
+
+    // per node: whether it feeds the output, modulators not yet ordered, and its buffer
+    bool *live = calloc(nnodes, sizeof(bool));
+    uint32_t *waiting = calloc(nnodes, sizeof(uint32_t));
+    uint32_t *buf = calloc(nnodes, sizeof(uint32_t));
+    uint32_t *order = JB_BUF;
+
+    jb_res_t res = JB_OK_VAL;
+    if (!live || !waiting || !buf) {
+        res = JB_ERR(JB_ERR_OOM, "failed to compile patch");
+        goto done;
+    }
+
+    // walk back from the output to find the oscillators it depends on
+    live[patch->out] = true;
+    for (bool changed = true; changed;) {
+        changed = false;
+
+        for (size_t e = 0; e < nedges; e++) {
+            jb_patch_edge_t edge = patch->edges[e];
+
+            if (live[edge.to] && !live[edge.from]) {
+                live[edge.from] = true;
+                changed = true;
+            }
+        }
+    }
+
+    size_t nlive = 0;
+    for (size_t n = 0; n < nnodes; n++) nlive += live[n];
+
+    for (size_t e = 0; e < nedges; e++)
+        if (live[patch->edges[e].to]) waiting[patch->edges[e].to]++;
+
+    // an oscillator is ready once everything modulating it is
+    for (uint32_t n = 0; n < nnodes; n++)
+        if (live[n] && !waiting[n]) jb_buf_push(order, n);
+
+    for (size_t i = 0; i < jb_buf_len(order); i++) {
+        for (size_t e = 0; e < nedges; e++) {
+            jb_patch_edge_t edge = patch->edges[e];
+            if (edge.from == order[i] && live[edge.to] && --waiting[edge.to] == 0)
+                jb_buf_push(order, edge.to);
+        }
+    }
+
+    if (jb_buf_len(order) != nlive) {
+        res = JB_ERR(JB_ERR_USER, "patch has a modulation cycle");
+        goto done;
+    }
+
+    uint32_t nbufs = 0;
+
+    for (size_t i = 0; i < nlive; i++) {
+        uint32_t n = order[i];
+        jb_patch_op_t render = {.kind = JB_PATCH_RENDER, .node = n};
+
+        for (jb_mod_t mod = 0; mod < JB_MOD_MAX; mod++) {
+            size_t count = 0;
+            uint32_t first = 0, acc = 0;
+
+            for (size_t e = 0; e < nedges; e++) {
+                jb_patch_edge_t edge = patch->edges[e];
+                if (edge.to != n || edge.mod != mod) continue;
+
+                if (count == 0) {
+                    first = buf[edge.from];
+                } else {
+                    // more than one modulator of a kind are combined in a buffer of their own;
+                    // amplitude modulators multiply, the others add
+                    if (count == 1) {
+                        acc = nbufs++;
+                        emit_op(patch, (jb_patch_op_t){.kind = JB_PATCH_COPY, .dst = acc, .src = first});
+                    }
+
+                    jb_patch_op_t op = {
+                        .kind = mod == JB_MOD_AM ? JB_PATCH_MUL : JB_PATCH_ADD,
+                        .dst = acc,
+                        .src = buf[edge.from],
+                    };
+                    emit_op(patch, op);
+                }
+
+                count++;
+            }
+
+            render.in[mod] = count == 0 ? -1 : count == 1 ? (int32_t)first : (int32_t)acc;
+        }
+
+        render.dst = buf[n] = nbufs++;
+        emit_op(patch, render);
+    }
+
+    patch->out_buf = buf[patch->out];
+    patch->nbufs = nbufs;
+
+done:
+    free(live);
+    free(waiting);
+    free(buf);
+    jb_buf_free(order);
+
+    return res;
+}
+
+jb_res_t jb_patch_from_chain(jb_patch_t *patch, jb_osc_link_t *chain) {
+    jb_patch_init(patch);
+
+    // each link is modulated by the next, as with `jb_chain_sample`
+    for (jb_osc_link_t *link = chain; link; link = link->next) {
+        uint32_t n = jb_patch_add(patch, link->osc);
+        if (link->next) jb_patch_connect(patch, n + 1, n, link->mod);
+    }
+
+    jb_res_t res = jb_patch_compile(patch);
+    if (res JB_IS_ERR) jb_patch_free(patch);
+
+    return res;
+}
+
+void jb_patch_free(jb_patch_t *patch) {
+    jb_buf_free(patch->nodes);
+    jb_buf_free(patch->edges);
+    jb_buf_free(patch->ops);
+}
+
+// render one oscillator of a patch, given the buffers modulating it (or NULL)
+static void render_node(const jb_osc_t *osc, jb_osc_state_t *state, float inc, size_t nframes,
+                        const float *in[JB_MOD_MAX], float *buf) {
+    const float *am = in[JB_MOD_AM], *fm = in[JB_MOD_FM], *pm = in[JB_MOD_PM], *bm = in[JB_MOD_BM];
+
+    if (fm) {
+        // frequency scales with 1 + the modulator, so the phase has to be accumulated
+        float p = state->phase;
+
+        for (size_t i = 0; i < nframes; i++) {
+            buf[i] = p;
+            p += inc * (1 + fm[i]);
+            p = wrap_phase(p);
+        }
+
+        state->phase = p;
+    } else {
+        state->phase = render_phase(state->phase, inc, nframes, buf);
+    }
+
+    // phase modulation is in radians, as with `jb_chain_sample`
+    if (pm) {
+        for (size_t i = 0; i < nframes; i++) {
+            float p = buf[i] + pm[i] * (float)(1 / (2 * M_PI));
+            buf[i] = wrap_phase(p);
+        }
+    }
+
+    // a bias changing every frame rules out the tables
+    if (bm) {
+        for (size_t i = 0; i < nframes; i++)
+            buf[i] = osc->fn(buf[i] * (float)(2 * M_PI), (bm[i] + 1) / 2 - 0.0005f);
+    } else {
+        render_shape(osc, inc, nframes, buf);
+    }
+
+    apply_amp(osc, state, nframes, am, buf);
+}
+
+void jb_patch_render(const jb_patch_t *patch, jb_osc_state_t *states, jb_cents_t note,
+                     size_t srate, size_t nframes, float *scratch, float *out) {
+    for (size_t base = 0; base < nframes; base += JB_SYNTH_BLOCK) {
+        size_t n = JB_MIN(JB_SYNTH_BLOCK, nframes - base);
+
+        for (size_t i = 0; i < jb_buf_len(patch->ops); i++) {
+            const jb_patch_op_t *op = &patch->ops[i];
+            float *dst = scratch + op->dst * JB_SYNTH_BLOCK;
+            const float *src = scratch + op->src * JB_SYNTH_BLOCK;
+
+            switch (op->kind) {
+                case JB_PATCH_COPY:
+                    memcpy(dst, src, n * sizeof(float));
+                    break;
+                case JB_PATCH_ADD:
+                    for (size_t j = 0; j < n; j++) dst[j] += src[j];
+                    break;
+                case JB_PATCH_MUL:
+                    for (size_t j = 0; j < n; j++) dst[j] *= src[j];
+                    break;
+                case JB_PATCH_RENDER: {
+                    const jb_osc_t *osc = patch->nodes[op->node];
+                    float inc = jb_cents_hz(note + osc->detune) / srate;
+
+                    const float *in[JB_MOD_MAX];
+                    for (size_t m = 0; m < JB_MOD_MAX; m++)
+                        in[m] = op->in[m] == -1 ? NULL : scratch + op->in[m] * JB_SYNTH_BLOCK;
+
+                    render_node(osc, &states[op->node], inc, n, in, dst);
+                } break;
+            }
+        }
+
+        memcpy(out + base, scratch + patch->out_buf * JB_SYNTH_BLOCK, n * sizeof(float));
+    }
+}
+
 float jb_chain_sample(jb_osc_link_t *link, jb_cents_t note, size_t idx, size_t srate) {
     if (!link->next) return jb_osc_sample(link->osc, note, idx, srate);
 
@@ -0,0 +1,172 @@
+/*
+ * jbase - C utility library
+ * Copyright (C) 2024  Jacob Sinclair <jcbsnclr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//
+// trace.c: span tracing
+//
+// each thread appends begin/end events to its own buffer, so recording takes no locks; buffers
+// are only linked into the global list (under a mutex) the first time a thread records a span
+//
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <jbase.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    uint64_t ts;
+    const char *name;
+    const char *detail;
+    char ph;  // 'B'egin or 'E'nd
+} event_t;
+
+typedef struct thread_buf {
+    struct thread_buf *next;
+    pid_t tid;
+    event_t *events;    // jb_buf
+    jb_arena_t details; // copies of span details
+} thread_buf_t;
+
+bool jb_span_enabled = false;
+
+static char *out_path;
+static uint64_t epoch;
+static thread_buf_t *threads;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+JB_TLOCAL static thread_buf_t *local;
+
+void jb_span_init(const char *path) {
+    out_path = strdup(path);
+    epoch = jb_now();
+    jb_span_enabled = out_path != NULL;
+}
+
+static thread_buf_t *thread_buf() {
+    if (local) return local;
+
+    local = calloc(1, sizeof(thread_buf_t));
+    if (!local) return NULL;
+
+    local->tid = gettid();
+    local->events = JB_BUF;
+    jb_arena_init(&local->details, 1 << 16);
+
+    pthread_mutex_lock(&threads_lock);
+    local->next = threads;
+    threads = local;
+    pthread_mutex_unlock(&threads_lock);
+
+    return local;
+}
+
+void jb_span_begin_(const char *name, const char *detail) {
+    thread_buf_t *tb = thread_buf();
+    if (!tb) return;
+
+    event_t ev = {jb_now(), name, NULL, 'B'};
+
+    if (detail) {
+        size_t len = strlen(detail) + 1;
+        char *copy = jb_arena_alloc(&tb->details, len);
+
+        if (copy) ev.detail = memcpy(copy, detail, len);
+    }
+
+    jb_buf_push(tb->events, ev);
+}
+
+void jb_span_end_() {
+    thread_buf_t *tb = thread_buf();
+    if (!tb) return;
+
+    event_t ev = {jb_now(), NULL, NULL, 'E'};
+    jb_buf_push(tb->events, ev);
+}
+
+// write `str` as a JSON string literal
+static void write_str(FILE *f, const char *str) {
+    fputc('"', f);
+
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+        if (*p == '"' || *p == '\\')
+            fprintf(f, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(f, "\\u%04x", *p);
+        else
+            fputc(*p, f);
+    }
+
+    fputc('"', f);
+}
+
+jb_errno_t jb_span_dump() {
+    if (!jb_span_enabled) return 0;
+
+    FILE *f = fopen(out_path, "w");
+    if (!f) return errno;
+
+    pid_t pid = getpid();
+    bool first = true;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    pthread_mutex_lock(&threads_lock);
+
+    for (thread_buf_t *tb = threads; tb; tb = tb->next) {
+        for (size_t i = 0; i < jb_buf_len(tb->events); i++) {
+            event_t *ev = &tb->events[i];
+            uint64_t ns = ev->ts - epoch;
+
+            fprintf(f,
+                    "%s\n{\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":%lu.%03lu",
+                    first ? "" : ",",
+                    ev->ph,
+                    pid,
+                    tb->tid,
+                    ns / 1000,
+                    ns % 1000);
+
+            if (ev->name) {
+                fprintf(f, ",\"name\":");
+                write_str(f, ev->name);
+            }
+
+            if (ev->detail) {
+                fprintf(f, ",\"args\":{\"detail\":");
+                write_str(f, ev->detail);
+                fputc('}', f);
+            }
+
+            fputc('}', f);
+            first = false;
+        }
+    }
+
+    pthread_mutex_unlock(&threads_lock);
+
+    fprintf(f, "\n]}\n");
+
+    if (fclose(f) == EOF) return errno;
+
+    return 0;
+}
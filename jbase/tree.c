@@ -0,0 +1,363 @@
+/*
+ * jbase - C utility library
+ * Copyright (C) 2024  Jacob Sinclair <jcbsnclr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//
+// tree.c: saved syntax trees
+//
+// a header, then a string table holding each distinct string once, then the nodes in preorder.
+// the table is the offset of each string in the text that follows it, plus the end of the text, so
+// strings are numbered in order of first use and the common ones get short indices. every node
+// starts with its kind, followed by its span as the (zigzag) difference between its start and that
+// of the node before it, and its length. strings are an index into the table, integers are zigzag
+// encoded, and blocks are a count of commands, each a span, a count of values and the values
+// themselves. all numbers in nodes are LEB128 varints
+//
+
+#include <errno.h>
+#include <jbase.h>
+#include <string.h>
+
+#define TREE_MAGIC 0x54414a42 // "JBAT"
+#define TREE_VERSION 1
+
+// deepest nesting of blocks a saved tree may have
+#define TREE_DEPTH_MAX 4096
+
+typedef struct {
+    uint32_t magic, version;
+    uint32_t nstrs, pad;
+    uint64_t text, nodes; // size of the string text and the nodes, in bytes
+} tree_hdr_t;
+
+//
+// saving
+//
+
+typedef struct {
+    uint8_t *nodes;  // jb_buf
+    char *strs;      // jb_buf
+    jb_sym_t *syms;  // jb_buf, each distinct string
+    uint32_t *table; // open-addressed string indices plus one, 0 for empty
+    size_t table_cap;
+    size_t prev;     // start of the last node written
+} writer_t;
+
+static void put_varint(writer_t *w, uint64_t v) {
+    uint8_t bytes[10];
+    size_t n = 0;
+
+    do {
+        bytes[n++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+        v >>= 7;
+    } while (v);
+
+    jb_buf_append(w->nodes, bytes, n);
+}
+
+static uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+// spans wrap around, as the start of an empty command is SIZE_MAX
+static void put_span(writer_t *w, size_t start, size_t end) {
+    put_varint(w, zigzag((int64_t)(start - w->prev)));
+    put_varint(w, zigzag((int64_t)(end - start)));
+    w->prev = start;
+}
+
+static void table_insert(writer_t *w, uint32_t idx) {
+    jb_sym_t *s = &w->syms[idx];
+    size_t mask = w->table_cap - 1;
+    size_t i = jb_hash(w->strs + s->off, s->len) & mask;
+
+    while (w->table[i]) i = (i + 1) & mask;
+    w->table[i] = idx + 1;
+}
+
+static jb_errno_t put_str(writer_t *w, jb_view_t str) {
+    size_t mask = w->table_cap - 1;
+
+    for (size_t i = jb_hash(str.ptr, str.len) & mask; w->table[i]; i = (i + 1) & mask) {
+        jb_sym_t *s = &w->syms[w->table[i] - 1];
+
+        if (s->len == str.len && memcmp(w->strs + s->off, str.ptr, str.len) == 0) {
+            put_varint(w, w->table[i] - 1);
+            return 0;
+        }
+    }
+
+    if (jb_buf_len(w->strs) + str.len >= UINT32_MAX || jb_buf_len(w->syms) >= UINT32_MAX - 1)
+        return EOVERFLOW;
+
+    jb_sym_t sym = {.off = jb_buf_len(w->strs), .len = str.len};
+    jb_buf_append(w->strs, str.ptr, str.len);
+    jb_buf_push(w->syms, sym);
+
+    // keep the table at most half full
+    if (jb_buf_len(w->syms) * 2 > w->table_cap) {
+        free(w->table);
+        w->table_cap *= 2;
+        w->table = calloc(w->table_cap, sizeof(uint32_t));
+        if (!w->table) return ENOMEM;
+
+        for (uint32_t i = 0; i < jb_buf_len(w->syms); i++) table_insert(w, i);
+    } else {
+        table_insert(w, jb_buf_len(w->syms) - 1);
+    }
+
+    put_varint(w, jb_buf_len(w->syms) - 1);
+    return 0;
+}
+
+static jb_errno_t put_val(writer_t *w, const jb_val_t *val) {
+    jb_buf_push(w->nodes, (uint8_t)val->kind);
+    put_span(w, val->start, val->end);
+
+    switch (val->kind) {
+        case JB_VAL_STR:
+        case JB_VAL_REF:
+            return put_str(w, val->str_val);
+
+        case JB_VAL_INT:
+            put_varint(w, zigzag(val->int_val));
+            return 0;
+
+        case JB_VAL_QUOTE:
+        case JB_VAL_INLINE:
+            put_varint(w, jb_buf_len(val->body));
+
+            for (size_t i = 0; i < jb_buf_len(val->body); i++) {
+                jb_cmd_t *cmd = &val->body[i];
+
+                put_span(w, cmd->start, cmd->end);
+                put_varint(w, jb_buf_len(cmd->body));
+
+                for (size_t j = 0; j < jb_buf_len(cmd->body); j++) {
+                    jb_errno_t err = put_val(w, &cmd->body[j]);
+                    if (err) return err;
+                }
+            }
+
+            return 0;
+    }
+
+    return EINVAL;
+}
+
+jb_errno_t jb_tree_save(const jb_val_t *tree, jb_io_buf_t *buf) {
+    writer_t w = {
+        .nodes = JB_BUF,
+        .strs = JB_BUF,
+        .syms = JB_BUF,
+        .table_cap = 64,
+        .prev = 0,
+    };
+
+    w.table = calloc(w.table_cap, sizeof(uint32_t));
+    jb_errno_t err = w.table ? put_val(&w, tree) : ENOMEM;
+
+    if (!err) {
+        tree_hdr_t hdr = {
+            .magic = TREE_MAGIC,
+            .version = TREE_VERSION,
+            .nstrs = jb_buf_len(w.syms),
+            .pad = 0,
+            .text = jb_buf_len(w.strs),
+            .nodes = jb_buf_len(w.nodes),
+        };
+
+        err = jb_io_buf_write(buf, (uint8_t *)&hdr, sizeof(hdr));
+
+        for (size_t i = 0; i < hdr.nstrs && !err; i++)
+            err = jb_io_buf_write(buf, (uint8_t *)&w.syms[i].off, sizeof(uint32_t));
+
+        uint32_t end = hdr.text;
+        if (!err) err = jb_io_buf_write(buf, (uint8_t *)&end, sizeof(end));
+        if (!err) err = jb_io_buf_write(buf, (uint8_t *)w.strs, hdr.text);
+        if (!err) err = jb_io_buf_write(buf, w.nodes, hdr.nodes);
+    }
+
+    jb_buf_free(w.nodes);
+    jb_buf_free(w.strs);
+    jb_buf_free(w.syms);
+    free(w.table);
+
+    return err;
+}
+
+//
+// loading
+//
+
+typedef struct {
+    jb_arena_t *arena;
+    const uint8_t *p, *end;
+    const uint8_t *offs; // string table, possibly unaligned
+    size_t nstrs;
+    const char *text;
+    size_t ntext;
+    size_t prev;
+    size_t depth;
+} reader_t;
+
+#define CORRUPT() JB_ERR(JB_ERR_PARSER, "saved tree is corrupt")
+
+static bool get_varint(reader_t *r, uint64_t *out) {
+    uint64_t v = 0;
+
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (r->p == r->end) return false;
+
+        uint8_t b = *r->p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+
+        if (!(b & 0x80)) {
+            *out = v;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool get_zigzag(reader_t *r, int64_t *out) {
+    uint64_t v;
+    if (!get_varint(r, &v)) return false;
+
+    *out = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    return true;
+}
+
+static bool get_span(reader_t *r, size_t *start, size_t *end) {
+    int64_t delta, len;
+    if (!get_zigzag(r, &delta) || !get_zigzag(r, &len)) return false;
+
+    *start = r->prev + (size_t)delta;
+    *end = *start + (size_t)len;
+    r->prev = *start;
+
+    return true;
+}
+
+// an exactly sized arena buffer of `n` elements, each taking at least `min_size` encoded bytes
+static jb_res_t get_array(reader_t *r, size_t min_size, size_t elem_size, void **out) {
+    uint64_t n;
+    if (!get_varint(r, &n) || n > (uint64_t)(r->end - r->p) / min_size) return CORRUPT();
+
+    *out = JB_BUF;
+    if (n == 0) return JB_OK_VAL;
+
+    *out = jb_buf_new_in(r->arena, n, elem_size);
+    if (!*out) return JB_ERR(JB_ERR_OOM, "failed to allocate syntax tree");
+
+    jb_buf_hdr(*out)->len = n;
+    return JB_OK_VAL;
+}
+
+static jb_res_t get_val(reader_t *r, jb_val_t *val) {
+    if (r->p == r->end) return CORRUPT();
+    uint8_t kind = *r->p++;
+
+    if (!get_span(r, &val->start, &val->end)) return CORRUPT();
+
+    switch (kind) {
+        case JB_VAL_STR:
+        case JB_VAL_REF: {
+            uint64_t idx;
+            if (!get_varint(r, &idx) || idx >= r->nstrs) return CORRUPT();
+
+            uint32_t off[2];
+            memcpy(off, r->offs + idx * sizeof(uint32_t), sizeof(off));
+            if (off[0] > off[1] || off[1] > r->ntext) return CORRUPT();
+
+            val->kind = kind;
+            val->str_val = (jb_view_t){r->text + off[0], off[1] - off[0]};
+            return JB_OK_VAL;
+        }
+
+        case JB_VAL_INT:
+            val->kind = kind;
+            if (!get_zigzag(r, &val->int_val)) return CORRUPT();
+            return JB_OK_VAL;
+
+        case JB_VAL_QUOTE:
+        case JB_VAL_INLINE:
+            if (++r->depth > TREE_DEPTH_MAX) return JB_ERR(JB_ERR_PARSER, "saved tree too deep");
+
+            val->kind = kind;
+            // a command is at least a two byte span and a count
+            JB_TRY(get_array(r, 3, sizeof(jb_cmd_t), (void **)&val->body));
+
+            for (size_t i = 0; i < jb_buf_len(val->body); i++) {
+                jb_cmd_t *cmd = &val->body[i];
+                if (!get_span(r, &cmd->start, &cmd->end)) return CORRUPT();
+
+                // a value is at least a kind, a two byte span and one more byte
+                JB_TRY(get_array(r, 4, sizeof(jb_val_t), (void **)&cmd->body));
+
+                for (size_t j = 0; j < jb_buf_len(cmd->body); j++)
+                    JB_TRY(get_val(r, &cmd->body[j]));
+            }
+
+            r->depth--;
+            return JB_OK_VAL;
+    }
+
+    return CORRUPT();
+}
+
+jb_res_t jb_tree_load(jb_arena_t *arena, const uint8_t *data, size_t len, jb_val_t *tree,
+                      size_t *used) {
+    tree_hdr_t hdr;
+    if (len < sizeof(hdr)) return JB_ERR(JB_ERR_PARSER, "saved tree truncated");
+    memcpy(&hdr, data, sizeof(hdr));
+
+    if (hdr.magic != TREE_MAGIC) return JB_ERR(JB_ERR_PARSER, "not a saved tree");
+    if (hdr.version != TREE_VERSION)
+        return JB_ERR(JB_ERR_PARSER, "unsupported saved tree version %u", hdr.version);
+
+    uint64_t offs = ((uint64_t)hdr.nstrs + 1) * sizeof(uint32_t);
+    uint64_t rest = len - sizeof(hdr);
+    if (offs > rest || hdr.text > rest - offs || hdr.nodes > rest - offs - hdr.text)
+        return JB_ERR(JB_ERR_PARSER, "saved tree truncated");
+
+    const uint8_t *text = data + sizeof(hdr) + offs;
+    const uint8_t *nodes = text + hdr.text;
+    reader_t r = {
+        .arena = arena,
+        .p = nodes,
+        .end = nodes + hdr.nodes,
+        .offs = data + sizeof(hdr),
+        .nstrs = hdr.nstrs,
+        .text = (const char *)text,
+        .ntext = hdr.text,
+        .prev = 0,
+        .depth = 0,
+    };
+
+    jb_span_begin("jb_tree_load", NULL);
+    jb_res_t res = get_val(&r, tree);
+    jb_span_end();
+
+    JB_TRY(res);
+    if (r.p != r.end || (tree->kind != JB_VAL_QUOTE && tree->kind != JB_VAL_INLINE))
+        return CORRUPT();
+
+    *used = sizeof(hdr) + offs + hdr.text + hdr.nodes;
+    return JB_OK_VAL;
+}
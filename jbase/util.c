@@ -1,25 +1,155 @@
 #include <assert.h>
 #include <jbase.h>
 #include <stddef.h>
+#include <time.h>
 
-void *jb_buf_grow(const void *buf, size_t new_len, size_t elem_size) {
-    assert(jb_buf_cap(buf) <= (SIZE_MAX - 1) / 2);
+#define ARENA_ALIGN 16
 
-    size_t new_cap = JB_MAX(16, JB_MAX(2 * jb_buf_cap(buf), new_len));
+static size_t align_up(size_t n) {
+    return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
 
-    assert(new_len <= new_cap);
+void jb_arena_init(jb_arena_t *a, size_t block_size) {
+    a->head = NULL;
+    a->block_size = JB_MAX(block_size, 256);
+}
+
+void *jb_arena_alloc(jb_arena_t *a, size_t size) {
+    size = align_up(size);
+
+    jb_arena_block_t *b = a->head;
+
+    if (!b || b->cap - b->used < size) {
+        size_t cap = JB_MAX(a->block_size, size);
+
+        b = malloc(sizeof(jb_arena_block_t) + cap);
+        if (!b) return NULL;
+
+        b->used = 0;
+        b->cap = cap;
+        b->next = a->head;
+        a->head = b;
+    }
+
+    void *ptr = b->data + b->used;
+    b->used += size;
+
+    return ptr;
+}
+
+void *jb_arena_realloc(jb_arena_t *a, void *ptr, size_t old_size, size_t new_size) {
+    jb_arena_block_t *b = a->head;
+    size_t old_aligned = align_up(old_size);
+
+    // the latest allocation can grow or shrink in place
+    if (b && (uint8_t *)ptr + old_aligned == b->data + b->used &&
+        b->cap - (b->used - old_aligned) >= align_up(new_size)) {
+        b->used = b->used - old_aligned + align_up(new_size);
+        return ptr;
+    }
+
+    void *new_ptr = jb_arena_alloc(a, new_size);
+    if (new_ptr && ptr) memcpy(new_ptr, ptr, JB_MIN(old_size, new_size));
+
+    return new_ptr;
+}
+
+void jb_arena_reset(jb_arena_t *a) {
+    if (!a->head) return;
+
+    // keep the newest block for reuse
+    jb_arena_block_t *keep = a->head;
+    a->head = keep->next;
+    jb_arena_free(a);
+
+    keep->used = 0;
+    keep->next = NULL;
+    a->head = keep;
+}
+
+void jb_arena_free(jb_arena_t *a) {
+    while (a->head) {
+        jb_arena_block_t *next = a->head->next;
+        free(a->head);
+        a->head = next;
+    }
+}
+
+// set the capacity of a buffer to exactly `new_cap`
+static void *buf_realloc(const void *buf, size_t new_cap, size_t elem_size) {
     assert(new_cap <= (SIZE_MAX - offsetof(jb_buf_hdr_t, buf)) / elem_size);
 
     size_t new_size = offsetof(jb_buf_hdr_t, buf) + new_cap * elem_size;
 
     jb_buf_hdr_t *new_hdr;
-    if (buf) {
+    if (buf && jb_buf_hdr(buf)->arena) {
+        jb_buf_hdr_t *hdr = jb_buf_hdr(buf);
+        size_t old_size = offsetof(jb_buf_hdr_t, buf) + hdr->cap * elem_size;
+
+        new_hdr = jb_arena_realloc(hdr->arena, hdr, old_size, new_size);
+    } else if (buf) {
         new_hdr = realloc(jb_buf_hdr(buf), new_size);
     } else {
         new_hdr = malloc(new_size);
         new_hdr->len = 0;
+        new_hdr->arena = NULL;
     }
 
     new_hdr->cap = new_cap;
     return new_hdr->buf;
 }
+
+void *jb_buf_grow(const void *buf, size_t new_len, size_t elem_size) {
+    assert(jb_buf_cap(buf) <= (SIZE_MAX - 1) / 2);
+
+    size_t new_cap = JB_MAX(16, JB_MAX(2 * jb_buf_cap(buf), new_len));
+
+    assert(new_len <= new_cap);
+
+    return buf_realloc(buf, new_cap, elem_size);
+}
+
+void *jb_buf_resize(const void *buf, size_t new_cap, size_t elem_size) {
+    assert(new_cap >= jb_buf_len(buf));
+
+    if (new_cap == jb_buf_cap(buf)) return (void *)buf;
+
+    if (new_cap == 0 && !jb_buf_hdr(buf)->arena) {
+        free(jb_buf_hdr(buf));
+        return NULL;
+    }
+
+    return buf_realloc(buf, new_cap, elem_size);
+}
+
+void *jb_buf_append_(void *buf, const void *src, size_t n, size_t elem_size) {
+    if (n == 0) return buf;
+
+    size_t len = jb_buf_len(buf);
+    if (len + n > jb_buf_cap(buf)) buf = jb_buf_grow(buf, len + n, elem_size);
+
+    memcpy((char *)buf + len * elem_size, src, n * elem_size);
+    jb_buf_hdr(buf)->len = len + n;
+
+    return buf;
+}
+
+void *jb_buf_new_in(jb_arena_t *arena, size_t cap, size_t elem_size) {
+    assert(cap <= (SIZE_MAX - offsetof(jb_buf_hdr_t, buf)) / elem_size);
+
+    jb_buf_hdr_t *hdr = jb_arena_alloc(arena, offsetof(jb_buf_hdr_t, buf) + cap * elem_size);
+    if (!hdr) return NULL;
+
+    hdr->len = 0;
+    hdr->cap = cap;
+    hdr->arena = arena;
+
+    return hdr->buf;
+}
+
+uint64_t jb_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
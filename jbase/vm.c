@@ -16,117 +16,96 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include <ctype.h>
 #include <jbase.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 
-typedef struct {
+// a delimiter that hasn't been closed yet
+typedef struct jb_parse_frame {
     size_t start;
     char kind;
-    jb_cmd_t *body;
+    size_t cmd_base; // first of its commands on the command stack
+    size_t val_base; // first of its current command's values on the value stack
 } frame_t;
 
-typedef bool (*jb_ccond_t)(char);
+typedef jb_parser_t parser_t;
 
-static char peek(jb_lexer_t *lx) {
-    if (lx->pos >= lx->len) return '\0';
+// character classes driving the parser's scanning loops
+static jb_cclass_t ws_class, digit_class, not_nl_class, sym_class;
+static pthread_once_t classes_once = PTHREAD_ONCE_INIT;
 
-    return lx->src[lx->pos];
-}
+static void classes_init() {
+    jb_cc_init(&ws_class);
+    jb_cc_add_range(&ws_class, '\t', '\r');
+    jb_cc_add_chars(&ws_class, " ");
 
-static bool take_if(jb_lexer_t *lx, jb_ccond_t cond) {
-    if (cond(peek(lx)) && lx->pos < lx->len) {
-        lx->pos++;
-        return true;
-    }
+    jb_cc_init(&digit_class);
+    jb_cc_add_range(&digit_class, '0', '9');
 
-    return false;
-}
+    jb_cc_init(&not_nl_class);
+    jb_cc_add_chars(&not_nl_class, "\n");
+    jb_cc_invert(&not_nl_class);
 
-static bool take_ifc(jb_lexer_t *lx, char c) {
-    if (peek(lx) == c && lx->pos < lx->len) {
-        lx->pos++;
-        return true;
-    }
-
-    return false;
+    // symbols run until whitespace or a delimiter
+    jb_cc_init(&sym_class);
+    jb_cc_add_range(&sym_class, '\t', '\r');
+    jb_cc_add_chars(&sym_class, " {}[];\"");
+    jb_cc_invert(&sym_class);
 }
 
-static bool take(jb_lexer_t *lx, char *c) {
-    if (lx->pos >= lx->len) return false;
+// copy the top `len - base` entries of a scratch stack into an arena-backed buffer, and pop them
+static jb_res_t seal(jb_arena_t *arena, void *stack, size_t base, size_t elem_size, void **out) {
+    size_t n = jb_buf_len(stack) - base;
 
-    *c = lx->src[lx->pos++];
+    *out = JB_BUF;
+    if (n == 0) return JB_OK_VAL;
 
-    return true;
-}
-
-static bool take_while(jb_lexer_t *lx, jb_ccond_t cond) {
-    bool taken = false;
+    void *buf = jb_buf_new_in(arena, n, elem_size);
+    if (!buf) return JB_ERR(JB_ERR_OOM, "failed to allocate syntax tree");
 
-    while (take_if(lx, cond)) taken = true;
+    memcpy(buf, (char *)stack + base * elem_size, n * elem_size);
+    jb_buf_hdr(buf)->len = n;
+    jb_buf_hdr(stack)->len = base;
 
-    return taken;
-}
-
-static bool is_digit(char c) {
-    return c >= '0' && c <= '9';
-}
-
-static bool is_ws(char c) {
-    return isspace(c);
+    *out = buf;
+    return JB_OK_VAL;
 }
 
-static bool is_not_nl(char c) {
-    return c != '\n';
-}
+static jb_res_t seal_cmd(parser_t *p) {
+    frame_t *frame = jb_buf_last(p->frames);
+    jb_cmd_t *cmd = jb_buf_last(p->cmds);
 
-static bool is_not_tok_end(char c) {
-    return c != '{' && c != '}' && c != '[' && c != ']' && !is_ws(c) && c != ';' && c != '"';
+    return seal(p->arena, p->vals, frame->val_base, sizeof(jb_val_t), (void **)&cmd->body);
 }
 
-static frame_t *stack_init() {
-    frame_t init_frame;
-    init_frame.body = JB_BUF;
-    init_frame.kind = '\0';
-    init_frame.start = 0;
-
-    jb_cmd_t init_cmd;
-    init_cmd.body = JB_BUF;
-    init_cmd.start = 0;
-    init_cmd.end = 0;
-
-    frame_t *stack = JB_BUF;
-
-    jb_buf_push(init_frame.body, init_cmd);
-    jb_buf_push(stack, init_frame);
+static void stack_init(parser_t *p) {
+    frame_t frame = {.start = 0, .kind = '\0', .cmd_base = 0, .val_base = 0};
+    jb_cmd_t cmd = {.body = JB_BUF, .start = 0, .end = 0};
 
-    return stack;
+    jb_buf_push(p->frames, frame);
+    jb_buf_push(p->cmds, cmd);
 }
 
-static void stack_push(frame_t **stack, jb_val_t val) {
-    frame_t *last_frame = jb_buf_last(*stack);
-    jb_cmd_t *last_cmd = jb_buf_last(last_frame->body);
+static void stack_push(parser_t *p, jb_val_t val) {
+    jb_cmd_t *last_cmd = jb_buf_last(p->cmds);
 
-    jb_info("last_frame = %p last_cmd = %p", last_frame, last_cmd);
-
-    jb_buf_push(last_cmd->body, val);
+    jb_buf_push(p->vals, val);
 
     if (last_cmd->start > val.start) last_cmd->start = val.start;
     last_cmd->end = val.end;
 }
 
-static void stack_close_cmd(frame_t **stack, size_t pos) {
-    frame_t *last_frame = jb_buf_last(*stack);
+static jb_res_t stack_close_cmd(parser_t *p, size_t pos) {
+    jb_buf_last(p->cmds)->end = pos;
+    JB_TRY(seal_cmd(p));
 
-    jb_buf_last(last_frame->body)->end = pos;
+    jb_cmd_t cmd = {.body = JB_BUF, .start = SIZE_MAX, .end = pos + 1};
+    jb_buf_push(p->cmds, cmd);
 
-    jb_cmd_t cmd;
-    cmd.body = JB_BUF;
-    cmd.start = SIZE_MAX;
-    cmd.end = pos + 1;
+    jb_buf_last(p->frames)->val_base = jb_buf_len(p->vals);
 
-    jb_buf_push(last_frame->body, cmd);
+    return JB_OK_VAL;
 }
 
 static bool matches(char open, char close) {
@@ -134,30 +113,28 @@ static bool matches(char open, char close) {
            (open == '(' && close == ')');
 }
 
-static void stack_open(frame_t **stack, size_t start, char kind) {
-    frame_t frame;
-    frame.kind = kind;
-    frame.start = start;
-    frame.body = JB_BUF;
-
-    jb_cmd_t cmd;
-    cmd.start = start + 1;
-    cmd.end = cmd.start;
-    cmd.body = JB_BUF;
-
-    jb_buf_push(frame.body, cmd);
-    jb_buf_push(*stack, frame);
+static void stack_open(parser_t *p, size_t start, char kind) {
+    frame_t frame = {
+        .start = start,
+        .kind = kind,
+        .cmd_base = jb_buf_len(p->cmds),
+        .val_base = jb_buf_len(p->vals),
+    };
+    jb_cmd_t cmd = {.body = JB_BUF, .start = start + 1, .end = start + 1};
+
+    jb_buf_push(p->frames, frame);
+    jb_buf_push(p->cmds, cmd);
 }
 
-static jb_res_t stack_close(frame_t **stack, size_t end, char kind) {
-    frame_t cur;
-    if (!jb_buf_pop(*stack, cur)) return JB_ERR(JB_ERR_PARSER, "parser stack exhausted");
+static jb_res_t stack_close(parser_t *p, size_t end, char kind) {
+    frame_t *cur = jb_buf_last(p->frames);
+    if (!cur) return JB_ERR(JB_ERR_PARSER, "parser stack exhausted");
 
-    if (!matches(cur.kind, kind))
+    if (!matches(cur->kind, kind))
         return JB_ERR(JB_ERR_PARSER, "unexpected closing delimiter '%c'", kind);
 
     jb_val_t val;
-    val.start = cur.start;
+    val.start = cur->start;
     val.end = end + 1;
 
     if (kind == '}')
@@ -165,136 +142,250 @@ static jb_res_t stack_close(frame_t **stack, size_t end, char kind) {
     else if (kind == ']')
         val.kind = JB_VAL_INLINE;
 
-    val.body = cur.body;
+    JB_TRY(seal_cmd(p));
+    JB_TRY(seal(p->arena, p->cmds, cur->cmd_base, sizeof(jb_cmd_t), (void **)&val.body));
+
+    jb_buf_hdr(p->frames)->len--;
 
-    stack_push(stack, val);
+    stack_push(p, val);
 
     return JB_OK_VAL;
 }
 
-static void take_sym(jb_lexer_t *lx, jb_val_t *val) {
-    val->kind = JB_VAL_STR;
-    val->str_val = JB_BUF;
-    val->start = lx->pos;
-    take_while(lx, is_not_tok_end);
-    val->end = lx->pos;
+// in a push parser, text is copied into the arena, as the chunk it came from won't last
+static jb_res_t keep_str(parser_t *p, jb_val_t *val) {
+    if (!p->push || val->str_val.len == 0) return JB_OK_VAL;
 
-    size_t len = val->end - val->start;
+    char *str = jb_arena_alloc(p->arena, val->str_val.len);
+    if (!str) return JB_ERR(JB_ERR_OOM, "failed to allocate symbol");
 
-    jb_buf_fit(val->str_val, len);
-    jb_buf_hdr(val->str_val)->len = len;
+    memcpy(str, val->str_val.ptr, val->str_val.len);
+    val->str_val.ptr = str;
 
-    memcpy(val->str_val, lx->src + val->start, len);
+    return JB_OK_VAL;
+}
+
+// symbols are slices of the source
+static void take_sym(parser_t *p, jb_lexer_t *lx, jb_val_t *val) {
+    size_t start = lx->pos;
+    jb_lx_take_while_class(lx, &sym_class);
+
+    val->kind = JB_VAL_STR;
+    val->start = p->base + start;
+    val->end = p->base + lx->pos;
+    val->str_val = (jb_view_t){p->src + start, lx->pos - start};
 }
 
-static jb_res_t take_int(jb_lexer_t *lx, jb_val_t *val) {
-    val->start = lx->pos;
-    take_while(lx, is_digit);
-    val->end = lx->pos;
+static jb_res_t take_int(parser_t *p, jb_lexer_t *lx, jb_val_t *val) {
+    size_t start = lx->pos;
+    jb_lx_take_while_class(lx, &digit_class);
+
+    val->start = p->base + start;
+    val->end = p->base + lx->pos;
 
     val->kind = JB_VAL_INT;
     char *endptr;
-    val->int_val = strtoll(lx->src + val->start, &endptr, 10);
+    val->int_val = strtoll(lx->src + start, &endptr, 10);
 
-    if (endptr != lx->src + val->end)
+    if (endptr != lx->src + lx->pos)
         return JB_ERR(JB_ERR_PARSER, "failed to fully tokenize integer");
 
     return JB_OK_VAL;
 }
 
-static jb_res_t take_str_lit(jb_lexer_t *lx, jb_val_t *val) {
+// string literals without escapes are slices of the source; others are unescaped into the arena
+static jb_res_t take_str_lit(parser_t *p, jb_lexer_t *lx, jb_val_t *val) {
     val->kind = JB_VAL_STR;
-    val->str_val = JB_BUF;
-    val->start = lx->pos;
-    if (!take_ifc(lx, '"')) return JB_ERR(JB_ERR_PARSER, "expected string lit");
+    val->start = p->base + lx->pos;
+    if (!jb_lx_take_ifc(lx, '"')) return JB_ERR(JB_ERR_PARSER, "expected string lit");
+
+    size_t run = strcspn(lx->src + lx->pos, "\"\\");
+
+    if (lx->src[lx->pos + run] == '"') {
+        val->str_val = (jb_view_t){lx->src + lx->pos, run};
+        lx->pos += run + 1;
+        val->end = p->base + lx->pos;
+
+        return keep_str(p, val);
+    }
+
+    jb_buf_truncate(p->str, 0);
 
     bool closed = false;
 
     char c;
-    while (take(lx, &c)) {  // while not EOF
-        if (c == '"') {     // string ended
+    for (;;) {
+        // copy the run of plain characters up to the next quote or escape in one go
+        run = strcspn(lx->src + lx->pos, "\"\\");
+        jb_buf_append(p->str, lx->src + lx->pos, run);
+        lx->pos += run;
+
+        if (!jb_lx_take(lx, &c)) break;  // EOF
+
+        if (c == '"') {  // string ended
             closed = true;
             break;
         }
 
         if (c == '\\') {
-            if (!take(lx, &c)) return JB_ERR(JB_ERR_PARSER, "expected escape sequence, found EOF");
+            if (!jb_lx_take(lx, &c)) {
+                if (p->final) return JB_ERR(JB_ERR_PARSER, "expected escape sequence, found EOF");
+                break;
+            }
 
             switch (c) {  // handle escape sequence
                 case 'n':
-                    jb_buf_push(val->str_val, '\n');
+                    jb_buf_push(p->str, '\n');
                     break;
                 case 'r':
-                    jb_buf_push(val->str_val, '\r');
+                    jb_buf_push(p->str, '\r');
                     break;
                 case 't':
-                    jb_buf_push(val->str_val, '\t');
+                    jb_buf_push(p->str, '\t');
                     break;
                 case 'v':
-                    jb_buf_push(val->str_val, '\v');
+                    jb_buf_push(p->str, '\v');
                     break;
 
                 default:
                     return JB_ERR(JB_ERR_PARSER, "unknown escape sequence '%c'", c);
             }
         } else {  // normal character
-            jb_buf_push(val->str_val, c);
+            jb_buf_push(p->str, c);
+        }
+    }
+
+    if (!closed) {
+        // the rest of the literal may be in the next chunk
+        if (!p->final) {
+            p->more = true;
+            return JB_OK_VAL;
         }
+
+        return JB_ERR(JB_ERR_PARSER, "unclosed string literal");
     }
 
-    if (!closed) return JB_ERR(JB_ERR_PARSER, "unclosed string literal");
+    size_t len = jb_buf_len(p->str);
+    char *str = jb_arena_alloc(p->arena, len);
+    if (!str) return JB_ERR(JB_ERR_OOM, "failed to allocate string literal");
 
-    val->end = ++lx->pos;
+    memcpy(str, p->str, len);
+    val->str_val = (jb_view_t){str, len};
+
+    // the closing quote has already been taken
+    val->end = p->base + lx->pos;
 
     return JB_OK_VAL;
 }
 
-jb_res_t jb_parse(char *src, jb_val_t *val) {
-    jb_lexer_t lx;
-    lx.len = strlen(src);
-    lx.pos = 0;
-    lx.src = src;
+// a symbol or integer running into the end of a chunk may continue in the next one; if so, rewind
+// to its start
+static bool cut_off(parser_t *p, jb_lexer_t *lx, size_t tok) {
+    if (p->final || lx->pos < lx->len) return false;
+
+    lx->pos = tok;
+
+    return true;
+}
 
-    frame_t *stack = stack_init();
+// hand the finished top-level command to the callback, and start the next one
+static jb_res_t emit(parser_t *p, size_t next) {
+    JB_TRY(seal_cmd(p));
 
-    while (lx.pos < lx.len) {
-        char c = peek(&lx);
+    jb_cmd_t cmd = p->cmds[0];
+    p->cmds[0] = (jb_cmd_t){.body = JB_BUF, .start = SIZE_MAX, .end = next};
+
+    // empty commands (`;;`) aren't worth a call
+    if (jb_buf_len(cmd.body) == 0) return JB_OK_VAL;
+
+    return p->cb(p->state, &cmd);
+}
+
+// scan as much of `lx` as forms complete tokens
+static jb_res_t scan(parser_t *p, jb_lexer_t *lx) {
+    while (lx->pos < lx->len) {
+        size_t tok = lx->pos;
+        char c = jb_lx_peek(lx);
         jb_val_t val;
 
         if (c == '#') {
-            take_while(&lx, is_not_nl);
-        } else if (is_ws(c)) {
-            take_while(&lx, is_ws);
-        } else if (is_digit(c)) {
-            JB_TRY(take_int(&lx, &val));
-            stack_push(&stack, val);
+            jb_lx_take_while_class(lx, &not_nl_class);
+            p->in_comment = lx->pos == lx->len && !p->final;
+        } else if (jb_cc_has(&ws_class, c)) {
+            jb_lx_take_while_class(lx, &ws_class);
+        } else if (jb_cc_has(&digit_class, c)) {
+            JB_TRY(take_int(p, lx, &val));
+            if (cut_off(p, lx, tok)) break;
+            stack_push(p, val);
         } else if (c == '{' || c == '[') {
-            stack_open(&stack, lx.pos++, c);
+            stack_open(p, p->base + lx->pos++, c);
         } else if (c == '}' || c == ']') {
-            JB_TRY(stack_close(&stack, ++lx.pos, c));
+            JB_TRY(stack_close(p, p->base + ++lx->pos, c));
         } else if (c == '"') {
-            JB_TRY(take_str_lit(&lx, &val));
-            stack_push(&stack, val);
-        } else if (take_ifc(&lx, ';')) {
-            stack_close_cmd(&stack, ++lx.pos);
+            JB_TRY(take_str_lit(p, lx, &val));
+            if (p->more) {
+                p->more = false;
+                lx->pos = tok;
+                break;
+            }
+            stack_push(p, val);
+        } else if (c == ';') {
+            size_t pos = p->base + lx->pos++;
+
+            // a push parser hands out top-level commands as they end
+            if (p->cb && jb_buf_len(p->frames) == 1) {
+                p->cmds[0].end = pos;
+                JB_TRY(emit(p, pos + 1));
+            } else {
+                JB_TRY(stack_close_cmd(p, pos));
+            }
         } else if (c == '$') {
-            size_t start = lx.pos++;
-            take_sym(&lx, &val);
-            val.start = start;
+            lx->pos++;
+            take_sym(p, lx, &val);
+            if (cut_off(p, lx, tok)) break;
+            JB_TRY(keep_str(p, &val));
+            val.start = p->base + tok;
             val.kind = JB_VAL_REF;
-            stack_push(&stack, val);
+            stack_push(p, val);
         } else {
-            take_sym(&lx, &val);
-            stack_push(&stack, val);
+            take_sym(p, lx, &val);
+            if (cut_off(p, lx, tok)) break;
+            JB_TRY(keep_str(p, &val));
+            stack_push(p, val);
         }
     }
 
+    return JB_OK_VAL;
+}
+
+// anything left in unclosed delimiters is dropped
+static void drop_unclosed(parser_t *p) {
+    if (jb_buf_len(p->frames) > 1) {
+        frame_t *inner = &p->frames[1];
+
+        jb_buf_truncate(p->vals, inner->val_base);
+        jb_buf_truncate(p->cmds, inner->cmd_base);
+        jb_buf_truncate(p->frames, 1);
+    }
+}
+
+static jb_res_t parse(parser_t *p, jb_val_t *val) {
+    jb_lexer_t lx;
+    jb_lx_init_str(&lx, p->src);
+
+    stack_init(p);
+
+    pthread_once(&classes_once, classes_init);
+
+    JB_TRY(scan(p, &lx));
+    drop_unclosed(p);
+
     val->kind = JB_VAL_QUOTE;
-    val->body = stack[0].body;
     val->start = 0;
     val->end = lx.len;
 
-    jb_buf_free(stack);
+    JB_TRY(seal_cmd(p));
+    JB_TRY(seal(p->arena, p->cmds, 0, sizeof(jb_cmd_t), (void **)&val->body));
 
     return JB_OK_VAL;
 }
@@ -309,16 +400,16 @@ void jb_write_val(FILE *f, jb_val_t *val, size_t indent) {
         case JB_VAL_STR:
             fprintf(f,
                     "Str \"%.*s\" (%lu -> %lu)\n",
-                    (int)jb_buf_len(val->str_val),
-                    val->str_val,
+                    (int)val->str_val.len,
+                    val->str_val.ptr,
                     val->start,
                     val->end);
             break;
         case JB_VAL_REF:
             fprintf(f,
                     "Ref \"%.*s\" (%lu -> %lu)\n",
-                    (int)jb_buf_len(val->str_val),
-                    val->str_val,
+                    (int)val->str_val.len,
+                    val->str_val.ptr,
                     val->start,
                     val->end);
             break;
@@ -349,3 +440,483 @@ void jb_write_val(FILE *f, jb_val_t *val, size_t indent) {
             break;
     }
 }
+
+jb_res_t jb_parse(jb_arena_t *arena, const char *src, jb_val_t *val) {
+    parser_t p = {
+        .arena = arena,
+        .src = src,
+        .final = true,
+        .frames = JB_BUF,
+        .cmds = JB_BUF,
+        .vals = JB_BUF,
+        .str = JB_BUF,
+        .pending = JB_BUF,
+    };
+
+    jb_span_begin("jb_parse", NULL);
+    jb_res_t res = parse(&p, val);
+    jb_span_end();
+
+    jb_parser_free(&p);
+
+    return res;
+}
+
+void jb_parser_init(jb_parser_t *p, jb_arena_t *arena, jb_parse_cb_t cb, void *state) {
+    *p = (jb_parser_t){
+        .arena = arena,
+        .push = true,
+        .frames = JB_BUF,
+        .cmds = JB_BUF,
+        .vals = JB_BUF,
+        .str = JB_BUF,
+        .pending = JB_BUF,
+        .cb = cb,
+        .state = state,
+    };
+
+    stack_init(p);
+
+    pthread_once(&classes_once, classes_init);
+}
+
+// scan the pending input, keeping whatever is left over
+static jb_res_t feed(parser_t *p) {
+    size_t len = jb_buf_len(p->pending);
+
+    // the scanners rely on a terminator past the end
+    jb_buf_push(p->pending, '\0');
+
+    jb_lexer_t lx;
+    jb_lx_init(&lx, p->pending, len);
+    p->src = p->pending;
+
+    if (p->in_comment) {
+        jb_lx_take_while_class(&lx, &not_nl_class);
+        p->in_comment = lx.pos == lx.len && !p->final;
+    }
+
+    jb_res_t res = scan(p, &lx);
+
+    memmove(p->pending, p->pending + lx.pos, len - lx.pos);
+    jb_buf_truncate(p->pending, len - lx.pos);
+    p->base += lx.pos;
+
+    return res;
+}
+
+jb_res_t jb_parser_feed(jb_parser_t *p, const char *chunk, size_t len) {
+    jb_buf_append(p->pending, chunk, len);
+
+    return feed(p);
+}
+
+jb_res_t jb_parser_finish(jb_parser_t *p) {
+    p->final = true;
+    JB_TRY(feed(p));
+
+    drop_unclosed(p);
+
+    return emit(p, p->base);
+}
+
+void jb_parser_free(jb_parser_t *p) {
+    jb_buf_free(p->frames);
+    jb_buf_free(p->cmds);
+    jb_buf_free(p->vals);
+    jb_buf_free(p->str);
+    jb_buf_free(p->pending);
+}
+
+//
+// interpreter
+//
+// dispatch is threaded: every handler ends by jumping straight to the next instruction's handler
+// through a table of label addresses, rather than returning to a central switch
+//
+
+bool jb_vm_truthy(jb_vm_val_t val) {
+    switch (val.kind) {
+        case JB_VM_NIL:
+            return false;
+        case JB_VM_INT:
+            return val.int_val != 0;
+        case JB_VM_STR:
+            return val.str_val.len > 0;
+        case JB_VM_BLOCK:
+            return true;
+    }
+
+    return false;
+}
+
+static jb_native_t find_cmd(jb_vm_t *vm, const char *name, size_t len) {
+    for (size_t i = 0; i < jb_buf_len(vm->cmds); i++)
+        if (strncmp(vm->cmds[i].name, name, len) == 0 && vm->cmds[i].name[len] == '\0')
+            return vm->cmds[i].fn;
+
+    return NULL;
+}
+
+static jb_res_t run(jb_vm_t *vm, uint32_t block, jb_vm_val_t *out) {
+    static const void *ops[JB_OP_MAX] = {
+        [JB_OP_NIL] = &&op_nil,
+        [JB_OP_INT] = &&op_int,
+        [JB_OP_STR] = &&op_str,
+        [JB_OP_BLOCK] = &&op_block,
+        [JB_OP_LOAD] = &&op_load,
+        [JB_OP_STORE] = &&op_store,
+        [JB_OP_POP] = &&op_pop,
+        [JB_OP_CALL] = &&op_call,
+        [JB_OP_CALLV] = &&op_callv,
+        [JB_OP_RET] = &&op_ret,
+    };
+
+    jb_prog_t *prog = vm->prog;
+    size_t base = vm->sp;
+
+    if (base + prog->blocks[block].depth > JB_VM_STACK)
+        return JB_ERR(JB_ERR_VM, "VM stack overflow");
+    if (vm->depth == JB_VM_DEPTH) return JB_ERR(JB_ERR_VM, "call depth exceeded");
+
+    vm->depth++;
+
+    const uint32_t *pc = prog->code + prog->blocks[block].start;
+    jb_vm_val_t *sp = vm->stack + base;
+    jb_res_t res;
+    uint32_t ins;
+
+#define NEXT() \
+    do { \
+        ins = *pc++; \
+        goto *ops[ins & 0xff]; \
+    } while (0)
+#define ARG (ins >> 8)
+
+    NEXT();
+
+op_nil:
+    sp->kind = JB_VM_NIL;
+    sp++;
+    NEXT();
+
+op_int:
+    sp->kind = JB_VM_INT;
+    sp->int_val = prog->ints[ARG];
+    sp++;
+    NEXT();
+
+op_str:
+    sp->kind = JB_VM_STR;
+    sp->str_val = (jb_view_t){jb_prog_sym(prog, ARG), prog->syms[ARG].len};
+    sp++;
+    NEXT();
+
+op_block:
+    sp->kind = JB_VM_BLOCK;
+    sp->block = ARG;
+    sp++;
+    NEXT();
+
+op_load:
+    *sp++ = prog->slots[ARG];
+    NEXT();
+
+op_store:
+    prog->slots[ARG] = sp[-1];
+    NEXT();
+
+op_pop:
+    sp--;
+    NEXT();
+
+op_call: {
+    size_t argc = ARG;
+    uint32_t name = *pc++;
+    jb_native_t fn = prog->cmds[name];
+
+    // arguments stay below the stack pointer while the command runs
+    jb_vm_val_t *args = sp - argc;
+    jb_vm_val_t ret;
+    vm->sp = sp - vm->stack;
+
+    if (fn)
+        res = fn(vm, args, argc, &ret);
+    else if (argc == 0 && prog->slots[name].kind == JB_VM_BLOCK)
+        res = run(vm, prog->slots[name].block, &ret);
+    else
+        res = JB_ERR(JB_ERR_USER, "unknown command '%s'", jb_prog_sym(prog, name));
+
+    if (res JB_IS_ERR) goto fail;
+
+    sp = args;
+    *sp++ = ret;
+    NEXT();
+}
+
+op_callv: {
+    size_t argc = ARG;
+    jb_vm_val_t *args = sp - argc;
+    jb_vm_val_t name = args[-1], ret;
+
+    vm->sp = sp - vm->stack;
+
+    if (name.kind == JB_VM_BLOCK && argc == 0) {
+        res = run(vm, name.block, &ret);
+    } else if ((name.kind == JB_VM_INT || name.kind == JB_VM_NIL) && argc == 0) {
+        // a lone value evaluates to itself
+        ret = name;
+        res = JB_OK_VAL;
+    } else if (name.kind == JB_VM_STR) {
+        jb_native_t fn = find_cmd(vm, name.str_val.ptr, name.str_val.len);
+
+        if (fn)
+            res = fn(vm, args, argc, &ret);
+        else
+            res = JB_ERR(JB_ERR_USER,
+                         "unknown command '%.*s'",
+                         (int)name.str_val.len,
+                         name.str_val.ptr);
+    } else {
+        res = JB_ERR(JB_ERR_USER, "not a command");
+    }
+
+    if (res JB_IS_ERR) goto fail;
+
+    sp = args;
+    sp[-1] = ret;
+    NEXT();
+}
+
+op_ret:
+    *out = sp[-1];
+    vm->sp = base;
+    vm->depth--;
+
+    return JB_OK_VAL;
+
+fail:
+    vm->sp = base;
+    vm->depth--;
+    return res;
+
+#undef NEXT
+#undef ARG
+}
+
+jb_res_t jb_vm_eval(jb_vm_t *vm, jb_vm_val_t val, jb_vm_val_t *out) {
+    if (val.kind != JB_VM_BLOCK) {
+        *out = val;
+        return JB_OK_VAL;
+    }
+
+    return run(vm, val.block, out);
+}
+
+jb_res_t jb_vm_run_block(jb_vm_t *vm, jb_prog_t *prog, uint32_t block, jb_vm_val_t *out) {
+    jb_prog_t *outer = vm->prog;
+    vm->prog = prog;
+
+    jb_res_t res = run(vm, block, out);
+
+    vm->prog = outer;
+    return res;
+}
+
+jb_res_t jb_vm_run(jb_vm_t *vm, jb_prog_t *prog, jb_vm_val_t *out) {
+    return jb_vm_run_block(vm, prog, 0, out);
+}
+
+void jb_vm_link(jb_vm_t *vm, jb_prog_t *prog) {
+    size_t n = jb_buf_len(prog->syms);
+
+    free(prog->cmds);
+    free(prog->slots);
+
+    prog->cmds = malloc(n * sizeof(jb_native_t));
+    prog->slots = malloc(n * sizeof(jb_vm_val_t));
+
+    for (size_t i = 0; i < n; i++) {
+        prog->cmds[i] = find_cmd(vm, jb_prog_sym(prog, i), prog->syms[i].len);
+        prog->slots[i].kind = JB_VM_NIL;
+    }
+}
+
+void jb_vm_register(jb_vm_t *vm, const char *name, jb_native_t fn) {
+    for (size_t i = 0; i < jb_buf_len(vm->cmds); i++) {
+        if (strcmp(vm->cmds[i].name, name) == 0) {
+            vm->cmds[i].fn = fn;
+            return;
+        }
+    }
+
+    jb_vm_cmd_t cmd = {name, fn};
+    jb_buf_push(vm->cmds, cmd);
+}
+
+//
+// core commands
+//
+
+static jb_res_t want_args(const char *cmd, size_t argc, size_t min, size_t max) {
+    if (argc < min || argc > max)
+        return JB_ERR(JB_ERR_USER, "`%s`: wrong number of arguments (%zu)", cmd, argc);
+
+    return JB_OK_VAL;
+}
+
+static jb_res_t want_int(const char *cmd, jb_vm_val_t val) {
+    if (val.kind != JB_VM_INT) return JB_ERR(JB_ERR_USER, "`%s`: expected an integer", cmd);
+
+    return JB_OK_VAL;
+}
+
+static jb_vm_val_t int_val(int64_t i) {
+    return (jb_vm_val_t){.kind = JB_VM_INT, .int_val = i};
+}
+
+// if COND THEN ?ELSE?
+static jb_res_t cmd_if(jb_vm_t *vm, jb_vm_val_t *args, size_t argc, jb_vm_val_t *out) {
+    JB_TRY(want_args("if", argc, 2, 3));
+
+    jb_vm_val_t cond;
+    JB_TRY(jb_vm_eval(vm, args[0], &cond));
+
+    if (jb_vm_truthy(cond)) return jb_vm_eval(vm, args[1], out);
+    if (argc == 3) return jb_vm_eval(vm, args[2], out);
+
+    out->kind = JB_VM_NIL;
+    return JB_OK_VAL;
+}
+
+// while COND BODY
+static jb_res_t cmd_while(jb_vm_t *vm, jb_vm_val_t *args, size_t argc, jb_vm_val_t *out) {
+    JB_TRY(want_args("while", argc, 2, 2));
+
+    jb_vm_val_t cond, body = {.kind = JB_VM_NIL};
+
+    for (;;) {
+        JB_TRY(jb_vm_eval(vm, args[0], &cond));
+        if (!jb_vm_truthy(cond)) break;
+
+        JB_TRY(jb_vm_eval(vm, args[1], &body));
+    }
+
+    *out = body;
+    return JB_OK_VAL;
+}
+
+// do BLOCK
+static jb_res_t cmd_do(jb_vm_t *vm, jb_vm_val_t *args, size_t argc, jb_vm_val_t *out) {
+    JB_TRY(want_args("do", argc, 1, 1));
+
+    return jb_vm_eval(vm, args[0], out);
+}
+
+// and/or evaluate block arguments lazily, and short-circuit
+static jb_res_t cmd_and(jb_vm_t *vm, jb_vm_val_t *args, size_t argc, jb_vm_val_t *out) {
+    *out = int_val(1);
+
+    for (size_t i = 0; i < argc; i++) {
+        JB_TRY(jb_vm_eval(vm, args[i], out));
+        if (!jb_vm_truthy(*out)) break;
+    }
+
+    return JB_OK_VAL;
+}
+
+static jb_res_t cmd_or(jb_vm_t *vm, jb_vm_val_t *args, size_t argc, jb_vm_val_t *out) {
+    *out = int_val(0);
+
+    for (size_t i = 0; i < argc; i++) {
+        JB_TRY(jb_vm_eval(vm, args[i], out));
+        if (jb_vm_truthy(*out)) break;
+    }
+
+    return JB_OK_VAL;
+}
+
+static jb_res_t cmd_not(jb_vm_t *vm, jb_vm_val_t *args, size_t argc, jb_vm_val_t *out) {
+    JB_TRY(want_args("not", argc, 1, 1));
+
+    jb_vm_val_t val;
+    JB_TRY(jb_vm_eval(vm, args[0], &val));
+
+    *out = int_val(!jb_vm_truthy(val));
+    return JB_OK_VAL;
+}
+
+// integers compare by value, strings by content, blocks by identity
+static jb_res_t cmd_eq(jb_vm_t *vm, jb_vm_val_t *args, size_t argc, jb_vm_val_t *out) {
+    (void)vm;
+    JB_TRY(want_args("eq", argc, 2, 2));
+
+    jb_vm_val_t a = args[0], b = args[1];
+    bool eq = a.kind == b.kind;
+
+    if (eq && a.kind == JB_VM_INT) eq = a.int_val == b.int_val;
+    if (eq && a.kind == JB_VM_STR)
+        eq = a.str_val.len == b.str_val.len && memcmp(a.str_val.ptr, b.str_val.ptr, a.str_val.len) == 0;
+    if (eq && a.kind == JB_VM_BLOCK) eq = a.block == b.block;
+
+    *out = int_val(eq);
+    return JB_OK_VAL;
+}
+
+static jb_res_t cmd_lt(jb_vm_t *vm, jb_vm_val_t *args, size_t argc, jb_vm_val_t *out) {
+    (void)vm;
+    JB_TRY(want_args("lt", argc, 2, 2));
+    JB_TRY(want_int("lt", args[0]));
+    JB_TRY(want_int("lt", args[1]));
+
+    *out = int_val(args[0].int_val < args[1].int_val);
+    return JB_OK_VAL;
+}
+
+// arithmetic wraps on overflow
+#define ARITH(name, op) \
+    static jb_res_t cmd_##name(jb_vm_t *vm, jb_vm_val_t *args, size_t argc, jb_vm_val_t *out) { \
+        (void)vm; \
+        JB_TRY(want_args(#name, argc, 1, SIZE_MAX)); \
+        JB_TRY(want_int(#name, args[0])); \
+\
+        uint64_t acc = args[0].int_val; \
+        for (size_t i = 1; i < argc; i++) { \
+            JB_TRY(want_int(#name, args[i])); \
+            acc = acc op(uint64_t) args[i].int_val; \
+        } \
+\
+        *out = int_val((int64_t)acc); \
+        return JB_OK_VAL; \
+    }
+
+ARITH(add, +)
+ARITH(sub, -)
+ARITH(mul, *)
+
+void jb_vm_init(jb_vm_t *vm) {
+    vm->cmds = JB_BUF;
+    vm->stack = malloc(JB_VM_STACK * sizeof(jb_vm_val_t));
+    vm->sp = 0;
+    vm->depth = 0;
+    vm->prog = NULL;
+    vm->user = NULL;
+
+    jb_vm_register(vm, "if", cmd_if);
+    jb_vm_register(vm, "while", cmd_while);
+    jb_vm_register(vm, "do", cmd_do);
+    jb_vm_register(vm, "and", cmd_and);
+    jb_vm_register(vm, "or", cmd_or);
+    jb_vm_register(vm, "not", cmd_not);
+    jb_vm_register(vm, "eq", cmd_eq);
+    jb_vm_register(vm, "lt", cmd_lt);
+    jb_vm_register(vm, "add", cmd_add);
+    jb_vm_register(vm, "sub", cmd_sub);
+    jb_vm_register(vm, "mul", cmd_mul);
+}
+
+void jb_vm_free(jb_vm_t *vm) {
+    jb_buf_free(vm->cmds);
+    free(vm->stack);
+    vm->stack = NULL;
+}
@@ -0,0 +1,588 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <jbase.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//
+// envelopes
+//
+// each stage is a straight line from the level the voice entered it at, so a block is rendered as
+// a few ramps rather than deciding the stage every frame
+//
+
+static void env_enter(const jb_env_t *env, jb_env_state_t *st, int stage, size_t srate) {
+    float target = 0, time = 0;
+
+    switch (stage) {
+        case JB_ENV_ATTACK:
+            target = 1;
+            time = env->attack;
+            break;
+        case JB_ENV_DECAY:
+            target = env->sustain;
+            time = env->decay;
+            break;
+        case JB_ENV_RELEASE:
+            target = 0;
+            time = env->release;
+            break;
+        default:
+            // sustain and idle hold their level until told otherwise
+            st->stage = stage;
+            st->left = SIZE_MAX;
+            st->step = 0;
+            return;
+    }
+
+    // a stage lasts at least a frame, so zero-length stages don't click by more than that
+    size_t frames = JB_MAX((size_t)1, (size_t)(time * srate));
+
+    st->stage = stage;
+    st->left = frames;
+    st->step = (target - st->level) / frames;
+}
+
+// fill `gain` with the envelope over the next `nframes`
+static void env_render(const jb_env_t *env, jb_env_state_t *st, size_t srate, size_t nframes,
+                       float *gain) {
+    size_t i = 0;
+
+    while (i < nframes) {
+        size_t n = JB_MIN(st->left, nframes - i);
+        float level = st->level, step = st->step;
+
+        for (size_t j = 0; j < n; j++) gain[i + j] = level + step * (float)(j + 1);
+
+        i += n;
+        st->left -= st->left == SIZE_MAX ? 0 : n;
+        st->level = level + step * (float)n;
+
+        if (st->left) continue;
+
+        // land exactly on the stage's target, then move on to the next
+        switch (st->stage) {
+            case JB_ENV_ATTACK:
+                st->level = 1;
+                env_enter(env, st, JB_ENV_DECAY, srate);
+                break;
+            case JB_ENV_DECAY:
+                st->level = env->sustain;
+                env_enter(env, st, JB_ENV_SUSTAIN, srate);
+                break;
+            case JB_ENV_RELEASE:
+                st->level = 0;
+                env_enter(env, st, JB_ENV_IDLE, srate);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+//
+// voices
+//
+
+jb_res_t jb_voices_init(jb_voices_t *vs, const jb_patch_t *patch, size_t nvoices, size_t srate) {
+    size_t nnodes = jb_buf_len(patch->nodes);
+
+    *vs = (jb_voices_t){
+        .patch = patch,
+        .env = {.attack = 0.005f, .decay = 0.1f, .sustain = 0.8f, .release = 0.2f},
+        .steal = JB_STEAL_OLDEST,
+        .srate = srate,
+        .nvoices = nvoices,
+    };
+
+    jb_params_init(&vs->params);
+
+    // everything rendering needs is allocated up front
+    vs->voices = calloc(nvoices, sizeof(jb_voice_t));
+    vs->states = calloc(nvoices * nnodes, sizeof(jb_osc_state_t));
+    vs->scratch = malloc(jb_patch_scratch(patch) * sizeof(float));
+
+    if (!vs->voices || !vs->states || !vs->scratch) {
+        jb_voices_free(vs);
+        return JB_ERR(JB_ERR_OOM, "failed to allocate %zu voices", nvoices);
+    }
+
+    for (size_t i = 0; i < nvoices; i++) vs->voices[i].osc = &vs->states[i * nnodes];
+
+    // keep table building off the real-time thread
+    jb_synth_init();
+
+    return JB_OK_VAL;
+}
+
+static bool voice_active(const jb_voice_t *v) {
+    return v->env.stage != JB_ENV_IDLE;
+}
+
+// a voice a late worker is still rendering, and holding back a note off for it until it's done;
+// defined with the workers
+static bool voice_busy(const jb_voices_t *vs, size_t i);
+static void defer_release(jb_voices_t *vs, size_t i);
+
+// whether `a` should be stolen ahead of `b`
+static bool steal_before(const jb_voices_t *vs, const jb_voice_t *a, const jb_voice_t *b) {
+    if (vs->steal == JB_STEAL_QUIETEST)
+        return a->env.level * a->velocity < b->env.level * b->velocity;
+
+    return a->started < b->started;
+}
+
+// voice to play a new note on: one already playing `key`, a free one, or one to steal
+static jb_voice_t *voice_for(jb_voices_t *vs, uint8_t key) {
+    jb_voice_t *free_voice = NULL, *victim = NULL;
+
+    for (size_t i = 0; i < vs->nvoices; i++) {
+        jb_voice_t *v = &vs->voices[i];
+
+        if (voice_busy(vs, i)) continue;
+
+        if (!voice_active(v)) {
+            if (!free_voice) free_voice = v;
+        } else if (v->key == key) {
+            return v;
+        } else if (!victim || steal_before(vs, v, victim)) {
+            victim = v;
+        }
+    }
+
+    return free_voice ? free_voice : victim;
+}
+
+void jb_voices_note_on(jb_voices_t *vs, uint8_t key, uint8_t velocity) {
+    if (velocity == 0) {
+        jb_voices_note_off(vs, key);
+        return;
+    }
+
+    jb_voice_t *v = voice_for(vs, key);
+    if (!v) return;
+
+    // a stolen voice starts its oscillators afresh, but its envelope attacks from where it is
+    // rather than clicking to silence
+    if (!voice_active(v) || v->key != key)
+        memset(v->osc, 0, jb_buf_len(vs->patch->nodes) * sizeof(jb_osc_state_t));
+
+    v->key = key;
+    v->velocity = velocity / 127.f;
+    v->started = vs->clock++;
+    env_enter(&vs->env, &v->env, JB_ENV_ATTACK, vs->srate);
+}
+
+static void release(jb_voices_t *vs, jb_voice_t *v) {
+    if (voice_active(v) && v->env.stage != JB_ENV_RELEASE)
+        env_enter(&vs->env, &v->env, JB_ENV_RELEASE, vs->srate);
+}
+
+void jb_voices_note_off(jb_voices_t *vs, uint8_t key) {
+    for (size_t i = 0; i < vs->nvoices; i++) {
+        jb_voice_t *v = &vs->voices[i];
+
+        if (v->key != key) continue;
+
+        // a voice in flight keeps its key, so it's released once its worker is done with it
+        if (voice_busy(vs, i))
+            defer_release(vs, i);
+        else
+            release(vs, v);
+    }
+}
+
+// mix `nframes` of a voice into `out`
+static void render_voice(jb_voices_t *vs, jb_voice_t *v, size_t nframes, float *scratch,
+                         float *out) {
+    float buf[JB_SYNTH_BLOCK], gain[JB_SYNTH_BLOCK];
+
+    for (size_t base = 0; base < nframes && voice_active(v); base += JB_SYNTH_BLOCK) {
+        size_t n = JB_MIN(JB_SYNTH_BLOCK, nframes - base);
+
+        jb_patch_render(vs->patch, v->osc, JB_SEMIS(v->key), vs->srate, n, scratch, buf);
+        env_render(&vs->env, &v->env, vs->srate, n, gain);
+
+        float vel = v->velocity;
+        for (size_t j = 0; j < n; j++) out[base + j] += buf[j] * gain[j] * vel;
+    }
+}
+
+// mix every `ngroups`th voice, starting at `group`, into `out`. voices are dealt out round-robin
+// so the low voices a sparse pool fills first are spread across the groups
+static void render_group(jb_voices_t *vs, size_t group, size_t ngroups, size_t nframes,
+                         float *scratch, float *out) {
+    memset(out, 0, nframes * sizeof(float));
+
+    for (size_t i = group; i < vs->nvoices; i += ngroups)
+        if (!voice_busy(vs, i)) render_voice(vs, &vs->voices[i], nframes, scratch, out);
+}
+
+//
+// worker threads
+//
+// each cycle the caller bumps `gen` and wakes the workers, then renders its own group. each voice
+// of a worker's group is claimed for the cycle by whichever of the worker or the caller gets to it
+// first: once the caller is done with its own share it renders every voice the workers haven't
+// reached, then waits on them only until the cycle's deadline. a worker still going by then has
+// its mix dropped for the cycle, and the voice it's in the middle of is left alone (not rendered,
+// retriggered or released) until it's done with it, so no voice is ever rendered twice at once
+//
+
+typedef struct {
+    atomic_uint claimed;  // cycle the voice was last claimed for
+    atomic_uint rendered; // and the last it was rendered for; behind `claimed` while in flight
+} claim_t;
+
+typedef struct {
+    _Alignas(64) atomic_uint done; // last cycle the worker finished
+    float *buf;                    // `max_frames` of the worker's mix
+    float *scratch;                // for `jb_patch_render`
+} group_t;
+
+struct jb_voice_workers {
+    jb_voices_t *vs;
+    size_t nthreads, max_frames;
+    pthread_t *threads;
+    group_t *groups;  // one per thread, after the caller's
+    claim_t *claims;  // one per voice
+    bool *deferred;   // note offs held back from voices in flight; only touched by the caller
+    bool prio_synced; // workers running at the rendering thread's priority
+
+    _Alignas(64) atomic_uint gen; // cycles started; workers sleep on it
+    atomic_size_t nframes;        // frames being rendered this cycle
+    atomic_bool stop;
+
+    size_t cycles, inline_voices, late; // for `jb_voices_stats`
+};
+
+typedef struct {
+    struct jb_voice_workers *w;
+    size_t idx;
+} worker_arg_t;
+
+static void futex_wait(atomic_uint *addr, unsigned val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static inline void spin_pause() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static bool voice_busy(const jb_voices_t *vs, size_t i) {
+    const struct jb_voice_workers *w = vs->workers;
+    if (!w) return false;
+
+    return atomic_load_explicit(&w->claims[i].claimed, memory_order_acquire) !=
+           atomic_load_explicit(&w->claims[i].rendered, memory_order_acquire);
+}
+
+// claim voice `i` for cycle `gen`, unless it's been claimed for this cycle (or a later one, when
+// a late worker asks) or is still being rendered for an earlier one
+static bool claim(struct jb_voice_workers *w, size_t i, unsigned gen) {
+    claim_t *c = &w->claims[i];
+    unsigned last = atomic_load_explicit(&c->claimed, memory_order_acquire);
+
+    if ((int)(gen - last) <= 0) return false;
+    if (atomic_load_explicit(&c->rendered, memory_order_acquire) != last) return false;
+
+    return atomic_compare_exchange_strong_explicit(
+        &c->claimed, &last, gen, memory_order_acquire, memory_order_relaxed);
+}
+
+static void render_claimed(struct jb_voice_workers *w, size_t i, unsigned gen, size_t nframes,
+                           float *scratch, float *out) {
+    render_voice(w->vs, &w->vs->voices[i], nframes, scratch, out);
+    atomic_store_explicit(&w->claims[i].rendered, gen, memory_order_release);
+}
+
+static void render_share(struct jb_voice_workers *w, size_t idx, unsigned gen) {
+    group_t *g = &w->groups[idx];
+    size_t nframes = atomic_load_explicit(&w->nframes, memory_order_relaxed);
+
+    memset(g->buf, 0, nframes * sizeof(float));
+
+    for (size_t i = idx + 1; i < w->vs->nvoices; i += w->nthreads + 1)
+        if (claim(w, i, gen)) render_claimed(w, i, gen, nframes, g->scratch, g->buf);
+
+    atomic_store_explicit(&g->done, gen, memory_order_release);
+}
+
+static void *worker_thread(void *arg) {
+    worker_arg_t a = *(worker_arg_t *)arg;
+    free(arg);
+
+    struct jb_voice_workers *w = a.w;
+    unsigned seen = 0;
+
+    for (;;) {
+        unsigned gen;
+        while ((gen = atomic_load_explicit(&w->gen, memory_order_acquire)) == seen)
+            futex_wait(&w->gen, seen);
+        seen = gen;
+
+        if (atomic_load_explicit(&w->stop, memory_order_acquire)) break;
+
+        render_share(w, a.idx, gen);
+    }
+
+    return NULL;
+}
+
+// best effort: pin to a core of our own, at the calling thread's scheduling policy and priority
+static void make_rt(pthread_t thread, size_t idx) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (ncpus > 1) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET((idx + 1) % ncpus, &set);
+
+        if (pthread_setaffinity_np(thread, sizeof(set), &set) != 0)
+            jb_debug("couldn't pin voice worker %zu", idx);
+    }
+
+    int policy;
+    struct sched_param param;
+    if (pthread_getschedparam(pthread_self(), &policy, &param) != 0 ||
+        pthread_setschedparam(thread, policy, &param) != 0)
+        jb_debug("couldn't give voice worker %zu the caller's priority", idx);
+}
+
+// workers start at the priority of whoever spawned them, usually not the audio thread; the first
+// parallel cycle gives them the audio thread's, so none can be starved by the thread waiting on it
+static void sync_priority(struct jb_voice_workers *w) {
+    int policy, wpolicy;
+    struct sched_param param, wparam;
+
+    w->prio_synced = true;
+    if (pthread_getschedparam(pthread_self(), &policy, &param) != 0) return;
+
+    for (size_t i = 0; i < w->nthreads; i++) {
+        if (pthread_getschedparam(w->threads[i], &wpolicy, &wparam) == 0 && wpolicy == policy &&
+            wparam.sched_priority == param.sched_priority)
+            continue;
+
+        pthread_setschedparam(w->threads[i], policy, &param);
+    }
+}
+
+static void workers_stop(struct jb_voice_workers *w, size_t started) {
+    atomic_store_explicit(&w->stop, true, memory_order_release);
+    atomic_fetch_add_explicit(&w->gen, 1, memory_order_release);
+    futex_wake(&w->gen);
+
+    for (size_t i = 0; i < started; i++) pthread_join(w->threads[i], NULL);
+
+    for (size_t i = 0; i < w->nthreads && w->groups; i++) {
+        free(w->groups[i].buf);
+        free(w->groups[i].scratch);
+    }
+
+    free(w->groups);
+    free(w->claims);
+    free(w->deferred);
+    free(w->threads);
+    free(w);
+}
+
+jb_res_t jb_voices_spawn(jb_voices_t *vs, size_t nthreads, size_t max_frames) {
+    if (vs->workers || nthreads == 0) return JB_OK_VAL;
+
+    struct jb_voice_workers *w = calloc(1, sizeof(*w));
+    if (!w) return JB_ERR(JB_ERR_OOM, "failed to allocate voice workers");
+
+    w->vs = vs;
+    w->nthreads = nthreads;
+    w->max_frames = max_frames;
+    atomic_init(&w->gen, 0);
+    atomic_init(&w->nframes, 0);
+    atomic_init(&w->stop, false);
+
+    w->threads = calloc(nthreads, sizeof(pthread_t));
+    w->groups = calloc(nthreads, sizeof(group_t));
+    w->claims = calloc(vs->nvoices, sizeof(claim_t));
+    w->deferred = calloc(vs->nvoices, sizeof(bool));
+
+    bool oom = !w->threads || !w->groups || !w->claims || !w->deferred;
+    for (size_t i = 0; i < nthreads && !oom; i++) {
+        atomic_init(&w->groups[i].done, 0);
+        w->groups[i].buf = malloc(max_frames * sizeof(float));
+        w->groups[i].scratch = malloc(jb_patch_scratch(vs->patch) * sizeof(float));
+        oom = !w->groups[i].buf || !w->groups[i].scratch;
+    }
+
+    for (size_t i = 0; i < vs->nvoices && !oom; i++) {
+        atomic_init(&w->claims[i].claimed, 0);
+        atomic_init(&w->claims[i].rendered, 0);
+    }
+
+    if (oom) {
+        workers_stop(w, 0);
+        return JB_ERR(JB_ERR_OOM, "failed to allocate voice workers");
+    }
+
+    for (size_t i = 0; i < nthreads; i++) {
+        worker_arg_t *arg = malloc(sizeof(*arg));
+        if (arg) *arg = (worker_arg_t){w, i};
+
+        int err = arg ? pthread_create(&w->threads[i], NULL, worker_thread, arg) : ENOMEM;
+        if (err) {
+            free(arg);
+            workers_stop(w, i);
+            return JB_ERR_LIBC(err, "failed to start voice worker %zu", i);
+        }
+
+        make_rt(w->threads[i], i);
+    }
+
+    vs->workers = w;
+    return JB_OK_VAL;
+}
+
+static void defer_release(jb_voices_t *vs, size_t i) {
+    vs->workers->deferred[i] = true;
+}
+
+// note offs that arrived while their voice was in flight
+static void release_deferred(jb_voices_t *vs) {
+    struct jb_voice_workers *w = vs->workers;
+
+    for (size_t i = 0; i < vs->nvoices; i++) {
+        if (!w->deferred[i] || voice_busy(vs, i)) continue;
+
+        w->deferred[i] = false;
+        release(vs, &vs->voices[i]);
+    }
+}
+
+// render up to `max_frames` across the workers
+static void render_parallel(jb_voices_t *vs, size_t nframes, float *out) {
+    struct jb_voice_workers *w = vs->workers;
+    size_t ngroups = w->nthreads + 1;
+
+    if (!w->prio_synced) sync_priority(w);
+
+    uint64_t deadline = jb_now() + (uint64_t)(nframes * JB_VOICES_DEADLINE * 1e9 / vs->srate);
+    unsigned gen = atomic_load_explicit(&w->gen, memory_order_relaxed) + 1;
+
+    atomic_store_explicit(&w->nframes, nframes, memory_order_relaxed);
+    atomic_store_explicit(&w->gen, gen, memory_order_release);
+    futex_wake(&w->gen);
+
+    render_group(vs, 0, ngroups, nframes, vs->scratch, out);
+
+    // take over the voices the workers haven't got to yet
+    for (size_t i = 0; i < vs->nvoices; i++) {
+        if (i % ngroups && claim(w, i, gen)) {
+            render_claimed(w, i, gen, nframes, vs->scratch, out);
+            w->inline_voices++;
+        }
+    }
+
+    for (size_t i = 0; i < w->nthreads; i++) {
+        group_t *g = &w->groups[i];
+        bool done;
+
+        // the worker may share our core, so give it the chance to finish
+        while (!(done = atomic_load_explicit(&g->done, memory_order_acquire) == gen) &&
+               jb_now() < deadline)
+            sched_yield();
+
+        if (!done) {
+            w->late++;
+            continue;
+        }
+
+        for (size_t j = 0; j < nframes; j++) out[j] += g->buf[j];
+    }
+
+    w->cycles++;
+}
+
+void jb_voices_render(jb_voices_t *vs, size_t nframes, float *out) {
+    struct jb_voice_workers *w = vs->workers;
+
+    jb_params_tick(&vs->params, nframes);
+    if (w) release_deferred(vs);
+
+    // waking the workers isn't worth it for a few voices
+    if (!w || jb_voices_active(vs) < JB_VOICES_PARALLEL_MIN) {
+        render_group(vs, 0, 1, nframes, vs->scratch, out);
+        return;
+    }
+
+    for (size_t base = 0; base < nframes; base += w->max_frames)
+        render_parallel(vs, JB_MIN(w->max_frames, nframes - base), out + base);
+}
+
+size_t jb_voices_active(const jb_voices_t *vs) {
+    size_t n = 0;
+    for (size_t i = 0; i < vs->nvoices; i++)
+        n += voice_busy(vs, i) || voice_active(&vs->voices[i]);
+
+    return n;
+}
+
+void jb_voices_stats(const jb_voices_t *vs, size_t *cycles, size_t *inline_voices, size_t *late) {
+    const struct jb_voice_workers *w = vs->workers;
+
+    *cycles = w ? w->cycles : 0;
+    *inline_voices = w ? w->inline_voices : 0;
+    *late = w ? w->late : 0;
+}
+
+void jb_voices_free(jb_voices_t *vs) {
+    if (vs->workers) workers_stop(vs->workers, vs->workers->nthreads);
+
+    free(vs->voices);
+    free(vs->states);
+    free(vs->scratch);
+    jb_params_free(&vs->params);
+}
+
+uint32_t jb_voices_add_param(jb_voices_t *vs, float *dst, float smooth) {
+    return jb_params_add(&vs->params, dst, smooth);
+}
+
+void jb_voices_midi(void *state, jb_midi_t ev) {
+    jb_voices_t *vs = state;
+
+    switch (ev.kind) {
+        case JB_NOTE_ON:
+            jb_voices_note_on(vs, ev.args[JB_NOTE], ev.args[JB_VELOCITY]);
+            break;
+        case JB_NOTE_OFF:
+            jb_voices_note_off(vs, ev.args[JB_NOTE]);
+            break;
+        default:
+            break;
+    }
+}
+
+void jb_voices_audio(void *state, jb_ctx_t ctx, size_t nframes, jb_sample_t *buf) {
+    jb_voices_t *vs = state;
+
+    // keep the rate from `jb_voices_init` if the host doesn't give one
+    if (ctx.srate) vs->srate = ctx.srate;
+    jb_voices_render(vs, nframes, buf);
+}
+
+void jb_voices_param(void *state, uint32_t id, float value) {
+    jb_voices_t *vs = state;
+
+    jb_params_set(&vs->params, id, value, vs->srate);
+}